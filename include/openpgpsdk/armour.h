@@ -26,6 +26,8 @@
 #include "signature.h"
 
 unsigned ops_crc24(unsigned checksum,unsigned char c);
+unsigned ops_crc24_update(unsigned checksum,const unsigned char *buf,
+			  size_t length);
 
 void ops_reader_push_dearmour(ops_parse_info_t *parse_info);
 
@@ -22,13 +22,73 @@
 /** \file
  */
 
+#ifndef OPS_COMPRESS_H
+#define OPS_COMPRESS_H
+
 #include "packet-parse.h"
 
+/** What an adaptive compressing writer did with the data */
+typedef enum
+    {
+    OPS_COMPRESS_COMPRESSED, /*!< compressed as asked */
+    OPS_COMPRESS_STORED, /*!< in a compressed packet, but not compressed */
+    OPS_COMPRESS_OMITTED /*!< written without a compressed packet */
+    } ops_compress_decision_t;
+
+/** What a compressing writer did, for tuning when to compress */
+typedef struct
+    {
+    ops_compress_decision_t decision;
+    size_t sample_in; /*!< bytes in the sample */
+    size_t sample_out; /*!< what deflate at level 1 made of them */
+    size_t bytes_in; /*!< bytes written to the writer */
+    size_t bytes_out; /*!< bytes it wrote, packet headers included */
+    } ops_compress_stats_t;
+
+/** How the compressing writers compress */
+typedef struct
+    {
+    ops_compression_type_t algorithm; /*!< ZIP, ZLIB or BZIP2 */
+    int level; /*!< 1 (fastest) to 9 (smallest), or -1 for the
+		 library's default. 0 stores ZIP and ZLIB uncompressed.
+		 For BZIP2 this is the block size, in 100k */
+    int window_bits; /*!< ZIP and ZLIB: the window is 2^window_bits
+		       bytes, from 9 to 15 */
+    int mem_level; /*!< ZIP and ZLIB: memory used for the compression
+		     state, from 1 to 9 */
+    unsigned sample_size; /*!< if not 0, the first sample_size bytes are
+			    deflated at level 1 as a trial, and the data
+			    is only compressed if that shrinks them to
+			    max_ratio percent or less */
+    unsigned max_ratio; /*!< percent */
+    ops_compress_decision_t bypass; /*!< OPS_COMPRESS_STORED or
+				      OPS_COMPRESS_OMITTED: what to do
+				      with data that doesn't compress */
+    ops_compress_stats_t *stats; /*!< if not NULL, what was done is put
+				   here when the writer is finalised */
+    } ops_compress_opts_t;
+
 int ops_decompress(ops_region_t *region,ops_parse_info_t *parse_info,
 		   ops_compression_type_t type);
 
+void ops_compress_opts_init(ops_compress_opts_t *opts);
+
 ops_boolean_t ops_write_compressed(const unsigned char* data,
                                    const unsigned int len,
                                    ops_create_info_t *cinfo);
+ops_boolean_t ops_write_compressed_with_opts(const unsigned char *data,
+					     const unsigned int len,
+					     const ops_compress_opts_t *opts,
+					     ops_create_info_t *cinfo);
 
 void ops_writer_push_compressed(ops_create_info_t *cinfo);
+ops_boolean_t ops_writer_push_compressed_with_opts(ops_create_info_t *cinfo,
+					      const ops_compress_opts_t *opts);
+void ops_writer_push_compressed_parallel(ops_create_info_t *cinfo,
+					 unsigned nthreads);
+ops_boolean_t
+ops_writer_push_compressed_parallel_with_opts(ops_create_info_t *cinfo,
+					      const ops_compress_opts_t *opts,
+					      unsigned nthreads);
+
+#endif
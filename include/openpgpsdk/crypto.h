@@ -29,6 +29,7 @@
 #include "util.h"
 #include "packet.h"
 #include "packet-parse.h"
+#include "compress.h"
 #include <openssl/dsa.h>
 #include <openssl/opensslv.h>
 #include <openssl/opensslconf.h>
@@ -98,6 +99,8 @@ struct _ops_crypt_t
     size_t num; /* Offset - see openssl _encrypt doco */
     void *encrypt_key;
     void *decrypt_key;
+    ops_boolean_t failed; /*!< set if the cipher failed, in which case
+			    its output was zeros */
     };
 
 void ops_crypto_init(void);
@@ -138,8 +141,11 @@ int ops_decrypt_data(ops_content_tag_t tag,ops_region_t *region,
 		     ops_parse_info_t *parse_info);
 
 int ops_crypt_any(ops_crypt_t *decrypt,ops_symmetric_algorithm_t alg);
+void ops_crypt_set_backend(ops_crypt_t *crypt,ops_crypt_backend_t backend);
 void ops_decrypt_init(ops_crypt_t *decrypt);
 void ops_encrypt_init(ops_crypt_t *encrypt);
+void ops_crypt_reset(ops_crypt_t *crypt,const unsigned char *iv);
+void ops_crypt_clone(ops_crypt_t *dest,const ops_crypt_t *src);
 size_t ops_decrypt_se(ops_crypt_t *decrypt,void *out,const void *in,
 		   size_t count);
 size_t ops_encrypt_se(ops_crypt_t *encrypt,void *out,const void *in,
@@ -184,6 +190,11 @@ extern void ops_encrypt_stream(ops_create_info_t* cinfo,
 			       const ops_secret_key_t* secret_key,
 			       const ops_boolean_t compress,
 			       const ops_boolean_t use_armour);
+void ops_encrypt_stream_with_opts(ops_create_info_t *cinfo,
+				  const ops_keydata_t *public_key,
+				  const ops_secret_key_t *secret_key,
+				  const ops_compress_opts_t *compress_opts,
+				  const ops_boolean_t use_armour);
 ops_boolean_t ops_decrypt_memory(const unsigned char *encrypted_memory,
 				 int em_length,
 				 unsigned char **decrypted_memory,
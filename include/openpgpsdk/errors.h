@@ -59,6 +59,8 @@ typedef enum
     OPS_E_P_PACKET_NOT_CONSUMED	=OPS_E_P+5,
     OPS_E_P_DECOMPRESSION_ERROR	=OPS_E_P+6,
     OPS_E_P_NO_USERID			=OPS_E_P+7,
+    OPS_E_P_BAD_PARTIAL_LENGTH		=OPS_E_P+8,
+    OPS_E_P_DECOMPRESSION_LIMIT		=OPS_E_P+9,
 
     /* creator errors */
     OPS_E_C=0x4000,	/* general creator error */
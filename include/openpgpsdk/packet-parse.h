@@ -68,6 +68,14 @@ typedef enum
     OPS_FINISHED
     } ops_parse_cb_return_t;
 
+/** Return values for ops_parse_feed() */
+typedef enum
+    {
+    OPS_PARSE_FEED_ERROR,	/*!< a packet failed to parse */
+    OPS_PARSE_FEED_NEED_MORE,	/*!< every complete packet has been
+				  parsed, the rest needs more input */
+    } ops_parse_feed_t;
+
 typedef struct ops_parse_cb_info ops_parse_cb_info_t;
 
 typedef ops_parse_cb_return_t
@@ -103,6 +111,42 @@ typedef int ops_reader_t(void *dest,size_t length,ops_error_t **errors,
 
 typedef void ops_reader_destroyer_t(ops_reader_info_t *rinfo);
 
+/*
+   A base reader whose data is held contiguously in memory may also
+   provide a borrower. It returns a pointer to the next length bytes
+   in place and consumes them, or NULL (consuming nothing) if there
+   aren't that many left. A length of 0 just returns the current
+   position. The pointer stays valid until the reader is destroyed.
+
+   The parser only borrows while no other reader is stacked above the
+   base one, and does its own accounting for what was borrowed.
+ */
+
+typedef const unsigned char *ops_reader_borrow_t(size_t length,
+						 ops_reader_info_t *rinfo);
+
+/*
+   A reader that holds its data in a buffer, or that can pass through
+   the spans of the reader below it, may also offer that data a span at
+   a time, so that callers can take as much as they like of it without
+   a call through every layer of the stack for each read.
+
+   The peeker sets *span to the next unread data and returns how many
+   bytes there are. Like a reader, it returns 0 at EOF, or stacks an
+   error and returns -1. It consumes nothing: until the consumer is
+   called, peeking again gives the same data.
+
+   The consumer is then given the span and the number of bytes from its
+   start that were used. The span is only valid until the next call to
+   either function.
+ */
+
+typedef int ops_reader_peek_t(const unsigned char **span,ops_error_t **errors,
+			      ops_reader_info_t *rinfo,
+			      ops_parse_cb_info_t *cbinfo);
+typedef void ops_reader_consume_t(const unsigned char *span,size_t length,
+				  ops_reader_info_t *rinfo);
+
 ops_parse_info_t *ops_parse_info_new(void);
 void ops_parse_info_delete(ops_parse_info_t *pinfo);
 ops_error_t *ops_parse_info_get_errors(ops_parse_info_t *pinfo);
@@ -115,6 +159,10 @@ void *ops_parse_cb_get_errors(ops_parse_cb_info_t *cbinfo);
 void ops_reader_set(ops_parse_info_t *pinfo,ops_reader_t *reader,ops_reader_destroyer_t *destroyer,void *arg);
 void ops_reader_push(ops_parse_info_t *pinfo,ops_reader_t *reader,ops_reader_destroyer_t *destroyer,void *arg);
 void ops_reader_pop(ops_parse_info_t *pinfo);
+void ops_reader_set_borrow(ops_parse_info_t *pinfo,ops_reader_borrow_t *borrow);
+void ops_reader_set_span(ops_parse_info_t *pinfo,ops_reader_peek_t *peek,
+			 ops_reader_consume_t *consume);
+ops_boolean_t ops_reader_has_span(ops_parse_info_t *pinfo);
 void *ops_reader_get_arg_from_pinfo(ops_parse_info_t *pinfo);
 
 void *ops_reader_get_arg(ops_reader_info_t *rinfo);
@@ -126,6 +174,11 @@ ops_parse_cb_return_t ops_parse_stacked_cb(const ops_parser_content_t *content,
 ops_reader_info_t *ops_parse_get_rinfo(ops_parse_info_t *pinfo);
 
 int ops_parse(ops_parse_info_t *parse_info);
+ops_parse_feed_t ops_parse_feed(ops_parse_info_t *pinfo,
+				const unsigned char *buf,size_t length);
+int ops_parse_finish(ops_parse_info_t *pinfo);
+ops_boolean_t ops_parse_next(ops_parse_info_t *pinfo,
+			     ops_parser_content_t *content);
 int ops_parse_and_print_errors(ops_parse_info_t *parse_info);
 int ops_parse_and_save_errs(ops_parse_info_t *parse_info,ops_ulong_list_t *errs);
 int ops_parse_errs(ops_parse_info_t *parse_info,ops_ulong_list_t *errs);
@@ -134,6 +187,19 @@ void ops_parse_and_validate(ops_parse_info_t *parse_info);
 
 void ops_parse_options(ops_parse_info_t *pinfo,ops_content_tag_t tag,
 		       ops_parse_type_t type);
+void ops_parse_options_release_before_auth(ops_parse_info_t *pinfo,
+					   ops_boolean_t release);
+void ops_parse_options_literal_chunk_size(ops_parse_info_t *pinfo,
+					  size_t size);
+void ops_parse_options_lazy_mpis(ops_parse_info_t *pinfo,ops_boolean_t lazy);
+void ops_parse_options_decompress_limits(ops_parse_info_t *pinfo,
+					 size_t max_bytes,
+					 unsigned max_expansion,
+					 unsigned max_depth);
+void ops_parse_options_parallel_decrypt(ops_parse_info_t *pinfo,
+					unsigned nthreads,size_t min_size);
+void ops_parse_options_crypt_backend(ops_parse_info_t *pinfo,
+				     ops_crypt_backend_t backend);
 
 ops_boolean_t ops_limited_read(unsigned char *dest,size_t length,
 			       ops_region_t *region,ops_error_t **errors,
@@ -153,6 +219,10 @@ ops_hash_t *ops_parse_hash_find(ops_parse_info_t *pinfo,
 				const unsigned char keyid[OPS_KEY_ID_SIZE]);
 
 ops_reader_t ops_stacked_read;
+int ops_stacked_peek(const unsigned char **span,ops_error_t **errors,
+		     ops_reader_info_t *rinfo,ops_parse_cb_info_t *cbinfo);
+void ops_stacked_consume(const unsigned char *span,size_t length,
+			 ops_reader_info_t *rinfo);
 
 /* vim:set textwidth=120: */
 /* vim:set ts=8: */
@@ -41,6 +41,7 @@ typedef struct
     {
     size_t len;
     unsigned char *contents;
+    ops_boolean_t borrowed; /*!< contents belong to the reader, don't free */
     } ops_data_t;
 
 /************************************/
@@ -151,6 +152,8 @@ typedef struct
 					  length information, not at the same moment we create the packet tag structure.
 					  Only defined if #length_read is set. */  /* XXX: Ben, is this correct? */
     unsigned		position;	/*!< The position (within the current reader) of the packet */
+    unsigned		partial;	/*!< Whether the length is a Partial Body Length - only if this packet tag is new format.
+					  length is then that of the first chunk only. */
     } ops_ptag_t;
 
 /** Public Key Algorithm Numbers.
@@ -248,6 +251,8 @@ typedef struct
 						  used with v3 keys. */
     ops_public_key_algorithm_t	algorithm;	/*!< Public Key Algorithm type */
     ops_public_key_union_t	key;		/*!< Public Key Parameters */
+    ops_data_t			raw_mpis;	/*!< Key parameters as read from the packet, not yet converted to
+						  BIGNUMs; see ops_public_key_materialise() */
     } ops_public_key_t;
 
 /** Structure to hold data for one RSA secret key
@@ -477,6 +482,8 @@ typedef struct
     ops_signature_union_t	signature;	/*!< signature parameters */
     size_t			v4_hashed_data_length;
     unsigned char* 		v4_hashed_data;
+    ops_data_t			raw_mpis;	/*!< signature parameters as read, not yet converted to BIGNUMs;
+						  see ops_signature_materialise() */
     ops_boolean_t		creation_time_set:1;
     ops_boolean_t		signer_id_set:1;
     } ops_signature_info_t;
@@ -604,6 +611,7 @@ typedef struct
     {
     size_t			length;
     unsigned char		*raw;
+    ops_boolean_t		borrowed; /*!< raw belongs to the reader */
     } ops_packet_t;
 
 /** Types of Compression */
@@ -916,9 +924,12 @@ void ops_keyid(unsigned char keyid[OPS_KEY_ID_SIZE],
 void ops_fingerprint(ops_fingerprint_t *fp, const ops_public_key_t *key);
 void ops_public_key_free(ops_public_key_t *key);
 void ops_public_key_copy(ops_public_key_t *dst, const ops_public_key_t *src);
+const ops_public_key_t *ops_public_key_materialise(const ops_public_key_t *key);
 void ops_user_id_free(ops_user_id_t *id);
 void ops_user_attribute_free(ops_user_attribute_t *att);
 void ops_signature_free(ops_signature_t *sig);
+const ops_signature_info_t *
+ops_signature_materialise(const ops_signature_info_t *sig);
 void ops_trust_free(ops_trust_t *trust);
 void ops_ss_preferred_ska_free(ops_ss_preferred_ska_t *ss_preferred_ska);
 void ops_ss_preferred_hash_free(ops_ss_preferred_hash_t *ss_preferred_hash);
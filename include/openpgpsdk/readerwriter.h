@@ -27,6 +27,15 @@
 
 
 void ops_reader_set_fd(ops_parse_info_t *pinfo,int fd);
+
+// Bounds on the read-ahead window of the buffered file reader
+#define OPS_READ_AHEAD_MIN	(64*1024)
+#define OPS_READ_AHEAD_MAX	(4*1024*1024)
+#define OPS_READ_AHEAD_DEFAULT	OPS_READ_AHEAD_MIN
+
+void ops_reader_set_fd_buffered(ops_parse_info_t *pinfo,int fd,size_t window,
+				ops_boolean_t sequential);
+void ops_reader_set_mmap(ops_parse_info_t *pinfo,int fd);
 void ops_reader_set_memory(ops_parse_info_t *pinfo,const void *buffer,
 			   size_t length);
 
@@ -38,6 +47,9 @@ void ops_reader_push_se_ip_data(ops_parse_info_t *pinfo, ops_crypt_t *decrypt,
                                 ops_region_t *region);
 void ops_reader_pop_se_ip_data(ops_parse_info_t* pinfo);
 
+void ops_reader_push_partial(ops_parse_info_t *pinfo,unsigned length);
+ops_boolean_t ops_reader_pop_partial(ops_parse_info_t *pinfo);
+
 //
 ops_boolean_t ops_write_mdc(const unsigned char *hashed,
                                    ops_create_info_t* info);
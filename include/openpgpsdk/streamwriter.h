@@ -26,5 +26,7 @@
 
 void ops_writer_push_stream_encrypt_se_ip(ops_create_info_t *cinfo,
                                           const ops_keydata_t *pub_key);
+void ops_writer_push_stream_encrypt_se_ip_crypt(ops_create_info_t *cinfo,
+						const ops_crypt_t *crypt);
 
 #endif /*__OPS_STREAMWRITER_H__*/
@@ -87,6 +87,8 @@ enum ops_content_tag_t
     OPS_PTAG_RAW_SS			=0x101,	/*!< Internal Use: content is raw sig subtag */
     OPS_PTAG_SS_ALL			=0x102,	/*!< Internal Use: select all subtags */
     OPS_PARSER_PACKET_END		=0x103,
+    OPS_PTAG_RAW_PACKET			=0x104,	/*!< content is the raw body of a packet
+						     set to OPS_PARSE_RAW */
 
     /* signature subpackets (0x200-2ff) (type+0x200) */
     /* only those we can parse are listed here */
@@ -172,6 +174,13 @@ enum ops_parse_type_t
 
 typedef struct _ops_crypt_t ops_crypt_t;
 
+/** How symmetric ciphers are done */
+typedef enum
+    {
+    OPS_CRYPT_BACKEND_LOW_LEVEL, /*!< OpenSSL's per-cipher functions */
+    OPS_CRYPT_BACKEND_EVP /*!< OpenSSL's EVP interface */
+    } ops_crypt_backend_t;
+
 /** ops_hash_t */
 typedef struct _ops_hash_t ops_hash_t;
 
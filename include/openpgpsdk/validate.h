@@ -89,6 +89,10 @@ typedef struct validate_data_cb_arg
     const ops_keyring_t *keyring; /*<! keyring to use */
     validate_reader_arg_t *rarg; /*<! reader-specific arg */
     ops_validate_result_t *result; /*<! where to put the result */
+    struct validate_data_hash *hashes; /*<! running hashes of the Literal
+					 Data, one for each One-Pass
+					 Signature still to be checked */
+    unsigned nhashes;
     } validate_data_cb_arg_t; /*<! used with validate_data_cb callback */
 
 ops_boolean_t ops_check_signature(const unsigned char *hash,
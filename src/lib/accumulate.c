@@ -77,7 +77,11 @@ accumulate_cb(const ops_parser_content_t *content_,ops_parse_cb_info_t *cbinfo)
 
 	keyring->keys[keyring->nkeys].type=content_->tag;
 
-	if(content_->tag == OPS_PTAG_CT_PUBLIC_KEY)
+	if(content_->tag == OPS_PTAG_CT_PUBLIC_KEY
+	   && pkey->raw_mpis.borrowed)
+	    // the keyring outlives the reader the MPIs are borrowed from
+	    ops_public_key_copy(&keyring->keys[keyring->nkeys].key.pkey,pkey);
+	else if(content_->tag == OPS_PTAG_CT_PUBLIC_KEY)
 	    keyring->keys[keyring->nkeys].key.pkey=*pkey;
 	else
 	    keyring->keys[keyring->nkeys].key.skey=content->secret_key;
@@ -99,7 +103,8 @@ accumulate_cb(const ops_parser_content_t *content_,ops_parse_cb_info_t *cbinfo)
 	if(!cur)
 	    return OPS_RELEASE_MEMORY;
 	ops_add_packet_to_keydata(cur, &content->packet);
-	free(content->packet.raw);
+	if(!content->packet.borrowed)
+	    free(content->packet.raw);
 	return OPS_KEEP_MEMORY;
 
     case OPS_PARSER_ERROR:
@@ -25,222 +25,402 @@
 
 #include <zlib.h>
 #include <bzlib.h>
-#include <assert.h>
 #include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #include <openpgpsdk/compress.h>
 #include <openpgpsdk/packet-parse.h>
 #include <openpgpsdk/crypto.h>
 #include <openpgpsdk/errors.h>
+#include <openpgpsdk/readerwriter.h>
 #include "parse_local.h"
 #include <openpgpsdk/final.h>
 #include <openpgpsdk/partial.h>
 
 static const int debug = 0;
 
-#define DECOMPRESS_BUFFER	1024
+#define DECOMPRESS_BUFFER	8192
+#define EXPANSION_ALLOWANCE	65536 /* output not held to max_expansion */
 #define COMPRESS_BUFFER	        32768
 
-typedef struct
-    {
-    ops_compression_type_t type;
-    ops_region_t *region;
-    unsigned char in[DECOMPRESS_BUFFER];
-    unsigned char out[DECOMPRESS_BUFFER];
-    z_stream zstream; // ZIP and ZLIB
-    size_t offset;
-    int inflate_ret;
-    } z_decompress_arg_t;
+typedef struct decompress_arg decompress_arg_t;
+typedef struct compress_arg compress_arg_t;
 
+/* What the compressing writers and the compressed data reader need
+   from each algorithm. The init and end functions return 0 on
+   success, as both libraries do. compress() and decompress() work
+   from next_in to next_out in their arg, and return 1 if there may be
+   more to come, 0 at the end of the stream, or -1 on error. */
 typedef struct
     {
     ops_compression_type_t type;
+    const char *name;
+    int (*decompress_init)(decompress_arg_t *arg);
+    int (*decompress)(decompress_arg_t *arg,ops_error_t **errors);
+    int (*decompress_end)(decompress_arg_t *arg);
+    int (*compress_init)(compress_arg_t *arg,const ops_compress_opts_t *opts);
+    int (*compress)(compress_arg_t *arg,ops_boolean_t finish,
+		    ops_error_t **errors);
+    int (*compress_end)(compress_arg_t *arg);
+    } codec_t;
+
+struct decompress_arg
+    {
+    const codec_t *codec;
     ops_region_t *region;
-    char in[DECOMPRESS_BUFFER];
-    char out[DECOMPRESS_BUFFER];
-    bz_stream bzstream; // BZIP2
-    size_t offset;
-    int inflate_ret;
-    } bz_decompress_arg_t;
+    ops_parse_info_t *pinfo; /*!< for its limits */
+    size_t consumed; /*!< compressed bytes decompressed so far */
+    size_t produced; /*!< bytes they decompressed to */
+    union
+	{
+	z_stream z; // ZIP and ZLIB
+	bz_stream bz; // BZIP2
+	} stream;
+    unsigned char *next_in;
+    unsigned avail_in;
+    unsigned char *next_out;
+    unsigned avail_out;
+    ops_boolean_t ended:1; /*!< set at the end of the stream */
+    ops_boolean_t over_limit:1; /*!< set once a limit is exceeded */
+    unsigned offset; /*!< next byte of out to return */
+    unsigned length; /*!< bytes held in out */
+    unsigned char in[DECOMPRESS_BUFFER];
+    unsigned char out[DECOMPRESS_BUFFER]; /*!< for short reads */
+    };
 
-typedef struct
+struct compress_arg
     {
-    z_stream stream;
-    unsigned char *src;
-    unsigned char *dst;
+    const codec_t *codec;
+    union
+	{
+	z_stream z; // ZIP and ZLIB
+	bz_stream bz; // BZIP2
+	} stream;
+    const unsigned char *next_in;
+    unsigned avail_in;
+    unsigned char *next_out;
+    unsigned avail_out;
+    unsigned char dst[COMPRESS_BUFFER];
     size_t bytes_in;
     size_t bytes_out;
-    } compress_arg_t;
+    };
 
-// \todo remove code duplication between this and bzip2_compressed_data_reader
-static int zlib_compressed_data_reader(void *dest,size_t length,
-				       ops_error_t **errors,
-				       ops_reader_info_t *rinfo,
-				       ops_parse_cb_info_t *cbinfo)
+static int zip_decompress_init(decompress_arg_t *arg)
     {
-    z_decompress_arg_t *arg=ops_reader_get_arg(rinfo);
-    assert(arg->type==OPS_C_ZIP || arg->type==OPS_C_ZLIB);
+    return inflateInit2(&arg->stream.z,-15);
+    }
 
-    //ops_parser_content_t content;
-    int saved=length;
+static int zlib_decompress_init(decompress_arg_t *arg)
+    {
+    return inflateInit(&arg->stream.z);
+    }
 
-    if(/*arg->region->indeterminate && */ arg->inflate_ret == Z_STREAM_END
-       && arg->zstream.next_out == &arg->out[arg->offset])
-        return 0;
+static int zlib_decompress(decompress_arg_t *arg,ops_error_t **errors)
+    {
+    z_stream *z=&arg->stream.z;
+    int ret;
 
-    if(arg->region->length_read == arg->region->length)
-        {
-        if(arg->inflate_ret != Z_STREAM_END)
-            OPS_ERROR(cbinfo->errors, OPS_E_P_DECOMPRESSION_ERROR,
-		      "Compressed data didn't end when region ended.");
-        /*
-          else
-          return 0;
-          www.zlib.org
-        */
-        }
+    z->next_in=arg->next_in;
+    z->avail_in=arg->avail_in;
+    z->next_out=arg->next_out;
+    z->avail_out=arg->avail_out;
+
+    ret=inflate(z,Z_SYNC_FLUSH);
+
+    arg->next_in=z->next_in;
+    arg->avail_in=z->avail_in;
+    arg->next_out=z->next_out;
+    arg->avail_out=z->avail_out;
+
+    if(ret == Z_STREAM_END)
+	return 0;
+    /* no progress is spotted by the reader */
+    if(ret == Z_OK || ret == Z_BUF_ERROR)
+	return 1;
+    OPS_ERROR_1(errors,OPS_E_P_DECOMPRESSION_ERROR,"%s",
+		z->msg ? z->msg : "Bad compressed data");
+    return -1;
+    }
 
-    while(length > 0)
-	{
-	unsigned len;
+static int zlib_decompress_end(decompress_arg_t *arg)
+    {
+    return inflateEnd(&arg->stream.z);
+    }
 
-	if(&arg->out[arg->offset] == arg->zstream.next_out)
-	    {
-	    int ret;
-
-	    arg->zstream.next_out=arg->out;
-	    arg->zstream.avail_out=sizeof arg->out;
-	    arg->offset=0;
-	    if(arg->zstream.avail_in == 0)
-		{
-		unsigned n=arg->region->length;
-
-		if(!arg->region->indeterminate)
-		    {
-		    n-=arg->region->length_read;
-		    if(n > sizeof arg->in)
-			n=sizeof arg->in;
-		    }
-		else
-		    n=sizeof arg->in;
-
-		if(!ops_stacked_limited_read(arg->in,n,arg->region,
-					     errors,rinfo,cbinfo))
-		    return -1;
-
-		arg->zstream.next_in=arg->in;
-		arg->zstream.avail_in=arg->region->indeterminate
-		    ? arg->region->last_read : n;
-		}
-
-	    ret=inflate(&arg->zstream,Z_SYNC_FLUSH);
-	    if(ret == Z_STREAM_END)
-		{
-		if(!arg->region->indeterminate
-		   && arg->region->length_read != arg->region->length)
-		    OPS_ERROR(cbinfo->errors,OPS_E_P_DECOMPRESSION_ERROR,
-			      "Compressed stream ended before packet end.");
-		}
-	    else if(ret != Z_OK)
-		{
-		fprintf(stderr,"ret=%d\n",ret);
-		OPS_ERROR(cbinfo->errors,OPS_E_P_DECOMPRESSION_ERROR, arg->zstream.msg);
-		}
-	    arg->inflate_ret=ret;
-	    }
-	assert(arg->zstream.next_out > &arg->out[arg->offset]);
-	len=arg->zstream.next_out-&arg->out[arg->offset];
-	if(len > length)
-	    len=length;
-	memcpy(dest,&arg->out[arg->offset],len);
-	arg->offset+=len;
-	length-=len;
-	}
+static int bzip2_decompress_init(decompress_arg_t *arg)
+    {
+    return BZ2_bzDecompressInit(&arg->stream.bz,1,0);
+    }
 
-    return saved;
+static int bzip2_decompress(decompress_arg_t *arg,ops_error_t **errors)
+    {
+    bz_stream *bz=&arg->stream.bz;
+    int ret;
+
+    bz->next_in=(char *)arg->next_in;
+    bz->avail_in=arg->avail_in;
+    bz->next_out=(char *)arg->next_out;
+    bz->avail_out=arg->avail_out;
+
+    ret=BZ2_bzDecompress(bz);
+
+    arg->next_in=(unsigned char *)bz->next_in;
+    arg->avail_in=bz->avail_in;
+    arg->next_out=(unsigned char *)bz->next_out;
+    arg->avail_out=bz->avail_out;
+
+    if(ret == BZ_STREAM_END)
+	return 0;
+    if(ret == BZ_OK)
+	return 1;
+    OPS_ERROR_1(errors,OPS_E_P_DECOMPRESSION_ERROR,
+		"Invalid return %d from BZ2_bzDecompress",ret);
+    return -1;
     }
 
-// \todo remove code duplication between this and zlib_compressed_data_reader
-static int bzip2_compressed_data_reader(void *dest,size_t length,
-					ops_error_t **errors,
-					ops_reader_info_t *rinfo,
-					ops_parse_cb_info_t *cbinfo)
+static int bzip2_decompress_end(decompress_arg_t *arg)
+    {
+    return BZ2_bzDecompressEnd(&arg->stream.bz);
+    }
+
+static void zlib_error(ops_error_t **errors, z_stream *stream, int error)
+    {
+    OPS_ERROR_2(errors,OPS_E_FAIL,
+		"Error from compression stream %d (%s)", error,
+		stream->msg == NULL ? "Unknown" :  stream->msg);
+    }
+
+static int zip_compress_init(compress_arg_t *arg,
+			     const ops_compress_opts_t *opts)
     {
-    bz_decompress_arg_t *arg=ops_reader_get_arg(rinfo);
-    assert(arg->type==OPS_C_BZIP2);
+    return deflateInit2(&arg->stream.z,opts->level,Z_DEFLATED,
+			-opts->window_bits,opts->mem_level,
+			Z_DEFAULT_STRATEGY);
+    }
 
-    //ops_parser_content_t content;
-    int saved=length;
+static int zlib_compress_init(compress_arg_t *arg,
+			      const ops_compress_opts_t *opts)
+    {
+    return deflateInit2(&arg->stream.z,opts->level,Z_DEFLATED,
+			opts->window_bits,opts->mem_level,Z_DEFAULT_STRATEGY);
+    }
 
-    if(arg->inflate_ret == BZ_STREAM_END
-       && arg->bzstream.next_out == &arg->out[arg->offset])
-        return 0;
+static int zlib_compress(compress_arg_t *arg,ops_boolean_t finish,
+			 ops_error_t **errors)
+    {
+    z_stream *z=&arg->stream.z;
+    int ret;
 
-    if(arg->region->length_read == arg->region->length)
-        {
-        if(arg->inflate_ret != BZ_STREAM_END)
-            OPS_ERROR(cbinfo->errors, OPS_E_P_DECOMPRESSION_ERROR,
-		      "Compressed data didn't end when region ended.");
-        }
+    z->next_in=(unsigned char *)arg->next_in;
+    z->avail_in=arg->avail_in;
+    z->next_out=arg->next_out;
+    z->avail_out=arg->avail_out;
+
+    ret=deflate(z,finish ? Z_FINISH : Z_NO_FLUSH);
+
+    arg->next_in=z->next_in;
+    arg->avail_in=z->avail_in;
+    arg->next_out=z->next_out;
+    arg->avail_out=z->avail_out;
 
-    while(length > 0)
+    if(ret == Z_STREAM_END)
+	return 0;
+    if(ret == Z_OK || ret == Z_BUF_ERROR)
+	return 1;
+    zlib_error(errors,z,ret);
+    return -1;
+    }
+
+static int zlib_compress_end(compress_arg_t *arg)
+    {
+    return deflateEnd(&arg->stream.z);
+    }
+
+static int bzip2_compress_init(compress_arg_t *arg,
+			       const ops_compress_opts_t *opts)
+    {
+    return BZ2_bzCompressInit(&arg->stream.bz,
+			      opts->level < 0 ? 9 : opts->level,0,0);
+    }
+
+static int bzip2_compress(compress_arg_t *arg,ops_boolean_t finish,
+			  ops_error_t **errors)
+    {
+    bz_stream *bz=&arg->stream.bz;
+    int ret;
+
+    bz->next_in=(char *)arg->next_in;
+    bz->avail_in=arg->avail_in;
+    bz->next_out=(char *)arg->next_out;
+    bz->avail_out=arg->avail_out;
+
+    ret=BZ2_bzCompress(bz,finish ? BZ_FINISH : BZ_RUN);
+
+    arg->next_in=(unsigned char *)bz->next_in;
+    arg->avail_in=bz->avail_in;
+    arg->next_out=(unsigned char *)bz->next_out;
+    arg->avail_out=bz->avail_out;
+
+    if(ret == BZ_STREAM_END)
+	return 0;
+    if(ret == BZ_RUN_OK || ret == BZ_FINISH_OK)
+	return 1;
+    OPS_ERROR_1(errors,OPS_E_FAIL,"Invalid return %d from BZ2_bzCompress",
+		ret);
+    return -1;
+    }
+
+static int bzip2_compress_end(compress_arg_t *arg)
+    {
+    return BZ2_bzCompressEnd(&arg->stream.bz);
+    }
+
+static const codec_t codecs[]=
+    {
+    { OPS_C_ZIP, "ZIP", zip_decompress_init, zlib_decompress,
+      zlib_decompress_end, zip_compress_init, zlib_compress,
+      zlib_compress_end },
+    { OPS_C_ZLIB, "ZLIB", zlib_decompress_init, zlib_decompress,
+      zlib_decompress_end, zlib_compress_init, zlib_compress,
+      zlib_compress_end },
+    { OPS_C_BZIP2, "BZIP2", bzip2_decompress_init, bzip2_decompress,
+      bzip2_decompress_end, bzip2_compress_init, bzip2_compress,
+      bzip2_compress_end },
+    };
+
+static const codec_t *find_codec(ops_compression_type_t type)
+    {
+    unsigned n;
+
+    for(n=0 ; n < sizeof codecs/sizeof *codecs ; ++n)
+	if(codecs[n].type == type)
+	    return &codecs[n];
+    return NULL;
+    }
+
+static int compressed_data_reader(void *dest,size_t length,
+				  ops_error_t **errors,
+				  ops_reader_info_t *rinfo,
+				  ops_parse_cb_info_t *cbinfo)
+    {
+    decompress_arg_t *arg=ops_reader_get_arg(rinfo);
+    ops_parse_info_t *pinfo=arg->pinfo;
+    size_t done=0;
+
+    if(arg->over_limit)
+	return -1;
+    if(arg->ended && arg->offset == arg->length)
+	return 0;
+
+    if(length > INT_MAX)
+	length=INT_MAX;
+
+    while(done < length)
 	{
-	unsigned len;
+	unsigned char *start;
+	unsigned avail_in;
+	int ret;
+
+	if(arg->offset < arg->length)
+	    {
+	    unsigned n=arg->length-arg->offset;
+
+	    if(n > length-done)
+		n=length-done;
+	    memcpy((unsigned char *)dest+done,&arg->out[arg->offset],n);
+	    arg->offset+=n;
+	    done+=n;
+	    continue;
+	    }
+	if(arg->ended)
+	    break;
+
+	/* only short reads go through our own buffer */
+	if(length-done >= sizeof arg->out)
+	    {
+	    arg->next_out=(unsigned char *)dest+done;
+	    arg->avail_out=length-done;
+	    }
+	else
+	    {
+	    arg->next_out=arg->out;
+	    arg->avail_out=sizeof arg->out;
+	    arg->offset=arg->length=0;
+	    }
+	/* don't decompress much past the limit before finding out */
+	if(pinfo->max_decompressed
+	   && arg->avail_out > pinfo->max_decompressed-pinfo->decompressed)
+	    arg->avail_out=pinfo->max_decompressed-pinfo->decompressed+1;
+
+	if(arg->avail_in == 0)
+	    {
+	    unsigned n=sizeof arg->in;
+
+	    if(!arg->region->indeterminate
+	       && n > arg->region->length-arg->region->length_read)
+		n=arg->region->length-arg->region->length_read;
+
+	    if(!ops_stacked_limited_read(arg->in,n,arg->region,
+					 errors,rinfo,cbinfo))
+		return -1;
+
+	    arg->next_in=arg->in;
+	    arg->avail_in=arg->region->indeterminate
+		? arg->region->last_read : n;
+	    }
 
-	if(&arg->out[arg->offset] == arg->bzstream.next_out)
+	start=arg->next_out;
+	avail_in=arg->avail_in;
+	ret=arg->codec->decompress(arg,errors);
+	if(ret < 0)
+	    return -1;
+
+	arg->consumed+=avail_in-arg->avail_in;
+	arg->produced+=arg->next_out-start;
+	pinfo->decompressed+=arg->next_out-start;
+	if(pinfo->max_decompressed
+	   && pinfo->decompressed > pinfo->max_decompressed)
 	    {
-	    int ret;
-
-	    arg->bzstream.next_out=(char *) arg->out;
-	    arg->bzstream.avail_out=sizeof arg->out;
-	    arg->offset=0;
-	    if(arg->bzstream.avail_in == 0)
-		{
-		unsigned n=arg->region->length;
-
-		if(!arg->region->indeterminate)
-		    {
-		    n-=arg->region->length_read;
-		    if(n > sizeof arg->in)
-			n=sizeof arg->in;
-		    }
-		else
-		    n=sizeof arg->in;
-
-		if(!ops_stacked_limited_read(arg->in, n, arg->region, errors,
-					     rinfo, cbinfo))
-		    return -1;
-
-		arg->bzstream.next_in=arg->in;
-		arg->bzstream.avail_in=arg->region->indeterminate
-		    ? arg->region->last_read : n;
-		}
-
-	    ret=BZ2_bzDecompress(&arg->bzstream);
-	    if(ret == BZ_STREAM_END)
-		{
-		if(!arg->region->indeterminate
-		   && arg->region->length_read != arg->region->length)
-		    OPS_ERROR(cbinfo->errors, OPS_E_P_DECOMPRESSION_ERROR,
-			      "Compressed stream ended before packet end.");
-		}
-	    else if(ret != BZ_OK)
-		{
-                OPS_ERROR_1(cbinfo->errors, OPS_E_P_DECOMPRESSION_ERROR,
-			    "Invalid return %d from BZ2_bzDecompress", ret);
-		}
-	    arg->inflate_ret=ret;
+	    OPS_ERROR_1(errors,OPS_E_P_DECOMPRESSION_LIMIT,
+			"Decompressed data is over the limit of %zu bytes",
+			pinfo->max_decompressed);
+	    arg->over_limit=ops_true;
+	    return -1;
 	    }
-	assert(arg->bzstream.next_out > &arg->out[arg->offset]);
-	len=arg->bzstream.next_out-&arg->out[arg->offset];
-	if(len > length)
-	    len=length;
-	memcpy(dest,&arg->out[arg->offset],len);
-	arg->offset+=len;
-	length-=len;
+	if(pinfo->max_expansion && arg->produced > EXPANSION_ALLOWANCE
+	   && arg->produced/pinfo->max_expansion > arg->consumed)
+	    {
+	    OPS_ERROR_1(errors,OPS_E_P_DECOMPRESSION_LIMIT,
+			"Compressed data expands by more than %u times",
+			pinfo->max_expansion);
+	    arg->over_limit=ops_true;
+	    return -1;
+	    }
+	if(ret == 0)
+	    {
+	    arg->ended=ops_true;
+	    if(!arg->region->indeterminate
+	       && arg->region->length_read != arg->region->length)
+		OPS_ERROR(errors,OPS_E_P_DECOMPRESSION_ERROR,
+			  "Compressed stream ended before packet end.");
+	    }
+	else if(arg->next_out == start && arg->avail_in == avail_in)
+	    {
+	    OPS_ERROR(errors,OPS_E_P_DECOMPRESSION_ERROR,
+		      "Compressed data ended early.");
+	    return -1;
+	    }
+
+	if(start == arg->out)
+	    arg->length=arg->next_out-start;
+	else
+	    done+=arg->next_out-start;
 	}
 
-    return saved;
+    return done;
     }
 
 /**
@@ -254,111 +434,249 @@ static int bzip2_compressed_data_reader(void *dest,size_t length,
 int ops_decompress(ops_region_t *region,ops_parse_info_t *parse_info,
 		   ops_compression_type_t type)
     {
-    z_decompress_arg_t z_arg;
-    bz_decompress_arg_t bz_arg;
+    decompress_arg_t *arg;
+    const codec_t *codec;
     int ret;
 
-    switch (type)
+    codec=find_codec(type);
+    if(!codec)
         {
-    case OPS_C_ZIP:
-    case OPS_C_ZLIB:
-        memset(&z_arg,'\0',sizeof z_arg);
-
-        z_arg.region=region;
-        z_arg.offset=0;
-        z_arg.type=type;
-
-        z_arg.zstream.next_in=Z_NULL;
-        z_arg.zstream.avail_in=0;
-        z_arg.zstream.next_out=z_arg.out;
-        z_arg.zstream.zalloc=Z_NULL;
-        z_arg.zstream.zfree=Z_NULL;
-        z_arg.zstream.opaque=Z_NULL;
-        break;
-
-    case OPS_C_BZIP2:
-        memset(&bz_arg,'\0',sizeof bz_arg);
-
-        bz_arg.region=region;
-        bz_arg.offset=0;
-        bz_arg.type=type;
-
-        bz_arg.bzstream.next_in=NULL;
-        bz_arg.bzstream.avail_in=0;
-        bz_arg.bzstream.next_out=bz_arg.out;
-        bz_arg.bzstream.bzalloc=NULL;
-        bz_arg.bzstream.bzfree=NULL;
-        bz_arg.bzstream.opaque=NULL;
-        break;
-
-    default:
         OPS_ERROR_1(&parse_info->errors, OPS_E_ALG_UNSUPPORTED_COMPRESS_ALG,
 		    "Compression algorithm %d is not yet supported", type);
         return 0;
         }
 
-    switch(type)
-        {
-    case OPS_C_ZIP:
-        ret=inflateInit2(&z_arg.zstream,-15);
-        break;
-
-    case OPS_C_ZLIB:
-        ret=inflateInit(&z_arg.zstream);
-        break;
+    if(parse_info->max_compressed_depth
+       && parse_info->compressed_depth >= parse_info->max_compressed_depth)
+	{
+	OPS_ERROR_1(&parse_info->errors,OPS_E_P_DECOMPRESSION_LIMIT,
+		    "Compressed packets are nested more than %u deep",
+		    parse_info->max_compressed_depth);
+	return 0;
+	}
 
-    case OPS_C_BZIP2:
-        /*
-        OPS_ERROR_1(&parse_info->errors, OPS_E_ALG_UNSUPPORTED_COMPRESS_ALG, "Compression algorithm %s is not yet supported", "BZIP2");
-        return 0;
-        */
-        ret=BZ2_bzDecompressInit(&bz_arg.bzstream, 1, 0);
-        break;
+    arg=ops_mallocz(sizeof *arg);
+    arg->codec=codec;
+    arg->region=region;
+    arg->pinfo=parse_info;
 
-    default:
-        OPS_ERROR_1(&parse_info->errors, OPS_E_ALG_UNSUPPORTED_COMPRESS_ALG,
-		    "Compression algorithm %d is not yet supported", type);
-        return 0;
-        }
+    ret=codec->decompress_init(arg);
+    if(ret != 0)
+	{
+	OPS_ERROR_2(&parse_info->errors, OPS_E_P_DECOMPRESSION_ERROR,
+		    "Cannot initialise %s stream for decompression: error=%d",
+		    codec->name,ret);
+	free(arg);
+	return 0;
+	}
 
-    switch (type)
-        {
-    case OPS_C_ZIP:
-    case OPS_C_ZLIB:
-        if(ret != Z_OK)
-            {
-            OPS_ERROR_1(&parse_info->errors, OPS_E_P_DECOMPRESSION_ERROR,
-			"Cannot initialise ZIP or ZLIB stream "
-			"for decompression: error=%d", ret);
-            return 0;
-            }
-        ops_reader_push(parse_info,zlib_compressed_data_reader,NULL,&z_arg);
-        break;
-
-    case OPS_C_BZIP2:
-        if (ret != BZ_OK)
-            {
-            OPS_ERROR_1(&parse_info->errors, OPS_E_P_DECOMPRESSION_ERROR,
-			"Cannot initialise BZIP2 stream "
-			"for decompression: error=%d", ret);
-            return 0;
-            }
-        ops_reader_push(parse_info,bzip2_compressed_data_reader,NULL,&bz_arg);
-        break;
-
-    default:
-        OPS_ERROR_1(&parse_info->errors, OPS_E_ALG_UNSUPPORTED_COMPRESS_ALG,
-		    "Compression algorithm %d is not yet supported", type);
-        return 0;
-        }
+    ops_reader_push(parse_info,compressed_data_reader,NULL,arg);
 
+    ++parse_info->compressed_depth;
     ret=ops_parse(parse_info);
+    --parse_info->compressed_depth;
 
     ops_reader_pop(parse_info);
+    codec->decompress_end(arg);
+    free(arg);
 
     return ret;
     }
 
+/**
+\ingroup Core_WritePackets
+\brief Sets compression options to the defaults.
+
+The defaults are ZLIB at zlib's default level, with a 32k window and
+the default memory level, which is what ops_write_compressed() and
+ops_writer_push_compressed() use. There is no trial: set sample_size
+to only compress data that compresses. 64k samples and a max_ratio of
+90 percent do well on data that is already compressed.
+
+\param opts The options to set
+*/
+void ops_compress_opts_init(ops_compress_opts_t *opts)
+    {
+    opts->algorithm=OPS_C_ZLIB;
+    opts->level=Z_DEFAULT_COMPRESSION;
+    opts->window_bits=15;
+    opts->mem_level=8;
+    opts->sample_size=0;
+    opts->max_ratio=90;
+    opts->bypass=OPS_COMPRESS_OMITTED;
+    opts->stats=NULL;
+    }
+
+/* Set up compression as opts asks, or report why not */
+static ops_boolean_t compress_init(compress_arg_t *arg,
+				   const ops_compress_opts_t *opts,
+				   ops_error_t **errors)
+    {
+    int ret;
+
+    arg->codec=find_codec(opts->algorithm);
+    if(!arg->codec)
+	{
+	OPS_ERROR_1(errors,OPS_E_ALG_UNSUPPORTED_COMPRESS_ALG,
+		    "Compression algorithm %d is not yet supported",
+		    opts->algorithm);
+	return ops_false;
+	}
+    if(opts->level < -1 || opts->level > 9
+       || (opts->algorithm == OPS_C_BZIP2 && opts->level == 0)
+       || opts->window_bits < 9 || opts->window_bits > 15
+       || opts->mem_level < 1 || opts->mem_level > 9)
+	{
+	OPS_ERROR(errors,OPS_E_FAIL,"Bad compression options");
+	return ops_false;
+	}
+
+    ret=arg->codec->compress_init(arg,opts);
+    if(ret != 0)
+	{
+	OPS_ERROR_2(errors,OPS_E_FAIL,
+		    "Cannot initialise %s stream for compression: error=%d",
+		    arg->codec->name,ret);
+	return ops_false;
+	}
+    return ops_true;
+    }
+
+/* Deflate the sample at level 1, and decide from how well it does */
+static ops_compress_decision_t decide(const ops_compress_opts_t *opts,
+				      const unsigned char *sample,
+				      unsigned length,
+				      ops_compress_stats_t *stats)
+    {
+    z_stream stream;
+    unsigned char out[COMPRESS_BUFFER];
+    int ret;
+
+    stats->sample_in=length;
+    stats->sample_out=0;
+    if(!opts->sample_size)
+	return OPS_COMPRESS_COMPRESSED;
+
+    memset(&stream,'\0',sizeof stream);
+    if(deflateInit2(&stream,1,Z_DEFLATED,-15,8,Z_DEFAULT_STRATEGY) != Z_OK)
+	return OPS_COMPRESS_COMPRESSED;
+    stream.next_in=(unsigned char *)sample;
+    stream.avail_in=length;
+    do
+	{
+	stream.next_out=out;
+	stream.avail_out=sizeof out;
+	ret=deflate(&stream,Z_FINISH);
+	stats->sample_out+=sizeof out-stream.avail_out;
+	}
+    while(ret == Z_OK);
+    deflateEnd(&stream);
+
+    if(stats->sample_out*100 <= stats->sample_in*opts->max_ratio)
+	return OPS_COMPRESS_COMPRESSED;
+    return opts->bypass;
+    }
+
+/* The options to compress with once decided, with no trial */
+static void decided_opts(ops_compress_opts_t *decided,
+			 const ops_compress_opts_t *opts,
+			 ops_compress_decision_t decision)
+    {
+    *decided=*opts;
+    decided->sample_size=0;
+    decided->stats=NULL;
+    if(decision == OPS_COMPRESS_STORED)
+	{
+	// bzip2 has no way to store, but deflate does
+	if(decided->algorithm == OPS_C_BZIP2)
+	    decided->algorithm=OPS_C_ZIP;
+	decided->level=0;
+	}
+    }
+
+/* Compress what there is from next_in, or finish the stream, writing
+   out each buffer full */
+static ops_boolean_t compress_and_write(compress_arg_t *arg,
+					ops_boolean_t finish,
+					ops_error_t **errors,
+					ops_writer_info_t *winfo)
+    {
+    int ret;
+
+    do
+	{
+	unsigned n;
+
+	arg->next_out=arg->dst;
+	arg->avail_out=sizeof arg->dst;
+	ret=arg->codec->compress(arg,finish,errors);
+	if(ret < 0)
+	    return ops_false;
+	n=sizeof arg->dst-arg->avail_out;
+	if (debug)
+	    fprintf(stderr, "bytes_to_write = %u\n", n);
+	arg->bytes_out+=n;
+	if(n && !ops_stacked_write(arg->dst,n,errors,winfo))
+	    return ops_false;
+	}
+    while(finish ? ret > 0 : arg->avail_in || arg->avail_out == 0);
+
+    return ops_true;
+    }
+
+static ops_boolean_t stream_compress_writer(const unsigned char *src,
+                                            unsigned length,
+                                            ops_error_t **errors,
+                                            ops_writer_info_t *winfo)
+    {
+    compress_arg_t *arg=ops_writer_get_arg(winfo);
+
+    // ZLib doesn't like being asked to compress nothing, so return if
+    // we are given no input.
+    if (length == 0)
+	return ops_true;
+    if (debug)
+	fprintf(stderr, "Compressing %u bytes\n", length);
+    arg->bytes_in+=length;
+    arg->next_in=src;
+    arg->avail_in=length;
+
+    return compress_and_write(arg,ops_false,errors,winfo);
+    }
+
+static ops_boolean_t stream_compress_finaliser(ops_error_t **errors,
+                                               ops_writer_info_t *winfo)
+    {
+    compress_arg_t *arg=ops_writer_get_arg(winfo);
+
+    arg->next_in=NULL;
+    arg->avail_in=0;
+
+    return compress_and_write(arg,ops_true,errors,winfo);
+    }
+
+static void stream_compress_destroyer(ops_writer_info_t *winfo)
+    {
+    compress_arg_t *arg=ops_writer_get_arg(winfo);
+
+    if (debug)
+	fprintf(stderr, "Compressed %zu to %zu\n", arg->bytes_in,
+		arg->bytes_out);
+    arg->codec->compress_end(arg);
+    free(arg);
+    }
+
+/* The bottom of the stack ops_write_compressed_with_opts() builds:
+   writes to the create info it was given */
+static ops_boolean_t create_info_writer(const unsigned char *src,
+					unsigned length,
+					ops_error_t **errors,
+					ops_writer_info_t *winfo)
+    {
+    OPS_USED(errors);
+    return ops_write(src,length,ops_writer_get_arg(winfo));
+    }
+
 /**
 \ingroup Core_WritePackets
 \brief Writes Compressed packet
@@ -372,53 +690,50 @@ ops_boolean_t ops_write_compressed(const unsigned char *data,
                                    const unsigned int len,
                                    ops_create_info_t *cinfo)
     {
-    int r=0;
-    int sz_in=0;
-    int sz_out=0;
-    compress_arg_t* compress=ops_mallocz(sizeof *compress);
-
-    // compress the data
-    const int level=Z_DEFAULT_COMPRESSION; // \todo allow varying levels
-    compress->stream.zalloc=Z_NULL;
-    compress->stream.zfree=Z_NULL;
-    compress->stream.opaque=NULL;
-
-    // all other fields set to zero by use of ops_mallocz
+    ops_compress_opts_t opts;
 
-    if (deflateInit(&compress->stream,level) != Z_OK)
-        {
-        // can't initialise
-        assert(0);
-        }
-
-    // do necessary transformation
-    // copy input to maintain const'ness of src
-    assert(compress->src==NULL);
-    assert(compress->dst==NULL);
+    ops_compress_opts_init(&opts);
+    return ops_write_compressed_with_opts(data,len,&opts,cinfo);
+    }
 
-    sz_in=len * sizeof (unsigned char);
-    sz_out= (sz_in * 1.01) + 12; // from zlib webpage
-    compress->src=ops_mallocz(sz_in);
-    compress->dst=ops_mallocz(sz_out);
-    memcpy(compress->src,data,len);
+/**
+\ingroup Core_WritePackets
+\brief Writes Compressed packet, compressed as opts says
 
-    // setup stream
-    compress->stream.next_in=compress->src;
-    compress->stream.avail_in=sz_in;
-    compress->stream.total_in=0;
+The packet is written as it is compressed, using partial body
+lengths, so memory use doesn't depend on len.
 
-    compress->stream.next_out=compress->dst;
-    compress->stream.avail_out=sz_out;
-    compress->stream.total_out=0;
+\param data Data to write out
+\param len Length of data
+\param opts How to compress it
+\param cinfo Write settings
+\return ops_true if OK; else ops_false
+*/
+ops_boolean_t ops_write_compressed_with_opts(const unsigned char *data,
+					     const unsigned int len,
+					     const ops_compress_opts_t *opts,
+					     ops_create_info_t *cinfo)
+    {
+    ops_create_info_t *packet;
+    ops_boolean_t ret;
+
+    // stream it through a stack of our own that writes to cinfo, so
+    // only a buffer's worth is held at a time
+    packet=ops_create_info_new();
+    ops_writer_set(packet,create_info_writer,NULL,NULL,cinfo);
+    if(!ops_writer_push_compressed_with_opts(packet,opts))
+	{
+	ops_move_errors(packet,&cinfo->errors);
+	ops_create_info_delete(packet);
+	return ops_false;
+	}
 
-    r=deflate(&compress->stream, Z_FINISH);
-    assert(r==Z_STREAM_END); // need to loop if not
+    ret=ops_write(data,len,packet);
+    ret=ops_writer_close(packet) && ret;
 
-    // write it out
-    return (ops_write_ptag(OPS_PTAG_CT_COMPRESSED, cinfo)
-            && ops_write_length(1+compress->stream.total_out, cinfo)
-            && ops_write_scalar(OPS_C_ZLIB,1,cinfo)
-            && ops_write(compress->dst, compress->stream.total_out,cinfo));
+    ops_move_errors(packet,&cinfo->errors);
+    ops_create_info_delete(packet);
+    return ret;
     }
 
 
@@ -428,151 +743,631 @@ ops_boolean_t ops_write_compressed(const unsigned char *data,
 static ops_boolean_t write_compressed_header(ops_create_info_t *info,
                                              void *header_data)
     {
-    OPS_USED(header_data);
-    // Write the compression type. Currently we just use ZLIB
-    ops_write_scalar(OPS_C_ZLIB, 1, info);
+    const codec_t *codec=header_data;
+
+    // Write the compression type.
+    ops_write_scalar(codec->type, 1, info);
     return ops_true;
     }
 
-static void zlib_error(ops_error_t **errors, z_stream *stream, int error)
+static ops_boolean_t push_compressed(ops_create_info_t *cinfo,
+				     const ops_compress_opts_t *opts);
+static ops_boolean_t push_parallel(ops_create_info_t *cinfo,
+				   const ops_compress_opts_t *opts,
+				   unsigned nthreads);
+static ops_boolean_t push_adaptive(ops_create_info_t *cinfo,
+				   const ops_compress_opts_t *opts,
+				   ops_boolean_t parallel,unsigned nthreads);
+
+/**
+\ingroup Core_WritePackets
+\brief Pushes a compressed writer onto the stack. Data written
+       will be encoded as a compressed packet.
+\param cinfo Write settings
+*/
+void ops_writer_push_compressed(ops_create_info_t *cinfo)
     {
-    OPS_ERROR_2(errors,OPS_E_FAIL,
-		"Error from compression stream %d (%s)", error,
-		stream->msg == NULL ? "Unknown" :  stream->msg);
+    ops_compress_opts_t opts;
+
+    ops_compress_opts_init(&opts);
+    ops_writer_push_compressed_with_opts(cinfo,&opts);
     }
 
-static ops_boolean_t stream_compress_writer(const unsigned char *src,
-                                            unsigned length,
-                                            ops_error_t **errors,
-                                            ops_writer_info_t *winfo)
+/**
+\ingroup Core_WritePackets
+\brief Pushes a compressed writer onto the stack, compressing as
+       opts says. Data written will be encoded as a compressed packet.
+
+If opts has a sample_size, the data is held back until there is that
+much of it, or it ends, and then compressed or not as the trial
+decides. If it is not compressed and opts says to omit the compressed
+packet, the data is written out as it is.
+
+\param cinfo Write settings
+\param opts How to compress
+\return ops_false if opts can't be used, with the reason in cinfo's
+	errors; else ops_true
+*/
+ops_boolean_t ops_writer_push_compressed_with_opts(ops_create_info_t *cinfo,
+					       const ops_compress_opts_t *opts)
     {
-    // ZLib doesn't like being asked to compress nothing, so return if
-    // we are given no input.
-    if (length == 0)
-	return ops_true;
-    if (debug)
-	fprintf(stderr, "Compressing %u bytes\n", length);
-    compress_arg_t* compress = ops_writer_get_arg(winfo);
-    compress->bytes_in += length;
-    compress->stream.next_in = (void*) src;
-    compress->stream.avail_in = length;
-    ops_boolean_t result = ops_true;
-    do
+    if(opts->sample_size || opts->stats)
+	return push_adaptive(cinfo,opts,ops_false,0);
+    return push_compressed(cinfo,opts);
+    }
+
+static ops_boolean_t push_compressed(ops_create_info_t *cinfo,
+				     const ops_compress_opts_t *opts)
+    {
+    // This is a streaming writer, so we don't know the length in
+    // advance. Use a partial writer to handle the partial body
+    // packet lengths.
+    compress_arg_t *arg=ops_mallocz(sizeof *arg);
+
+    if(!compress_init(arg,opts,&cinfo->errors))
 	{
-	compress->stream.next_out = compress->dst;
-	compress->stream.avail_out = COMPRESS_BUFFER;
-	int retcode = deflate(&compress->stream, Z_NO_FLUSH);
-	if (retcode != Z_OK)
-	    {
-	    zlib_error(errors, &compress->stream, retcode);
-	    deflateEnd(&compress->stream);
-	    return ops_false;
-	    }
-	unsigned bytes_to_write = COMPRESS_BUFFER - compress->stream.avail_out;
-	if (debug)
-	    fprintf(stderr, "bytes_to_write = %u\n", bytes_to_write);
-	compress->bytes_out += bytes_to_write;
-	result = ops_stacked_write(compress->dst, bytes_to_write, errors,
-				   winfo);
+	free(arg);
+	return ops_false;
 	}
-    while (result && compress->stream.avail_out == 0);
 
-    return result;
+    ops_writer_push_partial(COMPRESS_BUFFER,
+			    cinfo, OPS_PTAG_CT_COMPRESSED,
+			    write_compressed_header, (void *)arg->codec);
+    ops_writer_push(cinfo,stream_compress_writer,stream_compress_finaliser,
+		    stream_compress_destroyer,arg);
+    return ops_true;
     }
 
-static ops_boolean_t stream_compress_finaliser(ops_error_t **errors,
-                                               ops_writer_info_t *winfo)
+/* Parallel compression: the input is cut into blocks which are
+   deflated on worker threads, each primed with the end of the block
+   before as its dictionary. All but the last end with a sync flush,
+   so their output, concatenated in order, is one deflate stream. */
+
+#define PARALLEL_BLOCK		131072
+#define DICTIONARY_SIZE		32768
+
+typedef struct deflate_job
     {
-    compress_arg_t* compress = ops_writer_get_arg(winfo);
-    compress->stream.next_in = NULL;
-    compress->stream.avail_in = 0;
-    int retcode = Z_OK;
-    int output_size = COMPRESS_BUFFER;
-    ops_boolean_t result = ops_true;
-    do
+    unsigned char *in;
+    unsigned in_length;
+    unsigned char dictionary[DICTIONARY_SIZE];
+    unsigned dictionary_length;
+    ops_boolean_t last:1; /*!< finish the stream with this block */
+    ops_boolean_t done:1;
+    int error; /*!< from zlib, Z_OK if none */
+    unsigned char *out;
+    unsigned out_length;
+    unsigned long adler; /*!< of this block's input */
+    struct deflate_job *next_queued; /*!< waiting for a worker */
+    struct deflate_job *next; /*!< in the order of the output */
+    } deflate_job_t;
+
+typedef struct
+    {
+    ops_compress_opts_t opts; /*!< ZIP or ZLIB */
+    unsigned nthreads;
+    pthread_t *threads;
+    pthread_mutex_t lock;
+    pthread_cond_t work; /*!< signalled when a job is queued */
+    pthread_cond_t done; /*!< signalled when a job is done */
+    ops_boolean_t stop:1; /*!< tells the workers to exit */
+    ops_boolean_t started:1; /*!< the zlib header has been written */
+    deflate_job_t *queue;
+    deflate_job_t **queue_end;
+    deflate_job_t *pending; /*!< jobs not yet written out */
+    deflate_job_t **pending_end;
+    unsigned npending;
+    unsigned char *block; /*!< the block being filled */
+    unsigned block_length;
+    unsigned char dictionary[DICTIONARY_SIZE]; /*!< end of the last block */
+    unsigned dictionary_length;
+    unsigned long adler;
+    } parallel_compress_arg_t;
+
+static void deflate_block(deflate_job_t *job,const ops_compress_opts_t *opts)
+    {
+    z_stream stream;
+    unsigned size;
+    int flush=job->last ? Z_FINISH : Z_SYNC_FLUSH;
+
+    memset(&stream,'\0',sizeof stream);
+    job->error=deflateInit2(&stream,opts->level,Z_DEFLATED,
+			    -opts->window_bits,opts->mem_level,
+			    Z_DEFAULT_STRATEGY);
+    if(job->error != Z_OK)
+	return;
+    if(job->dictionary_length)
+	deflateSetDictionary(&stream,job->dictionary,job->dictionary_length);
+
+    /* leave room for the sync flush too */
+    size=deflateBound(&stream,job->in_length)+16;
+    job->out=malloc(size);
+    stream.next_in=job->in;
+    stream.avail_in=job->in_length;
+    stream.next_out=job->out;
+    stream.avail_out=size;
+    while((job->error=deflate(&stream,flush)) == Z_OK
+	  && stream.avail_out == 0)
+	{
+	job->out=realloc(job->out,size*2);
+	stream.next_out=job->out+size;
+	stream.avail_out=size;
+	size*=2;
+	}
+    if(job->error == Z_STREAM_END)
+	job->error=Z_OK;
+
+    job->out_length=stream.next_out-job->out;
+    job->adler=adler32(adler32(0L,Z_NULL,0),job->in,job->in_length);
+    deflateEnd(&stream);
+    }
+
+static void *deflate_worker(void *arg_)
+    {
+    parallel_compress_arg_t *arg=arg_;
+
+    pthread_mutex_lock(&arg->lock);
+    for( ; ; )
+	{
+	deflate_job_t *job;
+
+	while(!arg->queue && !arg->stop)
+	    pthread_cond_wait(&arg->work,&arg->lock);
+	if(!arg->queue)
+	    break;
+	job=arg->queue;
+	arg->queue=job->next_queued;
+	if(!arg->queue)
+	    arg->queue_end=&arg->queue;
+	pthread_mutex_unlock(&arg->lock);
+
+	deflate_block(job,&arg->opts);
+
+	pthread_mutex_lock(&arg->lock);
+	job->done=ops_true;
+	pthread_cond_broadcast(&arg->done);
+	}
+    pthread_mutex_unlock(&arg->lock);
+
+    return NULL;
+    }
+
+static void free_deflate_job(deflate_job_t *job)
+    {
+    free(job->in);
+    free(job->out);
+    free(job);
+    }
+
+/* Write out the oldest job, waiting for it if need be */
+static ops_boolean_t write_deflate_job(parallel_compress_arg_t *arg,
+				       ops_error_t **errors,
+				       ops_writer_info_t *winfo)
+    {
+    deflate_job_t *job;
+    ops_boolean_t ret;
+
+    pthread_mutex_lock(&arg->lock);
+    job=arg->pending;
+    while(!job->done)
+	pthread_cond_wait(&arg->done,&arg->lock);
+    arg->pending=job->next;
+    if(!arg->pending)
+	arg->pending_end=&arg->pending;
+    --arg->npending;
+    pthread_mutex_unlock(&arg->lock);
+
+    if(job->error != Z_OK)
 	{
-	compress->stream.next_out = compress->dst;
-	compress->stream.avail_out = output_size;
-	retcode = deflate(&compress->stream, Z_FINISH);
-	if (retcode != Z_STREAM_END && retcode != Z_OK)
+	OPS_ERROR_1(errors,OPS_E_FAIL,"Error %d from compression stream",
+		    job->error);
+	free_deflate_job(job);
+	return ops_false;
+	}
+
+    if(!arg->started && arg->opts.algorithm == OPS_C_ZLIB)
+	{
+	/* the zlib header: deflate, the window size, and the level */
+	unsigned header=(Z_DEFLATED+((arg->opts.window_bits-8) << 4)) << 8;
+	unsigned char c[2];
+	int level=arg->opts.level;
+
+	if(level == Z_DEFAULT_COMPRESSION || level == 6)
+	    header|=2 << 6;
+	else if(level >= 7)
+	    header|=3 << 6;
+	else if(level >= 2)
+	    header|=1 << 6;
+	header+=31-header%31;
+	c[0]=header >> 8;
+	c[1]=header;
+	arg->started=ops_true;
+	if(!ops_stacked_write(c,2,errors,winfo))
 	    {
-	    zlib_error(errors, &compress->stream, retcode);
-	    deflateEnd(&compress->stream);
+	    free_deflate_job(job);
 	    return ops_false;
 	    }
-	int bytes_to_write = output_size - compress->stream.avail_out;
-	if (debug)
-	    fprintf(stderr, "At end, bytes_to_write = %u\n", bytes_to_write);
-	compress->bytes_out += bytes_to_write;
-	result = ops_stacked_write(compress->dst, bytes_to_write, errors,
-				   winfo);
-
-	// If deflate returns Z_OK after we have asked to flush, it means
-	// that there was not enough space in the output buffer. Increase
-	// the buffer size and try again.
-	if (retcode != Z_STREAM_END)
-	    {
-	    if (debug)
-		fprintf(stderr, "Reallocating %u\n", output_size * 2);
-	    output_size *= 2;
-	    compress->dst = realloc(compress->dst, output_size);
-	    }
 	}
-    while (result && retcode != Z_STREAM_END);
-  
-    int error = deflateEnd(&compress->stream);
-    if (error != Z_OK)
+
+    arg->adler=adler32_combine(arg->adler,job->adler,job->in_length);
+    ret=ops_stacked_write(job->out,job->out_length,errors,winfo);
+    free_deflate_job(job);
+
+    return ret;
+    }
+
+/* Hand the block being filled to the workers, or deflate it here if
+   there are none */
+static ops_boolean_t queue_deflate_job(parallel_compress_arg_t *arg,
+				       ops_boolean_t last,ops_error_t **errors,
+				       ops_writer_info_t *winfo)
+    {
+    deflate_job_t *job=ops_mallocz(sizeof *job);
+
+    job->in=arg->block;
+    job->in_length=arg->block_length;
+    job->last=last;
+    memcpy(job->dictionary,arg->dictionary,arg->dictionary_length);
+    job->dictionary_length=arg->dictionary_length;
+
+    /* only the last block can be short */
+    if(!last)
+	{
+	memcpy(arg->dictionary,arg->block+PARALLEL_BLOCK-DICTIONARY_SIZE,
+	       DICTIONARY_SIZE);
+	arg->dictionary_length=DICTIONARY_SIZE;
+	arg->block=malloc(PARALLEL_BLOCK);
+	}
+    else
+	arg->block=NULL;
+    arg->block_length=0;
+
+    if(!arg->nthreads)
+	{
+	deflate_block(job,&arg->opts);
+	job->done=ops_true;
+	}
+
+    pthread_mutex_lock(&arg->lock);
+    if(!job->done)
+	{
+	*arg->queue_end=job;
+	arg->queue_end=&job->next_queued;
+	pthread_cond_signal(&arg->work);
+	}
+    *arg->pending_end=job;
+    arg->pending_end=&job->next;
+    ++arg->npending;
+    pthread_mutex_unlock(&arg->lock);
+
+    /* keep the workers busy, but no more than that in memory */
+    while(arg->npending > 2*arg->nthreads)
+	if(!write_deflate_job(arg,errors,winfo))
+	    return ops_false;
+
+    return ops_true;
+    }
+
+static ops_boolean_t parallel_compress_writer(const unsigned char *src,
+					      unsigned length,
+					      ops_error_t **errors,
+					      ops_writer_info_t *winfo)
+    {
+    parallel_compress_arg_t *arg=ops_writer_get_arg(winfo);
+
+    while(length)
 	{
-	zlib_error(errors, &compress->stream, error);
+	unsigned n=PARALLEL_BLOCK-arg->block_length;
+
+	if(n > length)
+	    n=length;
+	memcpy(arg->block+arg->block_length,src,n);
+	arg->block_length+=n;
+	src+=n;
+	length-=n;
+
+	if(arg->block_length == PARALLEL_BLOCK
+	   && !queue_deflate_job(arg,ops_false,errors,winfo))
+	    return ops_false;
+	}
+
+    return ops_true;
+    }
+
+static ops_boolean_t parallel_compress_finaliser(ops_error_t **errors,
+						 ops_writer_info_t *winfo)
+    {
+    parallel_compress_arg_t *arg=ops_writer_get_arg(winfo);
+    unsigned char c[4];
+
+    if(!queue_deflate_job(arg,ops_true,errors,winfo))
 	return ops_false;
+    while(arg->pending)
+	if(!write_deflate_job(arg,errors,winfo))
+	    return ops_false;
+
+    /* ZIP is bare deflate */
+    if(arg->opts.algorithm != OPS_C_ZLIB)
+	return ops_true;
+    c[0]=arg->adler >> 24;
+    c[1]=arg->adler >> 16;
+    c[2]=arg->adler >> 8;
+    c[3]=arg->adler;
+    return ops_stacked_write(c,4,errors,winfo);
+    }
+
+static void parallel_compress_destroyer(ops_writer_info_t *winfo)
+    {
+    parallel_compress_arg_t *arg=ops_writer_get_arg(winfo);
+    unsigned n;
+
+    pthread_mutex_lock(&arg->lock);
+    arg->stop=ops_true;
+    pthread_cond_broadcast(&arg->work);
+    pthread_mutex_unlock(&arg->lock);
+    for(n=0 ; n < arg->nthreads ; ++n)
+	pthread_join(arg->threads[n],NULL);
+
+    while(arg->pending)
+	{
+	deflate_job_t *job=arg->pending;
+
+	arg->pending=job->next;
+	free_deflate_job(job);
 	}
-    return result;
+    pthread_cond_destroy(&arg->done);
+    pthread_cond_destroy(&arg->work);
+    pthread_mutex_destroy(&arg->lock);
+    free(arg->threads);
+    free(arg->block);
+    free(arg);
     }
 
-static void stream_compress_destroyer(ops_writer_info_t *winfo)
+/**
+\ingroup Core_WritePackets
+\brief Pushes a compressed writer that compresses on several threads.
+
+Like ops_writer_push_compressed(), but the data is compressed in
+blocks of 128k, several at a time. Each block uses the end of the
+one before as its dictionary, so compression is nearly as good, and
+the result is an ordinary ZLIB compressed packet. Memory use is about
+two blocks per thread.
+
+\param cinfo Write settings
+\param nthreads Number of threads to compress on, or 0 for one per CPU
+*/
+void ops_writer_push_compressed_parallel(ops_create_info_t *cinfo,
+					 unsigned nthreads)
     {
-    compress_arg_t* compress = ops_writer_get_arg(winfo);
-    if (debug)
-	fprintf(stderr, "Compressed %zu to %zu\n", compress->bytes_in,
-		compress->bytes_out);
-    free(compress->dst);
-    free(compress);
+    ops_compress_opts_t opts;
+
+    ops_compress_opts_init(&opts);
+    ops_writer_push_compressed_parallel_with_opts(cinfo,&opts,nthreads);
     }
 
 /**
 \ingroup Core_WritePackets
-\brief Pushes a compressed writer onto the stack. Data written
-       will be encoded as a compressed packet.
+\brief Pushes a compressed writer that compresses on several threads,
+       as opts says.
+
+ZIP and ZLIB are compressed as ops_writer_push_compressed_parallel()
+does. BZIP2 blocks can't be split this way, so it gets the ordinary
+compressed writer. A sample_size in opts works as it does for
+ops_writer_push_compressed_with_opts().
+
 \param cinfo Write settings
+\param opts How to compress
+\param nthreads Number of threads to compress on, or 0 for one per CPU
+\return ops_false if opts can't be used, with the reason in cinfo's
+	errors; else ops_true
 */
-void ops_writer_push_compressed(ops_create_info_t *cinfo)
+ops_boolean_t
+ops_writer_push_compressed_parallel_with_opts(ops_create_info_t *cinfo,
+					      const ops_compress_opts_t *opts,
+					      unsigned nthreads)
     {
-    // This is a streaming writer, so we don't know the length in
-    // advance. Use a partial writer to handle the partial body
-    // packet lengths.
+    if(opts->sample_size || opts->stats)
+	return push_adaptive(cinfo,opts,ops_true,nthreads);
+    return push_parallel(cinfo,opts,nthreads);
+    }
+
+static ops_boolean_t push_parallel(ops_create_info_t *cinfo,
+				   const ops_compress_opts_t *opts,
+				   unsigned nthreads)
+    {
+    parallel_compress_arg_t *arg;
+    compress_arg_t check;
+    unsigned n;
+
+    if(opts->algorithm == OPS_C_BZIP2)
+	return push_compressed(cinfo,opts);
+
+    /* find out now if zlib will take the options */
+    memset(&check,'\0',sizeof check);
+    if(!compress_init(&check,opts,&cinfo->errors))
+	return ops_false;
+    check.codec->compress_end(&check);
+
+    if(!nthreads)
+	{
+	long ncpus=sysconf(_SC_NPROCESSORS_ONLN);
+
+	nthreads=ncpus > 0 ? ncpus : 1;
+	}
+
     ops_writer_push_partial(COMPRESS_BUFFER,
 			    cinfo, OPS_PTAG_CT_COMPRESSED,
-			    write_compressed_header, NULL);
-
-    // Create arg to be used with this writer
-    // Remember to free this in the destroyer
-    compress_arg_t *compress = ops_mallocz(sizeof *compress);
-
-    compress->dst = malloc(COMPRESS_BUFFER);
-    const int level=Z_DEFAULT_COMPRESSION; // \todo allow varying levels
-    compress->stream.zalloc=Z_NULL;
-    compress->stream.zfree=Z_NULL;
-    compress->stream.opaque=NULL;
-    compress->stream.avail_out = COMPRESS_BUFFER;
-    // all other fields set to zero by use of ops_mallocz
-
-    if (deflateInit(&compress->stream, level) != Z_OK)
-	// can't initialise. Is there a better way to handle this?
-	assert(0);
-
-    // And push writer on stack
-    ops_writer_push(cinfo, stream_compress_writer, stream_compress_finaliser,
-		    stream_compress_destroyer, compress);
+			    write_compressed_header, (void *)check.codec);
+
+    arg=ops_mallocz(sizeof *arg);
+    arg->opts=*opts;
+    pthread_mutex_init(&arg->lock,NULL);
+    pthread_cond_init(&arg->work,NULL);
+    pthread_cond_init(&arg->done,NULL);
+    arg->queue_end=&arg->queue;
+    arg->pending_end=&arg->pending;
+    arg->block=malloc(PARALLEL_BLOCK);
+    arg->adler=adler32(0L,Z_NULL,0);
+
+    /* if no threads will start, blocks are compressed as they fill */
+    arg->threads=malloc(nthreads*sizeof *arg->threads);
+    for(n=0 ; n < nthreads ; ++n)
+	if(pthread_create(&arg->threads[n],NULL,deflate_worker,arg) != 0)
+	    break;
+    arg->nthreads=n;
+
+    ops_writer_push(cinfo,parallel_compress_writer,
+		    parallel_compress_finaliser,parallel_compress_destroyer,
+		    arg);
+    return ops_true;
+    }
+
+/* Adaptive compression: the start of the data is held back as a
+   sample until the trial decides what to do with it, and then it and
+   the rest go through a stack of their own, set up as decided, which
+   writes to the writer below this one. */
+
+typedef struct
+    {
+    ops_compress_opts_t opts;
+    ops_boolean_t parallel:1; /*!< compress with push_parallel() */
+    unsigned nthreads;
+    ops_create_info_t *decided; /*!< NULL until decided */
+    ops_writer_info_t *winfo; /*!< this writer, while it writes */
+    unsigned char *sample;
+    unsigned sample_length;
+    ops_compress_stats_t stats;
+    } adaptive_compress_arg_t;
+
+static ops_boolean_t decided_writer(const unsigned char *src,
+				    unsigned length,
+				    ops_error_t **errors,
+				    ops_writer_info_t *winfo)
+    {
+    adaptive_compress_arg_t *arg=ops_writer_get_arg(winfo);
+
+    arg->stats.bytes_out+=length;
+    return ops_stacked_write(src,length,errors,arg->winfo);
+    }
+
+/* Decide, set up for it, and write out the sample */
+static ops_boolean_t adaptive_decide(adaptive_compress_arg_t *arg,
+				     ops_error_t **errors)
+    {
+    ops_compress_opts_t decided;
+    ops_boolean_t ret=ops_true;
+
+    arg->stats.decision=decide(&arg->opts,arg->sample,arg->sample_length,
+			       &arg->stats);
+    decided_opts(&decided,&arg->opts,arg->stats.decision);
+
+    arg->decided=ops_create_info_new();
+    ops_writer_set(arg->decided,decided_writer,NULL,NULL,arg);
+    if(arg->stats.decision == OPS_COMPRESS_COMPRESSED && arg->parallel)
+	ret=push_parallel(arg->decided,&decided,arg->nthreads);
+    else if(arg->stats.decision != OPS_COMPRESS_OMITTED)
+	ret=push_compressed(arg->decided,&decided);
+
+    ret=ret && ops_write(arg->sample,arg->sample_length,arg->decided);
+    ops_move_errors(arg->decided,errors);
+    free(arg->sample);
+    arg->sample=NULL;
+
+    return ret;
+    }
+
+static ops_boolean_t adaptive_compress_writer(const unsigned char *src,
+					      unsigned length,
+					      ops_error_t **errors,
+					      ops_writer_info_t *winfo)
+    {
+    adaptive_compress_arg_t *arg=ops_writer_get_arg(winfo);
+    ops_boolean_t ret;
+
+    arg->winfo=winfo;
+    arg->stats.bytes_in+=length;
+    if(!arg->decided)
+	{
+	unsigned n=arg->opts.sample_size-arg->sample_length;
+
+	if(n > length)
+	    n=length;
+	memcpy(arg->sample+arg->sample_length,src,n);
+	arg->sample_length+=n;
+	src+=n;
+	length-=n;
+	if(arg->sample_length < arg->opts.sample_size)
+	    return ops_true;
+	if(!adaptive_decide(arg,errors))
+	    return ops_false;
+	}
+
+    ret=ops_write(src,length,arg->decided);
+    ops_move_errors(arg->decided,errors);
+    return ret;
+    }
+
+static ops_boolean_t adaptive_compress_finaliser(ops_error_t **errors,
+						 ops_writer_info_t *winfo)
+    {
+    adaptive_compress_arg_t *arg=ops_writer_get_arg(winfo);
+    ops_boolean_t ret;
+
+    arg->winfo=winfo;
+    if(!arg->decided && !adaptive_decide(arg,errors))
+	{
+	// still finalise what was set up
+	ops_writer_close(arg->decided);
+	ops_move_errors(arg->decided,errors);
+	return ops_false;
+	}
+
+    ret=ops_writer_close(arg->decided);
+    ops_move_errors(arg->decided,errors);
+    if(arg->opts.stats)
+	*arg->opts.stats=arg->stats;
+    return ret;
+    }
+
+static void adaptive_compress_destroyer(ops_writer_info_t *winfo)
+    {
+    adaptive_compress_arg_t *arg=ops_writer_get_arg(winfo);
+
+    if(arg->decided)
+	ops_create_info_delete(arg->decided);
+    free(arg->sample);
+    free(arg);
+    }
+
+static ops_boolean_t push_adaptive(ops_create_info_t *cinfo,
+				   const ops_compress_opts_t *opts,
+				   ops_boolean_t parallel,unsigned nthreads)
+    {
+    adaptive_compress_arg_t *arg;
+    compress_arg_t check;
+
+    // find out now if the options will do
+    if(opts->bypass != OPS_COMPRESS_STORED
+       && opts->bypass != OPS_COMPRESS_OMITTED)
+	{
+	OPS_ERROR(&cinfo->errors,OPS_E_FAIL,"Bad compression options");
+	return ops_false;
+	}
+    memset(&check,'\0',sizeof check);
+    if(!compress_init(&check,opts,&cinfo->errors))
+	return ops_false;
+    check.codec->compress_end(&check);
+
+    arg=ops_mallocz(sizeof *arg);
+    arg->opts=*opts;
+    arg->parallel=parallel;
+    arg->nthreads=nthreads;
+    arg->sample=malloc(opts->sample_size ? opts->sample_size : 1);
+
+    ops_writer_push(cinfo,adaptive_compress_writer,
+		    adaptive_compress_finaliser,adaptive_compress_destroyer,
+		    arg);
+    return ops_true;
     }
 
 // EOF
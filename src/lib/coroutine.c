@@ -0,0 +1,195 @@
+/*
+ * Copyright (c) 2005-2008 Nominet UK (www.nic.uk)
+ * All rights reserved.
+ * Contributors: Ben Laurie, Rachel Willmer. The Contributors have asserted
+ * their moral rights under the UK Copyright Design and Patents Act 1988 to
+ * be recorded as the authors of this copyright work.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** \file
+ * Suspending the parser.
+ *
+ * The parser pulls its input and pushes what it finds to callbacks,
+ * all on one call stack. To hand control back to the caller in the
+ * middle of a packet, as ops_parse_feed() and ops_parse_next() do, it
+ * is run on a stack of its own, which is switched away from and back
+ * to. No threads are involved.
+ */
+
+#include <openpgpsdk/util.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <stdint.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#include "parse_local.h"
+
+#include <openpgpsdk/final.h>
+
+/* room for the parser, nested packets and all, and the callbacks it
+ * calls; pages are only used as they are touched */
+#define STACK_SIZE	(1024*1024)
+
+struct ops_coroutine
+    {
+    ops_coroutine_fn_t *fn;
+    void *arg;
+#ifdef WIN32
+    LPVOID fiber;
+    LPVOID caller;
+#else
+    ucontext_t context;
+    ucontext_t caller; /*!< where the last resume came from */
+    void *stack; /*!< mapped, with a guard page at the bottom */
+    size_t stack_size;
+#endif
+    ops_boolean_t running:1;
+    ops_boolean_t done:1; /*!< set once fn has returned */
+    };
+
+#ifdef WIN32
+
+static void WINAPI fiber_main(LPVOID co_)
+    {
+    ops_coroutine_t *co=co_;
+
+    co->fn(co->arg);
+    co->done=ops_true;
+    /* a fiber must not return */
+    for( ; ; )
+	SwitchToFiber(co->caller);
+    }
+
+#else
+
+/* makecontext() only passes ints, so the pointer comes in halves */
+static void context_main(unsigned hi,unsigned lo)
+    {
+    ops_coroutine_t *co=(ops_coroutine_t *)(((uintptr_t)hi << 16 << 16)
+					    |lo);
+
+    co->fn(co->arg);
+    co->done=ops_true;
+    /* returns to uc_link, which is co->caller */
+    }
+
+#endif
+
+/*
+ * Set up fn(arg) to run on a stack of its own; nothing runs until the
+ * first ops_coroutine_resume(). Returns NULL if there is no memory for
+ * the stack.
+ */
+ops_coroutine_t *ops_coroutine_new(ops_coroutine_fn_t *fn,void *arg)
+    {
+    ops_coroutine_t *co=ops_mallocz(sizeof *co);
+#ifndef WIN32
+    size_t page=sysconf(_SC_PAGESIZE);
+    uintptr_t p=(uintptr_t)co;
+#endif
+
+    co->fn=fn;
+    co->arg=arg;
+
+#ifdef WIN32
+    co->fiber=CreateFiber(STACK_SIZE,fiber_main,co);
+    if(!co->fiber)
+	{
+	free(co);
+	return NULL;
+	}
+#else
+    co->stack_size=STACK_SIZE+page;
+    co->stack=mmap(NULL,co->stack_size,PROT_READ|PROT_WRITE,
+		   MAP_PRIVATE|MAP_ANON,-1,0);
+    if(co->stack == MAP_FAILED)
+	{
+	free(co);
+	return NULL;
+	}
+    /* so that running off the end faults rather than corrupts */
+    mprotect(co->stack,page,PROT_NONE);
+
+    getcontext(&co->context);
+    co->context.uc_stack.ss_sp=(char *)co->stack+page;
+    co->context.uc_stack.ss_size=STACK_SIZE;
+    co->context.uc_link=&co->caller;
+    makecontext(&co->context,(void (*)())context_main,2,
+		(unsigned)(p >> 16 >> 16),(unsigned)p);
+#endif
+
+    return co;
+    }
+
+/* Run until the coroutine yields (ops_true) or returns (ops_false) */
+ops_boolean_t ops_coroutine_resume(ops_coroutine_t *co)
+    {
+#ifdef WIN32
+    ops_boolean_t converted;
+#endif
+
+    assert(!co->running);
+    if(co->done)
+	return ops_false;
+
+    co->running=ops_true;
+#ifdef WIN32
+    converted=!IsThreadAFiber();
+    co->caller=converted ? ConvertThreadToFiber(NULL) : GetCurrentFiber();
+    SwitchToFiber(co->fiber);
+    if(converted)
+	ConvertFiberToThread();
+#else
+    swapcontext(&co->caller,&co->context);
+#endif
+    co->running=ops_false;
+
+    return !co->done;
+    }
+
+/* From within the coroutine, go back to whoever resumed it */
+void ops_coroutine_yield(ops_coroutine_t *co)
+    {
+    assert(co->running);
+#ifdef WIN32
+    SwitchToFiber(co->caller);
+#else
+    swapcontext(&co->context,&co->caller);
+#endif
+    }
+
+/* Anything still on the stack is lost, so fn should have returned */
+void ops_coroutine_delete(ops_coroutine_t *co)
+    {
+    if(!co)
+	return;
+    assert(!co->running);
+#ifdef WIN32
+    DeleteFiber(co->fiber);
+#else
+    munmap(co->stack,co->stack_size);
+#endif
+    free(co);
+    }
+
+/* eof */
@@ -122,6 +122,9 @@ static unsigned mpi_length(const BIGNUM *bn)
 
 static unsigned public_key_length(const ops_public_key_t *key)
     {
+    if(key->raw_mpis.len)
+	return key->raw_mpis.len;
+
     switch(key->algorithm)
 	{
     case OPS_PKA_RSA:
@@ -185,6 +188,10 @@ static ops_boolean_t write_public_key_body(const ops_public_key_t *key,
     if(!ops_write_scalar(key->algorithm,1,info))
 	return ops_false;
 
+    /* still in packet format if the key was parsed lazily */
+    if(key->raw_mpis.len)
+	return ops_write(key->raw_mpis.contents,key->raw_mpis.len,info);
+
     switch(key->algorithm)
 	{
     case OPS_PKA_DSA:
@@ -404,8 +411,7 @@ static ops_boolean_t write_secret_key_body(const ops_secret_key_t *key,
 
     ops_writer_pop(info);
 
-    free(crypt.encrypt_key);
-    free(crypt.decrypt_key);
+    crypt.decrypt_finish(&crypt);
 
     return ops_true;
     }
@@ -907,7 +913,7 @@ ops_boolean_t encode_m_buf(const unsigned char *M, size_t mLen,
     
     assert(pkey->algorithm == OPS_PKA_RSA);
 
-    k=BN_num_bytes(pkey->key.rsa.n);
+    k=BN_num_bytes(ops_public_key_materialise(pkey)->key.rsa.n);
     assert(mLen <= k-11);
     if (mLen > k-11)
         {
@@ -970,11 +976,15 @@ ops_pk_session_key_t *ops_create_pk_session_key(const ops_keydata_t *key)
 #define SZ_UNENCODED_M_BUF CAST_KEY_LENGTH+1+2
     unsigned char unencoded_m_buf[SZ_UNENCODED_M_BUF];
 
-    const size_t sz_encoded_m_buf=BN_num_bytes(pub_key->key.rsa.n);
-    unsigned char* encoded_m_buf = ops_mallocz(sz_encoded_m_buf);
+    size_t sz_encoded_m_buf;
+    unsigned char* encoded_m_buf;
 
     ops_pk_session_key_t *session_key=ops_mallocz(sizeof *session_key);
 
+    pub_key=ops_public_key_materialise(pub_key);
+    sz_encoded_m_buf=BN_num_bytes(pub_key->key.rsa.n);
+    encoded_m_buf=ops_mallocz(sz_encoded_m_buf);
+
     assert(key->type == OPS_PTAG_CT_PUBLIC_KEY);
     session_key->version=OPS_PKSK_V3;
     memcpy(session_key->key_id, key->key_id, sizeof session_key->key_id);
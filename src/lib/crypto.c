@@ -128,6 +128,7 @@ ops_boolean_t ops_rsa_encrypt_mpi(const unsigned char *encoded_m_buf,
 				  const ops_public_key_t *pkey,
 				  ops_pk_session_key_parameters_t *skp)
     {
+    pkey=ops_public_key_materialise(pkey);
     assert(sz_encoded_m_buf==(size_t) BN_num_bytes(pkey->key.rsa.n));
 
     unsigned char encmpibuf[8192];
@@ -258,11 +259,39 @@ extern void ops_encrypt_stream(ops_create_info_t* cinfo,
                                const ops_boolean_t compress,
                                const ops_boolean_t use_armour)
     {
+    ops_compress_opts_t opts;
+
+    ops_compress_opts_init(&opts);
+    ops_encrypt_stream_with_opts(cinfo, public_key, secret_key,
+				 compress ? &opts : NULL, use_armour);
+    }
+
+/**
+   \ingroup HighLevel_Crypto
+   Encrypt a signed stream, compressed as compress_opts says.
+
+   As ops_encrypt_stream(), but with a choice of how to compress. To
+   only compress data that compresses, set a sample_size in
+   compress_opts.
+   \param cinfo the structure describing where the output will be written.
+   \param public_key the key used to encrypt the data
+   \param secret_key the key used to sign the data. If NULL, the data
+          will not be signed
+   \param compress_opts How to compress the stream, or NULL not to
+   \param use_armour Write armoured text, if set
+   \sa ops_compress_opts_init()
+*/
+void ops_encrypt_stream_with_opts(ops_create_info_t *cinfo,
+				  const ops_keydata_t *public_key,
+				  const ops_secret_key_t *secret_key,
+				  const ops_compress_opts_t *compress_opts,
+				  const ops_boolean_t use_armour)
+    {
     if (use_armour)
 	ops_writer_push_armoured_message(cinfo);
     ops_writer_push_stream_encrypt_se_ip(cinfo, public_key);
-    if (compress)
-	ops_writer_push_compressed(cinfo);
+    if (compress_opts)
+	ops_writer_push_compressed_with_opts(cinfo, compress_opts);
     if (secret_key != NULL)
 	ops_writer_push_signed(cinfo, OPS_SIG_BINARY, secret_key);
     else
@@ -62,6 +62,8 @@ static ops_errcode_name_map_t errcode_name_map[] =
     ERRNAME(OPS_E_P_UNKNOWN_TAG),
     ERRNAME(OPS_E_P_PACKET_CONSUMED),
     ERRNAME(OPS_E_P_MPI_FORMAT_ERROR),
+    ERRNAME(OPS_E_P_BAD_PARTIAL_LENGTH),
+    ERRNAME(OPS_E_P_DECOMPRESSION_LIMIT),
 
     ERRNAME(OPS_E_C),
 
@@ -56,6 +56,7 @@ void ops_fingerprint(ops_fingerprint_t *fp,const ops_public_key_t *key)
 	int n;
 	ops_hash_t md5;
 
+	key=ops_public_key_materialise(key);
 	assert(key->algorithm == OPS_PKA_RSA
 	       || key->algorithm == OPS_PKA_RSA_ENCRYPT_ONLY
 	       || key->algorithm == OPS_PKA_RSA_SIGN_ONLY );
@@ -118,8 +119,10 @@ void ops_keyid(unsigned char keyid[8],const ops_public_key_t *key)
     if(key->version == 2 || key->version == 3)
 	{
 	unsigned char bn[8192];
-	unsigned n=BN_num_bytes(key->key.rsa.n);
+	unsigned n;
 
+	key=ops_public_key_materialise(key);
+	n=BN_num_bytes(key->key.rsa.n);
 	assert(n <= sizeof bn);
 	assert(key->algorithm == OPS_PKA_RSA
 	       || key->algorithm == OPS_PKA_RSA_ENCRYPT_ONLY
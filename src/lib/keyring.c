@@ -132,6 +132,7 @@ void ops_copy_packet(ops_packet_t* dst, const ops_packet_t* src)
     if (dst->raw)
         free(dst->raw);
     dst->raw=ops_mallocz(src->length);
+    dst->borrowed=ops_false;
 
     dst->length=src->length;
     memcpy(dst->raw, src->raw, src->length);
@@ -692,7 +693,7 @@ ops_boolean_t ops_keyring_read_from_file(ops_keyring_t *keyring, const ops_boole
         return ops_false;
         }
 
-    ops_reader_set_fd(pinfo,fd);
+    ops_reader_set_mmap(pinfo,fd);
 
     ops_parse_cb_set(pinfo,cb_keyring_read,NULL);
 
@@ -49,11 +49,18 @@
 #endif
 #include <errno.h>
 #include <limits.h>
+#include <pthread.h>
 
 #include <openpgpsdk/final.h>
 
 static int debug=0;
 
+/* default for how much of a literal data packet to deliver at once */
+#define LITERAL_CHUNK_SIZE	8192
+
+static const unsigned char *limited_borrow(size_t length,ops_region_t *region,
+					   ops_parse_info_t *pinfo);
+
 /**
  * limited_read_data reads the specified amount of the subregion's data 
  * into a data_t structure
@@ -72,13 +79,30 @@ static int limited_read_data(ops_data_t *data,unsigned int len,
 
     assert(subregion->length-subregion->length_read >= len);
 
+    if(len)
+	{
+	const unsigned char *borrowed=limited_borrow(len,subregion,pinfo);
+
+	if(borrowed)
+	    {
+	    data->contents=(unsigned char *)borrowed;
+	    data->borrowed=ops_true;
+	    return 1;
+	    }
+	}
+
+    data->borrowed=ops_false;
     data->contents=malloc(data->len);
     if (!data->contents)
 	return 0;
 
     if (!ops_limited_read(data->contents, data->len,subregion,&pinfo->errors,
 			  &pinfo->rinfo,&pinfo->cbinfo))
+	{
+	free(data->contents);
+	data->contents=NULL;
 	return 0;
+	}
     
     return 1;
     }
@@ -179,16 +203,86 @@ void ops_init_subregion(ops_region_t *subregion,ops_region_t *region)
  * \sa #ops_reader_ret_t for details of return codes
  */
 
+/* Account for n bytes just read into src. If in_place is set, it is
+ * where those bytes live in the base reader's buffer, and if they
+ * follow on from what we have already accumulated we need not copy
+ * them. */
+static void account_read(const unsigned char *src,size_t n,
+			 const unsigned char *in_place,
+			 ops_reader_info_t *rinfo)
+    {
+    if(rinfo->accumulate)
+	{
+	if(in_place && rinfo->alength == 0)
+	    {
+	    if(!rinfo->accumulated_borrowed)
+		free(rinfo->accumulated);
+	    rinfo->accumulated=(unsigned char *)in_place;
+	    rinfo->asize=0;
+	    rinfo->accumulated_borrowed=ops_true;
+	    }
+	else if(!in_place || !rinfo->accumulated_borrowed
+		|| rinfo->accumulated+rinfo->alength != in_place)
+	    {
+	    if(rinfo->accumulated_borrowed)
+		{
+		unsigned char *copy=malloc(rinfo->alength);
+
+		memcpy(copy,rinfo->accumulated,rinfo->alength);
+		rinfo->accumulated=copy;
+		rinfo->asize=rinfo->alength;
+		rinfo->accumulated_borrowed=ops_false;
+		}
+	    assert(rinfo->asize >= rinfo->alength);
+	    if(rinfo->alength+n > rinfo->asize)
+		{
+		rinfo->asize=rinfo->asize*2+n;
+		rinfo->accumulated=realloc(rinfo->accumulated,rinfo->asize);
+		}
+	    assert(rinfo->asize >= rinfo->alength+n);
+	    memcpy(rinfo->accumulated+rinfo->alength,src,n);
+	    }
+	}
+    // we track length anyway, because it is used for packet offsets
+    rinfo->alength+=n;
+    // and also the position
+    rinfo->position+=n;
+    }
+
 static int sub_base_read(void *dest,size_t length,ops_error_t **errors,
 			 ops_reader_info_t *rinfo,ops_parse_cb_info_t *cbinfo)
     {
     size_t n;
+    const unsigned char *in_place=NULL;
 
     /* reading more than this would look like an error */
     if(length > INT_MAX)
 	length=INT_MAX;
 
-    for(n=0 ; n < length ; )
+    if(rinfo->accumulate && rinfo->borrow)
+	in_place=rinfo->borrow(0,rinfo);
+
+    if(rinfo->peek)
+	{
+	/* one trip down the stack per span rather than per read */
+	for(n=0 ; n < length ; )
+	    {
+	    const unsigned char *span;
+	    int r=rinfo->peek(&span,errors,rinfo,cbinfo);
+
+	    if(r < 0)
+		return r;
+	    if(r == 0)
+		break;
+
+	    if((size_t)r > length-n)
+		r=length-n;
+	    memcpy((char *)dest+n,span,r);
+	    rinfo->consume(span,r,rinfo);
+	    n+=r;
+	    }
+	}
+    else for(n=0 ; n < length ; )
 	{
 	int r=rinfo->reader((char*)dest+n,length-n,errors,rinfo,cbinfo);
 
@@ -207,21 +301,58 @@ static int sub_base_read(void *dest,size_t length,ops_error_t **errors,
     if(n == 0)
 	return 0;
 
-    if(rinfo->accumulate)
+    account_read(dest,n,in_place,rinfo);
+
+    return n;
+    }
+
+/* As sub_base_read(), but borrows the data in place rather than
+ * copying it. Returns NULL if the reader can't lend the whole
+ * length. */
+static const unsigned char *sub_base_borrow(size_t length,
+					    ops_reader_info_t *rinfo)
+    {
+    const unsigned char *data;
+
+    if(!rinfo->borrow || length == 0 || length > INT_MAX)
+	return NULL;
+
+    data=rinfo->borrow(length,rinfo);
+    if(!data)
+	return NULL;
+
+    account_read(data,length,data,rinfo);
+
+    return data;
+    }
+
+/* As sub_base_read(), but throws the data away. The reader must have
+ * spans, so that nothing need be copied (unless we are accumulating). */
+static int sub_base_skip(size_t length,ops_error_t **errors,
+			 ops_reader_info_t *rinfo,ops_parse_cb_info_t *cbinfo)
+    {
+    size_t n;
+
+    assert(rinfo->peek);
+    if(length > INT_MAX)
+	length=INT_MAX;
+
+    for(n=0 ; n < length ; )
 	{
-	assert(rinfo->asize >= rinfo->alength);
-	if(rinfo->alength+n > rinfo->asize)
-	    {
-	    rinfo->asize=rinfo->asize*2+n;
-	    rinfo->accumulated=realloc(rinfo->accumulated,rinfo->asize);
-	    }
-	assert(rinfo->asize >= rinfo->alength+n);
-	memcpy(rinfo->accumulated+rinfo->alength,dest,n);
+	const unsigned char *span;
+	int r=rinfo->peek(&span,errors,rinfo,cbinfo);
+
+	if(r < 0)
+	    return r;
+	if(r == 0)
+	    break;
+
+	if((size_t)r > length-n)
+	    r=length-n;
+	rinfo->consume(span,r,rinfo);
+	account_read(span,r,rinfo->borrow ? span : NULL,rinfo);
+	n+=r;
 	}
-    // we track length anyway, because it is used for packet offsets
-    rinfo->alength+=n;
-    // and also the position
-    rinfo->position+=n;
 
     return n;
     }
@@ -230,6 +361,42 @@ int ops_stacked_read(void *dest,size_t length,ops_error_t **errors,
 		     ops_reader_info_t *rinfo,ops_parse_cb_info_t *cbinfo)
     { return sub_base_read(dest,length,errors,rinfo->next,cbinfo); }
 
+/**
+ * \ingroup Core_Readers
+ * \brief Peeks at the next span of the reader below this one
+ *
+ * For use by readers that pass spans through, or that want to
+ * consume a span at a time themselves. The reader below must have
+ * spans (see ops_reader_has_span()).
+ */
+int ops_stacked_peek(const unsigned char **span,ops_error_t **errors,
+		     ops_reader_info_t *rinfo,ops_parse_cb_info_t *cbinfo)
+    {
+    assert(rinfo->next->peek);
+    return rinfo->next->peek(span,errors,rinfo->next,cbinfo);
+    }
+
+/**
+ * \ingroup Core_Readers
+ * \brief Consumes data peeked with ops_stacked_peek()
+ *
+ * This accounts for the data exactly as if it had been read with
+ * ops_stacked_read().
+ */
+void ops_stacked_consume(const unsigned char *span,size_t length,
+			 ops_reader_info_t *rinfo)
+    {
+    ops_reader_info_t *next=rinfo->next;
+    const unsigned char *in_place=NULL;
+
+    if(length == 0)
+	return;
+    if(next->accumulate && next->borrow)
+	in_place=next->borrow(0,next);
+    next->consume(span,length,next);
+    account_read(span,length,in_place,next);
+    }
+
 /* This will do a full read so long as length < MAX_INT */
 static int base_read(unsigned char *dest,size_t length,
 		     ops_parse_info_t *pinfo)
@@ -283,20 +450,17 @@ static size_t full_read(unsigned char *dest,size_t length,int *last_read,
 static ops_boolean_t _read_scalar(unsigned *result,unsigned length,
 				    ops_parse_info_t *pinfo)
     {
+    unsigned char c[sizeof *result];
     unsigned t=0;
+    unsigned n;
 
     assert (length <= sizeof(*result));
 
-    while(length--)
-	{
-	unsigned char c[1];
-	int r;
+    if(base_read(c,length,pinfo) != (int)length)
+	return ops_false;
 
-	r=base_read(c,1,pinfo);
-	if(r != 1)
-	    return ops_false;
-	t=(t << 8)+c[0];
-	}
+    for(n=0 ; n < length ; ++n)
+	t=(t << 8)+c[n];
 
     *result=t;
     return ops_true;
@@ -328,6 +492,18 @@ static ops_boolean_t _read_scalar(unsigned *result,unsigned length,
  * \param cbinfo	Callback info
  * \return		ops_true on success, ops_false on error
  */
+/* Account for length bytes read from region and its parents */
+static void region_read(ops_region_t *region,size_t length)
+    {
+    region->last_read=length;
+    do
+	{
+	region->length_read+=length;
+	assert(!region->parent || region->length <= region->parent->length);
+	}
+    while((region=region->parent));
+    }
+
 ops_boolean_t ops_limited_read(unsigned char *dest,size_t length,
 			       ops_region_t *region,ops_error_t **errors,
 			       ops_reader_info_t *rinfo,
@@ -356,17 +532,38 @@ ops_boolean_t ops_limited_read(unsigned char *dest,size_t length,
 	return ops_false;
 	}
 
-    region->last_read=r;
-    do
-	{
-	region->length_read+=r;
-	assert(!region->parent || region->length <= region->parent->length);
-	}
-    while((region=region->parent));
+    region_read(region,r);
 
     return ops_true;
     }
 
+/**
+ * As ops_limited_read(), but returns a pointer to the data in the
+ * base reader's buffer instead of copying it. Only possible for
+ * regions of known length, and only if the reader in rinfo can lend
+ * its data (see #ops_reader_borrow_t).
+ *
+ * \return Pointer to the data, or NULL if it could not be borrowed
+ * (in which case nothing has been read)
+ */
+static const unsigned char *limited_borrow(size_t length,ops_region_t *region,
+					   ops_parse_info_t *pinfo)
+    {
+    const unsigned char *data;
+
+    if(region->indeterminate
+       || region->length_read+length > region->length)
+	return NULL;
+
+    data=sub_base_borrow(length,&pinfo->rinfo);
+    if(!data)
+	return NULL;
+
+    region_read(region,length);
+
+    return data;
+    }
+
 /**
    \ingroup Core_ReadPackets
    \brief Call ops_limited_read on next in stack
@@ -402,7 +599,9 @@ static ops_boolean_t exact_limited_read(unsigned char *dest,unsigned length,
 
 /** Skip over length bytes of this packet.
  *
- * Calls limited_read() to skip over some data.
+ * If the reader has spans, the data is consumed in place; otherwise
+ * calls limited_read() to skip over it. For an indeterminate region,
+ * skips to the end and ignores length.
  *
  * This function makes sure to respect packet boundaries.
  *
@@ -416,11 +615,38 @@ static int limited_skip(unsigned length,ops_region_t *region,
     {
     unsigned char buf[8192];
 
+    if(region->indeterminate)
+	length=UINT_MAX;
+    else if(region->length_read+length > region->length)
+	{
+	OPS_ERROR(&pinfo->errors,OPS_E_P_NOT_ENOUGH_DATA,"Not enough data");
+	return 0;
+	}
+
     while(length)
 	{
-	int n=length%8192;
-	if(!limited_read(buf,n,region,pinfo))
+	unsigned n=length < sizeof buf ? length : sizeof buf;
+
+	if(pinfo->rinfo.peek)
+	    {
+	    int r=sub_base_skip(length,&pinfo->errors,&pinfo->rinfo,
+				&pinfo->cbinfo);
+
+	    if(r < 0 || (r == 0 && !region->indeterminate))
+		{
+		OPS_ERROR(&pinfo->errors,OPS_E_R_READ_FAILED,"Read failed");
+		return 0;
+		}
+	    region_read(region,r);
+	    n=r;
+	    }
+	else if(!limited_read(buf,n,region,pinfo))
 	    return 0;
+	else if(region->indeterminate)
+	    n=region->last_read;
+
+	if(n == 0)
+	    break;
 	length-=n;
 	}
     return 1;
@@ -542,6 +768,76 @@ static int limited_read_time(time_t *dest,ops_region_t *region,
         }
     }
 
+/**
+\ingroup Core_Create
+\brief Free allocated memory
+*/
+static void data_free(ops_data_t *data)
+    {
+    if(!data->borrowed)
+	free(data->contents);
+    data->contents=NULL;
+    data->len=0;
+    }
+
+/* Check the most significant byte of an MPI of bits bits, at buf */
+static int mpi_check(const unsigned char *buf,unsigned bits,
+		     ops_parse_info_t *pinfo)
+    {
+    unsigned nonzero;
+
+    nonzero=bits&7; /* there should be this many zero bits in the MS byte */
+    if(!nonzero)
+	nonzero=8;
+
+    if(!bits || (buf[0] >> nonzero) != 0 || !(buf[0]&(1 << (nonzero-1))))
+	{
+	OPS_ERROR(&pinfo->errors,OPS_E_P_MPI_FORMAT_ERROR,"MPI Format error");  /* XXX: Ben, one part of this constraint does not apply to encrypted MPIs the draft says. -- peter */
+	return 0;
+	}
+
+    return 1;
+    }
+
+/* Read the bit count of an MPI */
+static int limited_read_mpi_bits(unsigned *bits,ops_region_t *region,
+				 ops_parse_info_t *pinfo)
+    {
+    ops_boolean_t ret;
+
+    pinfo->reading_mpi_length=ops_true;
+    ret=limited_read_scalar(bits,2,region,pinfo);
+    pinfo->reading_mpi_length=ops_false;
+
+    return ret;
+    }
+
+/**
+ * \ingroup Core_MPI
+ * Read the bit count and the bytes of an MPI into \a buf, checking
+ * the MPI is properly formed.
+ *
+ * \param buf		At least 8192 bytes
+ * \param bits	The bit count of the MPI
+ * \return		1 on success, 0 on error
+ */
+static int limited_read_mpi_bytes(unsigned char *buf,unsigned *bits,
+				  ops_region_t *region,ops_parse_info_t *pinfo)
+    {
+    unsigned length;
+
+    if(!limited_read_mpi_bits(bits,region,pinfo))
+	return 0;
+
+    length=(*bits+7)/8;
+
+    assert(length <= 8192);
+    if(!limited_read(buf,length,region,pinfo))
+	return 0;
+
+    return mpi_check(buf,*bits,pinfo);
+    }
+
 /** 
  * \ingroup Core_MPI
  * Read a multiprecision integer.
@@ -569,53 +865,144 @@ static int limited_read_time(time_t *dest,ops_region_t *region,
 static int limited_read_mpi(BIGNUM **pbn,ops_region_t *region,
 			    ops_parse_info_t *pinfo)
     {
-    unsigned length;
-    unsigned nonzero;
+    unsigned bits;
     unsigned char buf[8192]=""; /* an MPI has a 2 byte length part.  Length
                                 is given in bits, so the largest we should
                                 ever need for the buffer is 8192 bytes. */
-    ops_boolean_t ret;
-
-    pinfo->reading_mpi_length=ops_true;
-    ret=limited_read_scalar(&length,2,region,pinfo);
 
-    pinfo->reading_mpi_length=ops_false;
-    if(!ret)
+    if(!limited_read_mpi_bytes(buf,&bits,region,pinfo))
 	return 0;
 
-    nonzero=length&7; /* there should be this many zero bits in the MS byte */
-    if(!nonzero)
-	nonzero=8;
-    length=(length+7)/8;
+    *pbn=BN_bin2bn(buf,(bits+7)/8,NULL);
+    return 1;
+    }
 
-    assert(length <= 8192);
-    if(!limited_read(buf,length,region,pinfo))
-	return 0;
+/*
+ * Add the next length bytes of the packet to raw, borrowing them in
+ * place if the reader can lend them, as it can everything up to them,
+ * or else reading them. Returns a pointer to them, or NULL on error.
+ */
+static const unsigned char *raw_mpis_extend(ops_data_t *raw,unsigned length,
+					    ops_region_t *region,
+					    ops_parse_info_t *pinfo)
+    {
+    if(raw->borrowed)
+	{
+	const unsigned char *data=limited_borrow(length,region,pinfo);
+
+	if(data)
+	    {
+	    if(!raw->len)
+		raw->contents=(unsigned char *)data;
+	    assert(data == raw->contents+raw->len);
+	    raw->len+=length;
+	    return data;
+	    }
+
+	// copy what we have, and read from here on
+	data=raw->contents;
+	raw->contents=malloc(raw->len+length);
+	if(raw->len)
+	    memcpy(raw->contents,data,raw->len);
+	raw->borrowed=ops_false;
+	}
+    else
+	raw->contents=realloc(raw->contents,raw->len+length);
+
+    if(!limited_read(raw->contents+raw->len,length,region,pinfo))
+	return NULL;
+    raw->len+=length;
+    return raw->contents+raw->len-length;
+    }
 
-    if((buf[0] >> nonzero) != 0 || !(buf[0]&(1 << (nonzero-1))))
+/**
+ * \ingroup Core_MPI
+ * Read \a count MPIs without converting them.
+ *
+ * The MPIs are checked as limited_read_mpi() does, and kept in \a raw
+ * in packet format, bit counts included, to be turned into BIGNUMs by
+ * raw_mpis_to_bn() if they are ever needed. If the reader can lend
+ * its data, \a raw borrows them where they are, and nothing is
+ * copied.
+ *
+ * \return		1 on success, 0 on error
+ */
+static int limited_read_raw_mpis(ops_data_t *raw,unsigned count,
+				 ops_region_t *region,ops_parse_info_t *pinfo)
+    {
+    unsigned n;
+
+    memset(raw,'\0',sizeof *raw);
+    raw->borrowed=ops_true;
+
+    for(n=0 ; n < count ; ++n)
 	{
-	OPS_ERROR(&pinfo->errors,OPS_E_P_MPI_FORMAT_ERROR,"MPI Format error");  /* XXX: Ben, one part of this constraint does not apply to encrypted MPIs the draft says. -- peter */
-	return 0;
+	const unsigned char *data;
+	unsigned bits;
+
+	pinfo->reading_mpi_length=ops_true;
+	data=raw_mpis_extend(raw,2,region,pinfo);
+	pinfo->reading_mpi_length=ops_false;
+	if(!data)
+	    {
+	    data_free(raw);
+	    return 0;
+	    }
+	bits=(data[0] << 8)+data[1];
+
+	if(bits)
+	    data=raw_mpis_extend(raw,(bits+7)/8,region,pinfo);
+	if(!data || !mpi_check(data,bits,pinfo))
+	    {
+	    data_free(raw);
+	    return 0;
+	    }
 	}
 
-    *pbn=BN_bin2bn(buf,length,NULL);
     return 1;
     }
 
+/**
+ * \ingroup Core_MPI
+ * Convert MPIs kept by limited_read_raw_mpis() into BIGNUMs.
+ *
+ * \param bn		Where to put each BIGNUM, in packet order
+ * \param count	Number of MPIs in \a raw
+ * \param raw		The MPIs
+ */
+static void raw_mpis_to_bn(BIGNUM **bn[],unsigned count,const ops_data_t *raw)
+    {
+    const unsigned char *p=raw->contents;
+    unsigned length;
+    unsigned n;
+
+    for(n=0 ; n < count ; ++n)
+	{
+	length=(((p[0] << 8)+p[1])+7)/8;
+	*bn[n]=BN_bin2bn(p+2,length,NULL);
+	p+=2+length;
+	}
+    assert(p == raw->contents+raw->len);
+    }
+
 /** Read some data with a New-Format length from reader.
  *
  * \sa Internet-Draft RFC4880.txt Section 4.2.2
  *
  * \param *length	Where the decoded length will be put
+ * \param *partial	Set if this is a Partial Body Length, in which case
+ *			*length is the length of the first chunk
  * \param *pinfo	How to parse
  * \return		ops_true if OK, else ops_false
  *
  */
 
-static ops_boolean_t read_new_length(unsigned *length,ops_parse_info_t *pinfo)
+static ops_boolean_t read_new_length(unsigned *length,ops_boolean_t *partial,
+				     ops_parse_info_t *pinfo)
     {
     unsigned char c[1];
 
+    *partial=ops_false;
     if(base_read(c,1,pinfo) != 1)
 	return ops_false;
     if(c[0] < 192)
@@ -645,9 +1032,9 @@ static ops_boolean_t read_new_length(unsigned *length,ops_parse_info_t *pinfo)
     else if (c[0]>=224 && c[0]<255)
         {
         // 4. Partial Body Length
-        OPS_ERROR(&pinfo->errors,OPS_E_UNIMPLEMENTED,
-                    "New format Partial Body Length fields not yet implemented");
-        return ops_false;
+        *length=1 << (c[0]&0x1f);
+        *partial=ops_true;
+        return ops_true;
         }
     return ops_false;
     }
@@ -693,17 +1080,6 @@ static int limited_read_new_length(unsigned *length,ops_region_t *region,
     return limited_read_scalar(length,4,region,pinfo);
     }
 
-/**
-\ingroup Core_Create
-\brief Free allocated memory
-*/
-static void data_free(ops_data_t *data)
-    {
-    free(data->contents);
-    data->contents=NULL;
-    data->len=0;
-    }
-
 /**
 \ingroup Core_Create
 \brief Free allocated memory
@@ -721,7 +1097,8 @@ static void string_free(char **str)
 /*! Free packet memory, set pointer to NULL */
 void ops_packet_free(ops_packet_t *packet)
     {
-    free(packet->raw);
+    if(!packet->borrowed)
+	free(packet->raw);
     packet->raw=NULL;
     }
 
@@ -903,6 +1280,7 @@ void ops_parser_content_free(ops_parser_content_t *c)
      break;
 
     case OPS_PARSER_PACKET_END:
+    case OPS_PTAG_RAW_PACKET:
 	ops_packet_free(&c->content.packet);
 	break;
 
@@ -970,6 +1348,8 @@ void ops_pk_session_key_free(ops_pk_session_key_t *sk)
 /*! Free the memory used when parsing a public key */
 void ops_public_key_free(ops_public_key_t *p)
     {
+    data_free(&p->raw_mpis);
+
     switch(p->algorithm)
 	{
     case OPS_PKA_RSA:
@@ -998,10 +1378,28 @@ void ops_public_key_free(ops_public_key_t *p)
 	}
     }
 
+static unsigned public_key_bns(BIGNUM **bn[4],ops_public_key_t *key);
+
 void ops_public_key_copy(ops_public_key_t *dst,const ops_public_key_t *src)
     {
     *dst = *src ;
 
+    if(src->raw_mpis.len)
+	{
+	BIGNUM **bn[4];
+	unsigned count=public_key_bns(bn,dst);
+
+	// the copy converts its own, if it needs them, rather than
+	// sharing any src has
+	while(count--)
+	    *bn[count]=NULL;
+	dst->raw_mpis.contents=ops_mallocz(src->raw_mpis.len);
+	memcpy(dst->raw_mpis.contents,src->raw_mpis.contents,
+	       src->raw_mpis.len);
+	dst->raw_mpis.borrowed=ops_false;
+	return;
+	}
+
     switch(src->algorithm)
 	{
     case OPS_PKA_RSA:
@@ -1035,6 +1433,89 @@ void ops_public_key_copy(ops_public_key_t *dst,const ops_public_key_t *src)
     }
 
 
+/* Find the BIGNUMs of a public key, in packet order. Returns how many
+   there are, 0 if the algorithm is not supported. */
+static unsigned public_key_bns(BIGNUM **bn[4],ops_public_key_t *key)
+    {
+    switch(key->algorithm)
+	{
+    case OPS_PKA_DSA:
+	bn[0]=&key->key.dsa.p;
+	bn[1]=&key->key.dsa.q;
+	bn[2]=&key->key.dsa.g;
+	bn[3]=&key->key.dsa.y;
+	return 4;
+
+    case OPS_PKA_RSA:
+    case OPS_PKA_RSA_ENCRYPT_ONLY:
+    case OPS_PKA_RSA_SIGN_ONLY:
+	bn[0]=&key->key.rsa.n;
+	bn[1]=&key->key.rsa.e;
+	return 2;
+
+    case OPS_PKA_ELGAMAL:
+    case OPS_PKA_ELGAMAL_ENCRYPT_OR_SIGN:
+	bn[0]=&key->key.elgamal.p;
+	bn[1]=&key->key.elgamal.g;
+	bn[2]=&key->key.elgamal.y;
+	return 3;
+
+    default:
+	return 0;
+	}
+    }
+
+/* Held while raw MPIs are converted and kept with their key or
+   signature, which may be shared between threads */
+static pthread_mutex_t materialise_lock=PTHREAD_MUTEX_INITIALIZER;
+
+/**
+\ingroup Core_Keys
+\brief Get the parameters of a public key as BIGNUMs
+
+A key parsed with ops_parse_options_lazy_mpis() keeps its MPIs in
+raw_mpis until something needs them. The first call converts them and
+keeps the BIGNUMs in the key, alongside raw_mpis, so later calls cost
+nothing more, and ops_public_key_free() frees them. This is safe to
+call on a key being used by several threads at once.
+
+\param key The key
+\return \a key, with its BIGNUMs set
+*/
+const ops_public_key_t *ops_public_key_materialise(const ops_public_key_t *key)
+    {
+    ops_public_key_t *cached=(ops_public_key_t *)key;
+    BIGNUM **bn[4];
+    unsigned count;
+
+    if(!key->raw_mpis.len)
+	return key;
+
+    pthread_mutex_lock(&materialise_lock);
+    count=public_key_bns(bn,cached);
+    assert(count);
+    if(!*bn[0])
+	raw_mpis_to_bn(bn,count,&key->raw_mpis);
+    pthread_mutex_unlock(&materialise_lock);
+
+    return key;
+    }
+
+/* Convert the raw MPIs of a key we own for good */
+static void public_key_own_bns(ops_public_key_t *key)
+    {
+    BIGNUM **bn[4];
+    unsigned count;
+
+    if(!key->raw_mpis.len)
+	return;
+
+    count=public_key_bns(bn,key);
+    assert(count);
+    raw_mpis_to_bn(bn,count,&key->raw_mpis);
+    data_free(&key->raw_mpis);
+    }
+
 /**
    \ingroup Core_ReadPackets
 */
@@ -1068,6 +1549,23 @@ static int parse_public_key_data(ops_public_key_t *key, ops_region_t *region,
 
     key->algorithm=c[0];
 
+    memset(&key->raw_mpis,'\0',sizeof key->raw_mpis);
+    if(pinfo->lazy_mpis)
+	{
+	BIGNUM **bn[4];
+	unsigned count=public_key_bns(bn,key);
+
+	if(count)
+	    {
+	    unsigned n;
+
+	    // so that they are converted when asked for
+	    for(n=0 ; n < count ; ++n)
+		*bn[n]=NULL;
+	    return limited_read_raw_mpis(&key->raw_mpis,count,region,pinfo);
+	    }
+	}
+
     switch(key->algorithm)
 	{
     case OPS_PKA_DSA:
@@ -1272,6 +1770,8 @@ void free_unknown_sig_pka(ops_unknown_signature_t *unknown_sig)
  */
 void ops_signature_free(ops_signature_t *sig)
     {
+    data_free(&sig->info.raw_mpis);
+
     switch(sig->info.key_algorithm)
 	{
     case OPS_PKA_RSA:
@@ -1309,6 +1809,62 @@ void ops_signature_free(ops_signature_t *sig)
     free(sig->info.v4_hashed_data);
     }
 
+/* Find the BIGNUMs of a signature, in packet order. Returns how many
+   there are, 0 if they are not MPIs. */
+static unsigned signature_bns(BIGNUM **bn[2],ops_signature_info_t *sig)
+    {
+    switch(sig->key_algorithm)
+	{
+    case OPS_PKA_RSA:
+    case OPS_PKA_RSA_SIGN_ONLY:
+	bn[0]=&sig->signature.rsa.sig;
+	return 1;
+
+    case OPS_PKA_DSA:
+	bn[0]=&sig->signature.dsa.r;
+	bn[1]=&sig->signature.dsa.s;
+	return 2;
+
+    case OPS_PKA_ELGAMAL_ENCRYPT_OR_SIGN:
+	bn[0]=&sig->signature.elgamal.r;
+	bn[1]=&sig->signature.elgamal.s;
+	return 2;
+
+    default:
+	return 0;
+	}
+    }
+
+/**
+ * \ingroup Core_Signature
+ * \brief Get the parameters of a signature as BIGNUMs
+ *
+ * The signature counterpart of ops_public_key_materialise(). The
+ * BIGNUMs are kept in the signature and freed by ops_signature_free().
+ *
+ * \param sig	The signature
+ * \return	\a sig, with its BIGNUMs set
+ */
+const ops_signature_info_t *
+ops_signature_materialise(const ops_signature_info_t *sig)
+    {
+    ops_signature_info_t *cached=(ops_signature_info_t *)sig;
+    BIGNUM **bn[2];
+    unsigned count;
+
+    if(!sig->raw_mpis.len)
+	return sig;
+
+    pthread_mutex_lock(&materialise_lock);
+    count=signature_bns(bn,cached);
+    assert(count);
+    if(!*bn[0])
+	raw_mpis_to_bn(bn,count,&sig->raw_mpis);
+    pthread_mutex_unlock(&materialise_lock);
+
+    return sig;
+    }
+
 /**
  * \ingroup Core_Parse
  * \brief Parse a version 3 signature.
@@ -1329,6 +1885,8 @@ static int parse_v3_signature(ops_region_t *region,
     {
     unsigned char c[1]="";
     ops_parser_content_t content;
+    BIGNUM **bn[2];
+    unsigned count;
 
     // clear signature
     memset(&C.signature,'\0',sizeof C.signature);
@@ -1367,7 +1925,13 @@ static int parse_v3_signature(ops_region_t *region,
     if(!limited_read(C.signature.hash2,2,region,pinfo))
 	return 0;
 
-    switch(C.signature.info.key_algorithm)
+    if(pinfo->lazy_mpis && (count=signature_bns(bn,&C.signature.info)))
+	{
+	if(!limited_read_raw_mpis(&C.signature.info.raw_mpis,count,region,
+				  pinfo))
+	    return 0;
+	}
+    else switch(C.signature.info.key_algorithm)
 	{
     case OPS_PKA_RSA:
     case OPS_PKA_RSA_SIGN_ONLY:
@@ -1786,6 +2350,8 @@ static int parse_v4_signature(ops_region_t *region,ops_parse_info_t *pinfo)
     {
     unsigned char c[1]="";
     ops_parser_content_t content;
+    BIGNUM **bn[2];
+    unsigned count;
     
     //debug=1;
     if (debug)
@@ -1854,7 +2420,13 @@ static int parse_v4_signature(ops_region_t *region,ops_parse_info_t *pinfo)
     if(!limited_read(C.signature.hash2,2,region,pinfo))
 	return 0;
 
-    switch(C.signature.info.key_algorithm)
+    if(pinfo->lazy_mpis && (count=signature_bns(bn,&C.signature.info)))
+	{
+	if(!limited_read_raw_mpis(&C.signature.info.raw_mpis,count,region,
+				  pinfo))
+	    return 0;
+	}
+    else switch(C.signature.info.key_algorithm)
 	{
     case OPS_PKA_RSA:
 	if(!limited_read_mpi(&C.signature.info.signature.rsa.sig,region,pinfo))
@@ -2107,14 +2679,32 @@ static int parse_literal_data(ops_region_t *region,ops_parse_info_t *pinfo)
 
     CBP(pinfo,OPS_PTAG_CT_LITERAL_DATA_HEADER,&content);
 
-    while(region->length_read < region->length)
+    /* The body is delivered in chunks of at most literal_chunk_size,
+       from a buffer that is reused, so callbacks must copy anything
+       they want to keep. */
+    if(!pinfo->literal_buffer)
+	{
+	if(!pinfo->literal_chunk_size)
+	    pinfo->literal_chunk_size=LITERAL_CHUNK_SIZE;
+	pinfo->literal_buffer=malloc(pinfo->literal_chunk_size);
+	}
+    C.literal_data_body.data=pinfo->literal_buffer;
+
+    while(region->indeterminate || region->length_read < region->length)
 	{
 	unsigned l=region->length-region->length_read;
 
-	C.literal_data_body.data = (unsigned char *)malloc(l) ;
+	if(region->indeterminate || l > pinfo->literal_chunk_size)
+	    l=pinfo->literal_chunk_size;
 
 	if(!limited_read(C.literal_data_body.data,l,region,pinfo))
 	    return 0;
+	if(region->indeterminate)
+	    {
+	    if(region->last_read == 0)
+		break;
+	    l=region->last_read;
+	    }
 
 	C.literal_data_body.length=l;
 
@@ -2191,16 +2781,14 @@ void ops_secret_key_copy(ops_secret_key_t *dst,const ops_secret_key_t *src)
 static int consume_packet(ops_region_t *region,ops_parse_info_t *pinfo,
 			  ops_boolean_t warn)
     {
-    ops_data_t remainder;
     ops_parser_content_t content;
 
     if(region->indeterminate)
 	ERRP(pinfo,"Can't consume indeterminate packets");
 
-    if(read_data(&remainder,region,pinfo))
+    /* skip it, rather than hold all of it in memory */
+    if(limited_skip(region->length-region->length_read,region,pinfo))
 	{
-	/* now throw it away */
-	data_free(&remainder);
 	if(warn)
 	    OPS_ERROR(&pinfo->errors,OPS_E_P_PACKET_CONSUMED,"Warning: packet consumer");
 	}
@@ -2215,6 +2803,52 @@ static int consume_packet(ops_region_t *region,ops_parse_info_t *pinfo,
     return 1;
     }
 
+/**
+ * \ingroup Core_ReadPackets
+ * \brief Pass the body of a packet to the callback without parsing it
+ *
+ * The body is given whole if its length is known, borrowing it from
+ * the reader if possible; otherwise in chunks, as it is read.
+ */
+static int parse_raw_packet(ops_region_t *region,ops_parse_info_t *pinfo)
+    {
+    ops_parser_content_t content;
+    ops_data_t data;
+
+    if(!region->indeterminate)
+	{
+	if(!read_data(&data,region,pinfo))
+	    return 0;
+
+	C.packet.length=data.len;
+	C.packet.raw=data.contents;
+	C.packet.borrowed=data.borrowed;
+	CBP(pinfo,OPS_PTAG_RAW_PACKET,&content);
+
+	return 1;
+	}
+
+    for( ; ; )
+	{
+	C.packet.raw=malloc(LITERAL_CHUNK_SIZE);
+	C.packet.borrowed=ops_false;
+
+	if(!limited_read(C.packet.raw,LITERAL_CHUNK_SIZE,region,pinfo))
+	    {
+	    free(C.packet.raw);
+	    return 0;
+	    }
+	if(region->last_read == 0)
+	    {
+	    free(C.packet.raw);
+	    return 1;
+	    }
+
+	C.packet.length=region->last_read;
+	CBP(pinfo,OPS_PTAG_RAW_PACKET,&content);
+	}
+    }
+
 /**
  * \ingroup Core_ReadPackets
  * \brief Parse a secret key
@@ -2239,6 +2873,8 @@ static int parse_secret_key(ops_region_t *region,ops_parse_info_t *pinfo)
     memset(&content,'\0',sizeof content);
     if(!parse_public_key_data(&C.secret_key.public_key,region,pinfo))
 	return 0;
+    /* secret keys are few and always used with their public part */
+    public_key_own_bns(&C.secret_key.public_key);
 
     if (debug)
         {
@@ -2392,6 +3028,7 @@ static int parse_secret_key(ops_region_t *region,ops_parse_info_t *pinfo)
 	free(passphrase);
 
 	ops_crypt_any(&decrypt,C.secret_key.algorithm);
+	ops_crypt_set_backend(&decrypt,pinfo->crypt_backend);
     if (debug)
         {
         unsigned int i=0;
@@ -2690,6 +3327,7 @@ static int parse_pk_session_key(ops_region_t *region,
     CBP(pinfo,OPS_PTAG_CT_PK_SESSION_KEY,&content);
 
     ops_crypt_any(&pinfo->decrypt,C.pk_session_key.symmetric_algorithm);
+    ops_crypt_set_backend(&pinfo->decrypt,pinfo->crypt_backend);
     iv=ops_mallocz(pinfo->decrypt.blocksize);
     pinfo->decrypt.set_iv(&pinfo->decrypt, iv);
     pinfo->decrypt.set_key(&pinfo->decrypt,C.pk_session_key.key);
@@ -2744,15 +3382,21 @@ int ops_decrypt_se_data(ops_content_tag_t tag,ops_region_t *region,
 	{
 	ops_parser_content_t content;
 
-	while(region->length_read < region->length)
+	while(region->indeterminate || region->length_read < region->length)
 	    {
 	    unsigned l=region->length-region->length_read;
 
-	    if(l > sizeof C.se_data_body.data)
+	    if(region->indeterminate || l > sizeof C.se_data_body.data)
 		l=sizeof C.se_data_body.data;
 
 	    if(!limited_read(C.se_data_body.data,l,region,pinfo))
 		return 0;
+	    if(region->indeterminate)
+		{
+		if(region->last_read == 0)
+		    break;
+		l=region->last_read;
+		}
 
 	    C.se_data_body.length=l;
 
@@ -2771,28 +3415,49 @@ int ops_decrypt_se_ip_data(ops_content_tag_t tag,ops_region_t *region,
 
     if(decrypt)
         {
-        ops_reader_push_decrypt(pinfo,decrypt,region);
+	/* to decrypt on several threads, the SE IP reader decrypts */
+	ops_boolean_t parallel=pinfo->decrypt_threads > 1;
+	unsigned char iv[OPS_MAX_BLOCK_SIZE];
+
+	/* each SE IP packet starts from a zero IV, however far the
+	   session key was used by the one before */
+	memset(iv,'\0',decrypt->blocksize);
+	decrypt->set_iv(decrypt,iv);
+
+	if(parallel)
+	    ops_decrypt_init(decrypt);
+	else
+	    ops_reader_push_decrypt(pinfo,decrypt,region);
         ops_reader_push_se_ip_data(pinfo,decrypt,region);
 
         r=ops_parse(pinfo);
 
         //        assert(0);
         ops_reader_pop_se_ip_data(pinfo);
-        ops_reader_pop_decrypt(pinfo);
+	if(parallel)
+	    decrypt->decrypt_finish(decrypt);
+	else
+	    ops_reader_pop_decrypt(pinfo);
         }
     else
         {
         ops_parser_content_t content;
         
-        while(region->length_read < region->length)
+        while(region->indeterminate || region->length_read < region->length)
             {
             unsigned l=region->length-region->length_read;
             
-            if(l > sizeof C.se_data_body.data)
+            if(region->indeterminate || l > sizeof C.se_data_body.data)
                 l=sizeof C.se_data_body.data;
             
             if(!limited_read(C.se_data_body.data,l,region,pinfo))
                 return 0;
+            if(region->indeterminate)
+                {
+                if(region->last_read == 0)
+                    break;
+                l=region->last_read;
+                }
             
             C.se_data_body.length=l;
             
@@ -2865,14 +3530,15 @@ static int parse_mdc(ops_region_t *region, ops_parse_info_t *pinfo)
  * \param *pinfo	How to parse
  * \param *pktlen	On return, will contain number of bytes in packet
  * \return 1 on success, 0 on error, -1 on EOF */
-static int ops_parse_one_packet(ops_parse_info_t *pinfo,
-				unsigned long *pktlen)
+int ops_parse_one_packet(ops_parse_info_t *pinfo,unsigned long *pktlen)
     {
     unsigned char ptag[1];
     ops_parser_content_t content;
     int r;
     ops_region_t region;
     ops_boolean_t indeterminate=ops_false;
+    ops_boolean_t partial=ops_false;
+    int t8,t7;
 
     C.ptag.position=pinfo->rinfo.position;
 
@@ -2896,8 +3562,9 @@ static int ops_parse_one_packet(ops_parse_info_t *pinfo,
 	{
 	C.ptag.content_tag=*ptag&OPS_PTAG_NF_CONTENT_TAG_MASK;
 	C.ptag.length_type=0;
-	if(!read_new_length(&C.ptag.length,pinfo))
+	if(!read_new_length(&C.ptag.length,&partial,pinfo))
 	    return 0;
+	C.ptag.partial=partial;
 
 	}
     else
@@ -2906,6 +3573,7 @@ static int ops_parse_one_packet(ops_parse_info_t *pinfo,
 
 	C.ptag.content_tag=(*ptag&OPS_PTAG_OF_CONTENT_TAG_MASK)
 	    >> OPS_PTAG_OF_CONTENT_TAG_SHIFT;
+	C.ptag.partial=ops_false;
 	C.ptag.length_type=*ptag&OPS_PTAG_OF_LENGTH_TYPE_MASK;
 	switch(C.ptag.length_type)
 	    {
@@ -2936,10 +3604,40 @@ static int ops_parse_one_packet(ops_parse_info_t *pinfo,
 
     CBP(pinfo,OPS_PARSER_PTAG,&content);
 
+    if(partial)
+	{
+	/* RFC4880 4.2.2.4: only data packets may have partial lengths */
+	switch(C.ptag.content_tag)
+	    {
+	case OPS_PTAG_CT_LITERAL_DATA:
+	case OPS_PTAG_CT_COMPRESSED:
+	case OPS_PTAG_CT_SE_DATA:
+	case OPS_PTAG_CT_SE_IP_DATA:
+	    break;
+
+	default:
+	    OPS_ERROR_1(&pinfo->errors,OPS_E_P_BAD_PARTIAL_LENGTH,
+			"Partial Body Length on packet with content tag 0x%x",
+			C.ptag.content_tag);
+	    return -1;
+	    }
+	/* the chunks are followed by a reader of their own, which makes
+	   the body look like a packet of indeterminate length */
+	ops_reader_push_partial(pinfo,C.ptag.length);
+	indeterminate=ops_true;
+	}
+
     ops_init_subregion(&region,NULL);
-    region.length=C.ptag.length;
+    region.length=partial ? 0 : C.ptag.length;
     region.indeterminate=indeterminate;
-    switch(C.ptag.content_tag)
+
+    t8=C.ptag.content_tag/8;
+    t7=1 << (C.ptag.content_tag&7);
+    if(pinfo->pkt_ignored[t8]&t7)
+	r=limited_skip(region.length,&region,pinfo);
+    else if(pinfo->pkt_raw[t8]&t7)
+	r=parse_raw_packet(&region,pinfo);
+    else switch(C.ptag.content_tag)
 	{
     case OPS_PTAG_CT_SIGNATURE:
 	r=parse_signature(&region,pinfo);
@@ -3006,6 +3704,9 @@ static int ops_parse_one_packet(ops_parse_info_t *pinfo,
 
     /* Ensure that the entire packet has been consumed */
 
+    if(partial && !ops_reader_pop_partial(pinfo))
+	r=-1;
+
     if(region.length != region.length_read && !region.indeterminate)
 	if(!consume_packet(&region,pinfo,ops_false))
 	    r=-1;
@@ -3013,7 +3714,7 @@ static int ops_parse_one_packet(ops_parse_info_t *pinfo,
     // also consume it if there's been an error?
     // \todo decide what to do about an error on an
     //       indeterminate packet
-    if (r==0)
+    if (r==0 && !partial)
         {
         if (!consume_packet(&region,pinfo,ops_false))
             r=-1;
@@ -3029,11 +3730,13 @@ static int ops_parse_one_packet(ops_parse_info_t *pinfo,
 	{
 	C.packet.length=pinfo->rinfo.alength;
 	C.packet.raw=pinfo->rinfo.accumulated;
+	C.packet.borrowed=pinfo->rinfo.accumulated_borrowed;
         
 	CBP(pinfo,OPS_PARSER_PACKET_END,&content);
 	//free(pinfo->rinfo.accumulated);
 	pinfo->rinfo.accumulated=NULL;
 	pinfo->rinfo.asize=0;
+	pinfo->rinfo.accumulated_borrowed=ops_false;
 	}
     else
        C.packet.raw = NULL ;
@@ -3128,19 +3831,49 @@ int ops_parse_and_print_errors(ops_parse_info_t *pinfo)
 /**
  * \ingroup Core_ReadPackets
  *
- * \brief Specifies whether one or more signature
+ * \brief Specifies whether one or more packet or signature
  * subpacket types should be returned parsed; or raw; or ignored.
  *
+ * Packets are parsed by default. A packet set to OPS_PARSE_RAW is
+ * given to the callback unparsed, as OPS_PTAG_RAW_PACKET; one set to
+ * OPS_PARSE_IGNORE is skipped without being read into memory (when
+ * the reader allows). Either way, OPS_PARSER_PTAG is still called
+ * back for it.
+ *
  * \param	pinfo	Pointer to previously allocated structure
- * \param	tag	Packet tag. OPS_PTAG_SS_ALL for all SS tags; or one individual signature subpacket tag
+ * \param	tag	Packet tag. OPS_PTAG_SS_ALL for all SS tags; or one individual signature subpacket tag; or a packet content tag
  * \param	type	Parse type
- * \todo Make all packet types optional, not just subpackets */
+ */
 void ops_parse_options(ops_parse_info_t *pinfo,
 		       ops_content_tag_t tag,
 		       ops_parse_type_t type)
     {
     int t8,t7;
 
+    if(tag < NPTAGS)
+	{
+	t8=tag/8;
+	t7=1 << (tag&7);
+	switch(type)
+	    {
+	case OPS_PARSE_RAW:
+	    pinfo->pkt_raw[t8] |= t7;
+	    pinfo->pkt_ignored[t8] &= ~t7;
+	    break;
+
+	case OPS_PARSE_PARSED:
+	    pinfo->pkt_raw[t8] &= ~t7;
+	    pinfo->pkt_ignored[t8] &= ~t7;
+	    break;
+
+	case OPS_PARSE_IGNORE:
+	    pinfo->pkt_raw[t8] &= ~t7;
+	    pinfo->pkt_ignored[t8] |= t7;
+	    break;
+	    }
+	return;
+	}
+
     if(tag == OPS_PTAG_SS_ALL)
 	{
 	int n;
@@ -3174,6 +3907,223 @@ void ops_parse_options(ops_parse_info_t *pinfo,
 	}
     }
 
+/**
+ * \ingroup Core_ReadPackets
+ *
+ * \brief Choose whether SE IP plaintext may be returned before its
+ * MDC has been checked.
+ *
+ * By default an SE IP packet is decrypted in full, and its MDC
+ * checked, before any of its plaintext is parsed. If release is set,
+ * plaintext is parsed as it is decrypted instead, using a fixed
+ * amount of memory, and a bad MDC is only reported as an error once
+ * the end of the packet has been reached. Callers that set this must
+ * discard any output if parsing fails.
+ *
+ * \note Only this mode streams. In the default mode the whole
+ * decrypted SE IP packet is held in memory until its MDC has been
+ * checked, however it was read: the memory used grows with the size
+ * of the message, and nothing inside it, literal data included, is
+ * seen before the end. Callers that must handle large encrypted
+ * messages in bounded memory have to set this.
+ *
+ * \param	pinfo	Pointer to previously allocated structure
+ * \param	release	ops_true to stream unauthenticated plaintext
+ */
+void ops_parse_options_release_before_auth(ops_parse_info_t *pinfo,
+					   ops_boolean_t release)
+    { pinfo->release_before_auth=release; }
+
+/**
+ * \ingroup Core_ReadPackets
+ *
+ * \brief Sets the most Literal Data to pass to the callback at once.
+ *
+ * A Literal Data body is delivered as a series of
+ * OPS_PTAG_CT_LITERAL_DATA_BODY callbacks of at most this many bytes
+ * each, all using the same buffer, so memory use does not depend on
+ * the size of the packet. The default is 8192.
+ *
+ * \param	pinfo	Pointer to previously allocated structure
+ * \param	size	Maximum chunk size, 0 for the default
+ */
+void ops_parse_options_literal_chunk_size(ops_parse_info_t *pinfo,
+					  size_t size)
+    {
+    if(!size)
+	size=LITERAL_CHUNK_SIZE;
+    if(size != pinfo->literal_chunk_size)
+	{
+	free(pinfo->literal_buffer);
+	pinfo->literal_buffer=NULL;
+	}
+    pinfo->literal_chunk_size=size;
+    }
+
+/**
+ * \ingroup Core_ReadPackets
+ *
+ * \brief Sets whether to keep MPIs raw.
+ *
+ * With this set, the MPIs of public keys and signatures are checked
+ * and kept in the raw_mpis of the parsed structure, borrowed from the
+ * reader where it can lend them. They are only turned into BIGNUMs,
+ * once, by ops_public_key_materialise() or
+ * ops_signature_materialise(). Anything that uses the BIGNUMs in the
+ * library goes through those; callbacks and other code that look at
+ * them directly must do the same, so this is off by default. Secret
+ * keys are always converted.
+ *
+ * Borrowed raw_mpis are only valid while the reader is; anything
+ * kept after that, ops_parse_and_accumulate() keyrings included, has
+ * its own copy.
+ *
+ * \param	pinfo	Pointer to previously allocated structure
+ * \param	lazy	ops_true to keep MPIs raw
+ */
+void ops_parse_options_lazy_mpis(ops_parse_info_t *pinfo,ops_boolean_t lazy)
+    {
+    pinfo->lazy_mpis=lazy;
+    }
+
+/**
+ * \ingroup Core_ReadPackets
+ *
+ * \brief Sets limits on decompression.
+ *
+ * Compressed data can expand enormously, and compressed packets can
+ * nest. Going over any of these limits fails the parse with
+ * OPS_E_P_DECOMPRESSION_LIMIT as soon as it happens. Each level of
+ * nesting holds a decompressor, so limiting depth also limits memory.
+ * By default there are no limits.
+ *
+ * \param	pinfo		Pointer to previously allocated structure
+ * \param	max_bytes	Most bytes to decompress in all, 0 for no
+ *				limit
+ * \param	max_expansion	Most a compressed packet may expand by: its
+ *				output may be at most this many times the
+ *				compressed data read so far, or 0 for no
+ *				limit. The first 64k of output is allowed
+ *				regardless.
+ * \param	max_depth	Most compressed packets to nest, 0 for no
+ *				limit
+ */
+void ops_parse_options_decompress_limits(ops_parse_info_t *pinfo,
+					 size_t max_bytes,
+					 unsigned max_expansion,
+					 unsigned max_depth)
+    {
+    pinfo->max_decompressed=max_bytes;
+    pinfo->max_expansion=max_expansion;
+    pinfo->max_compressed_depth=max_depth;
+    }
+
+/**
+ * \ingroup Core_ReadPackets
+ *
+ * \brief Decrypt SE IP packets on several threads.
+ *
+ * CFB decryption of a block only needs the ciphertext block before
+ * it, so a large amount of ciphertext can be cut into segments and
+ * decrypted on separate threads. The MDC hash is fed each segment as
+ * soon as it is done, while the later ones are still being decrypted.
+ * The plaintext is the same as decrypting serially.
+ *
+ * Ciphertext is decrypted a window at a time, and windows smaller
+ * than min_size are decrypted serially. With
+ * ops_parse_options_release_before_auth() the window is min_size, so
+ * that is also the memory used.
+ *
+ * \param	pinfo		Pointer to previously allocated structure
+ * \param	nthreads	Threads to decrypt on, 0 for one per CPU,
+ *				or 1 to decrypt serially (the default)
+ * \param	min_size	Least to decrypt on several threads at
+ *				once, or 0 for a megabyte
+ */
+void ops_parse_options_parallel_decrypt(ops_parse_info_t *pinfo,
+					unsigned nthreads,size_t min_size)
+    {
+    if(!nthreads)
+	{
+	long ncpus=sysconf(_SC_NPROCESSORS_ONLN);
+
+	nthreads=ncpus > 0 ? ncpus : 1;
+	}
+    pinfo->decrypt_threads=nthreads;
+    pinfo->parallel_decrypt_min=min_size ? min_size : 1024*1024;
+    }
+
+/**
+ * \ingroup Core_ReadPackets
+ *
+ * \brief Chooses how ciphers set up while parsing are done.
+ *
+ * This applies to the session key decrypted from a Public Key
+ * Encrypted Session Key packet and the key used to decrypt a secret
+ * key. See ops_crypt_set_backend(). The default is
+ * OPS_CRYPT_BACKEND_LOW_LEVEL.
+ *
+ * \param	pinfo	Pointer to previously allocated structure
+ * \param	backend	The backend to use
+ */
+void ops_parse_options_crypt_backend(ops_parse_info_t *pinfo,
+				     ops_crypt_backend_t backend)
+    { pinfo->crypt_backend=backend; }
+
+/* What a suspended parse reads and calls back while it unwinds */
+static int abandoned_reader(void *dest,size_t length,ops_error_t **errors,
+			    ops_reader_info_t *rinfo,
+			    ops_parse_cb_info_t *cbinfo)
+    {
+    OPS_USED(dest);
+    OPS_USED(length);
+    OPS_USED(errors);
+    OPS_USED(rinfo);
+    OPS_USED(cbinfo);
+    return 0;
+    }
+
+static int abandoned_peek(const unsigned char **span,ops_error_t **errors,
+			  ops_reader_info_t *rinfo,ops_parse_cb_info_t *cbinfo)
+    {
+    OPS_USED(span);
+    OPS_USED(errors);
+    OPS_USED(rinfo);
+    OPS_USED(cbinfo);
+    return 0;
+    }
+
+static ops_parse_cb_return_t
+abandoned_cb(const ops_parser_content_t *content,ops_parse_cb_info_t *cbinfo)
+    {
+    OPS_USED(content);
+    OPS_USED(cbinfo);
+    return OPS_RELEASE_MEMORY;
+    }
+
+/*
+ * Finish a parse left suspended by ops_parse_feed() or
+ * ops_parse_next(), so that it frees what it holds: from here on it
+ * reads EOF, and the callbacks no longer see anything.
+ */
+static void abandon_parse(ops_parse_info_t *pinfo)
+    {
+    ops_coroutine_t *co=pinfo->suspended;
+    ops_reader_info_t *base;
+
+    for(base=&pinfo->rinfo ; base->next ; base=base->next)
+	;
+    base->reader=abandoned_reader;
+    base->borrow=NULL;
+    if(base->peek)
+	base->peek=abandoned_peek;
+    pinfo->cbinfo.cb=abandoned_cb;
+    pinfo->abandoned=ops_true;
+
+    while(ops_coroutine_resume(co))
+	;
+    }
+
 /**
 \ingroup Core_ReadPackets
 \brief Creates a new zero-ed ops_parse_info_t struct
@@ -3191,6 +4141,8 @@ void ops_parse_info_delete(ops_parse_info_t *pinfo)
     {
     ops_parse_cb_info_t *cbinfo,*next;
 
+    if(pinfo->suspended)
+	abandon_parse(pinfo);
     for(cbinfo=pinfo->cbinfo.next ; cbinfo ; cbinfo=next)
 	{
 	next=cbinfo->next;
@@ -3199,7 +4151,9 @@ void ops_parse_info_delete(ops_parse_info_t *pinfo)
     if(pinfo->rinfo.destroyer)
 	pinfo->rinfo.destroyer(&pinfo->rinfo);
     ops_free_errors(pinfo->errors);
-    if(pinfo->rinfo.accumulated)
+    ops_parse_iter_delete(pinfo->iter);
+    free(pinfo->literal_buffer);
+    if(pinfo->rinfo.accumulated && !pinfo->rinfo.accumulated_borrowed)
         free(pinfo->rinfo.accumulated);
     free(pinfo);
     }
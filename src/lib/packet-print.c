@@ -49,6 +49,7 @@ static void print_hexdump_data(const char *name,
 			       unsigned int len);
 static void print_indent();
 static void print_name(const char *name);
+static void print_signature_mpis(const ops_signature_info_t *sig);
 static void print_string_and_value(char *name,
 				   const char *str,
 				   unsigned char value);
@@ -116,6 +117,7 @@ ops_print_public_key(const ops_public_key_t *pkey)
     print_string_and_value("Algorithm",ops_show_pka(pkey->algorithm),
 			   pkey->algorithm);
 
+    pkey=ops_public_key_materialise(pkey);
     switch(pkey->algorithm)
 	{
     case OPS_PKA_DSA:
@@ -359,6 +361,45 @@ static void print_data(const char *name,const ops_data_t *data)
     print_hexdump(name,data->contents,data->len);
     }
 
+static void print_signature_mpis(const ops_signature_info_t *sig)
+    {
+    sig=ops_signature_materialise(sig);
+    switch(sig->key_algorithm)
+	{
+    case OPS_PKA_RSA:
+    case OPS_PKA_RSA_SIGN_ONLY:
+	print_bn("sig",sig->signature.rsa.sig);
+	break;
+
+    case OPS_PKA_DSA:
+	print_bn("r",sig->signature.dsa.r);
+	print_bn("s",sig->signature.dsa.s);
+	break;
+
+    case OPS_PKA_ELGAMAL_ENCRYPT_OR_SIGN:
+	print_bn("r",sig->signature.elgamal.r);
+	print_bn("s",sig->signature.elgamal.s);
+	break;
+
+    case OPS_PKA_PRIVATE00:
+    case OPS_PKA_PRIVATE01:
+    case OPS_PKA_PRIVATE02:
+    case OPS_PKA_PRIVATE03:
+    case OPS_PKA_PRIVATE04:
+    case OPS_PKA_PRIVATE05:
+    case OPS_PKA_PRIVATE06:
+    case OPS_PKA_PRIVATE07:
+    case OPS_PKA_PRIVATE08:
+    case OPS_PKA_PRIVATE09:
+    case OPS_PKA_PRIVATE10:
+	print_data("Private/Experimental",&sig->signature.unknown.data);
+	break;
+
+    default:
+	assert(0);
+	}
+    }
+
 
 static void print_name(const char *name)
     {
@@ -653,6 +694,7 @@ int ops_print_packet(const ops_parser_content_t *content_)
 	break;
 
     case OPS_PARSER_PACKET_END:
+    case OPS_PTAG_RAW_PACKET:
 	print_packet_hex(&content->packet);
 	break;
 
@@ -742,26 +784,7 @@ int ops_print_packet(const ops_parser_content_t *content_)
 	print_indent();
 	print_hexdump_data("hash2",&content->signature.hash2[0],2);
 
-	switch(content->signature.info.key_algorithm)
-	    {
-	case OPS_PKA_RSA:
-	case OPS_PKA_RSA_SIGN_ONLY:
-	    print_bn("sig",content->signature.info.signature.rsa.sig);
-	    break;
-
-	case OPS_PKA_DSA:
-	    print_bn("r",content->signature.info.signature.dsa.r);
-	    print_bn("s",content->signature.info.signature.dsa.s);
-	    break;
-
-	case OPS_PKA_ELGAMAL_ENCRYPT_OR_SIGN:
-	    print_bn("r",content->signature.info.signature.elgamal.r);
-	    print_bn("s",content->signature.info.signature.elgamal.s);
-	    break;
-
-	default:
-	    assert(0);
-	    }
+	print_signature_mpis(&content->signature.info);
 
 	if(content->signature.hash)
 	    printf("data hash is set\n");
@@ -1088,40 +1111,7 @@ int ops_print_packet(const ops_parser_content_t *content_)
 	print_indent();
 	print_hexdump_data("hash2",&content->signature.hash2[0],2);
 
-	switch(content->signature.info.key_algorithm)
-	    {
-	case OPS_PKA_RSA:
-	    print_bn("sig",content->signature.info.signature.rsa.sig);
-	    break;
-
-	case OPS_PKA_DSA:
-	    print_bn("r",content->signature.info.signature.dsa.r);
-	    print_bn("s",content->signature.info.signature.dsa.s);
-	    break;
-
-	case OPS_PKA_ELGAMAL_ENCRYPT_OR_SIGN:
-	    print_bn("r",content->signature.info.signature.elgamal.r);
-	    print_bn("s",content->signature.info.signature.elgamal.s);
-	    break;
-
-	case OPS_PKA_PRIVATE00:
-	case OPS_PKA_PRIVATE01:
-	case OPS_PKA_PRIVATE02:
-	case OPS_PKA_PRIVATE03:
-	case OPS_PKA_PRIVATE04:
-	case OPS_PKA_PRIVATE05:
-	case OPS_PKA_PRIVATE06:
-	case OPS_PKA_PRIVATE07:
-	case OPS_PKA_PRIVATE08:
-	case OPS_PKA_PRIVATE09:
-	case OPS_PKA_PRIVATE10:
-	    print_data("Private/Experimental",
-		       &content->signature.info.signature.unknown.data);
-	    break;
-
-	default:
-	    assert(0);
-	    }
+	print_signature_mpis(&content->signature.info);
 	break;
 
     case OPS_PARSER_CMD_GET_SK_PASSPHRASE:
@@ -1236,6 +1226,7 @@ static ops_parse_cb_return_t cb_list_packets(const ops_parser_content_t * conten
 	break;
 
     case OPS_PARSER_PACKET_END:
+    case OPS_PTAG_RAW_PACKET:
 	print_packet_hex(&content->packet);
 	break;
 
@@ -1325,26 +1316,7 @@ static ops_parse_cb_return_t cb_list_packets(const ops_parser_content_t * conten
 	print_indent();
 	print_hexdump_data("hash2",&content->signature.hash2[0],2);
 
-	switch(content->signature.info.key_algorithm)
-	    {
-	case OPS_PKA_RSA:
-	case OPS_PKA_RSA_SIGN_ONLY:
-	    print_bn("sig",content->signature.info.signature.rsa.sig);
-	    break;
-
-	case OPS_PKA_DSA:
-	    print_bn("r",content->signature.info.signature.dsa.r);
-	    print_bn("s",content->signature.info.signature.dsa.s);
-	    break;
-
-	case OPS_PKA_ELGAMAL_ENCRYPT_OR_SIGN:
-	    print_bn("r",content->signature.info.signature.elgamal.r);
-	    print_bn("s",content->signature.info.signature.elgamal.s);
-	    break;
-
-	default:
-	    assert(0);
-	    }
+	print_signature_mpis(&content->signature.info);
 
 	if(content->signature.hash)
 	    printf("data hash is set\n");
@@ -1667,40 +1639,7 @@ static ops_parse_cb_return_t cb_list_packets(const ops_parser_content_t * conten
 	print_indent();
 	print_hexdump_data("hash2",&content->signature.hash2[0],2);
 
-	switch(content->signature.info.key_algorithm)
-	    {
-	case OPS_PKA_RSA:
-	    print_bn("sig",content->signature.info.signature.rsa.sig);
-	    break;
-
-	case OPS_PKA_DSA:
-	    print_bn("r",content->signature.info.signature.dsa.r);
-	    print_bn("s",content->signature.info.signature.dsa.s);
-	    break;
-
-	case OPS_PKA_ELGAMAL_ENCRYPT_OR_SIGN:
-	    print_bn("r",content->signature.info.signature.elgamal.r);
-	    print_bn("s",content->signature.info.signature.elgamal.s);
-	    break;
-
-	case OPS_PKA_PRIVATE00:
-	case OPS_PKA_PRIVATE01:
-	case OPS_PKA_PRIVATE02:
-	case OPS_PKA_PRIVATE03:
-	case OPS_PKA_PRIVATE04:
-	case OPS_PKA_PRIVATE05:
-	case OPS_PKA_PRIVATE06:
-	case OPS_PKA_PRIVATE07:
-	case OPS_PKA_PRIVATE08:
-	case OPS_PKA_PRIVATE09:
-	case OPS_PKA_PRIVATE10:
-	    print_data("Private/Experimental",
-		       &content->signature.info.signature.unknown.data);
-	    break;
-
-	default:
-	    assert(0);
-	    }
+	print_signature_mpis(&content->signature.info);
 	break;
 
     case OPS_PARSER_CMD_GET_SK_PASSPHRASE:
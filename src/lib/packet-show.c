@@ -65,6 +65,7 @@ static ops_map_t packet_tag_map[] =
     { OPS_PTAG_RAW_SS,			"OPS_PTAG_RAW_SS" },
     { OPS_PTAG_SS_ALL,			"OPS_PTAG_SS_ALL" },
     { OPS_PARSER_PACKET_END,		"OPS_PARSER_PACKET_END" },
+    { OPS_PTAG_RAW_PACKET,		"OPS_PTAG_RAW_PACKET" },
     { OPS_PTAG_SIGNATURE_SUBPACKET_BASE, "OPS_PTAG_SIGNATURE_SUBPACKET_BASE" },
 
     { OPS_PTAG_SS_CREATION_TIME,	"SS: Signature Creation Time" },
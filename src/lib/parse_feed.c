@@ -0,0 +1,235 @@
+/*
+ * Copyright (c) 2005-2008 Nominet UK (www.nic.uk)
+ * All rights reserved.
+ * Contributors: Ben Laurie, Rachel Willmer. The Contributors have asserted
+ * their moral rights under the UK Copyright Design and Patents Act 1988 to
+ * be recorded as the authors of this copyright work.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** \file
+ * Push-mode parsing: input is handed to the parser as it arrives.
+ *
+ * The parser itself pulls its input, so it is run as a coroutine
+ * whose reader, once it has read everything fed so far, suspends the
+ * parse until more is fed. Nothing is buffered here: each call's input
+ * is read in place before the call returns, and a packet is parsed,
+ * and its contents passed to the callbacks, as it arrives, however
+ * long it is.
+ */
+
+#include <openpgpsdk/packet-parse.h>
+#include <openpgpsdk/util.h>
+#include <openpgpsdk/errors.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <assert.h>
+
+#include "parse_local.h"
+
+#include <openpgpsdk/final.h>
+
+typedef struct
+    {
+    ops_parse_info_t *pinfo;
+    ops_coroutine_t *parse; /*!< NULL if it could not be set up */
+    const unsigned char *buffer; /*!< the input being fed */
+    size_t length; /*!< length of buffer */
+    size_t offset; /*!< next byte to read */
+    ops_boolean_t finished:1; /*!< set once there is no more input */
+    ops_boolean_t failed:1; /*!< set once a packet fails to parse */
+    } feed_arg_t;
+
+/* Wait until there is input; ops_false if there is no more */
+static ops_boolean_t feed_wait(feed_arg_t *arg)
+    {
+    while(arg->offset == arg->length)
+	{
+	if(arg->finished || arg->pinfo->abandoned)
+	    return ops_false;
+	ops_coroutine_yield(arg->parse);
+	}
+    return ops_true;
+    }
+
+static int feed_reader(void *dest,size_t length,ops_error_t **errors,
+		       ops_reader_info_t *rinfo,ops_parse_cb_info_t *cbinfo)
+    {
+    feed_arg_t *arg=ops_reader_get_arg(rinfo);
+    size_t n;
+
+    OPS_USED(cbinfo);
+    OPS_USED(errors);
+
+    if(!feed_wait(arg))
+	return 0;
+
+    n=arg->length-arg->offset;
+    if(n > length)
+	n=length;
+    memcpy(dest,arg->buffer+arg->offset,n);
+    arg->offset+=n;
+
+    return n;
+    }
+
+static int feed_peek(const unsigned char **span,ops_error_t **errors,
+		     ops_reader_info_t *rinfo,ops_parse_cb_info_t *cbinfo)
+    {
+    feed_arg_t *arg=ops_reader_get_arg(rinfo);
+
+    OPS_USED(cbinfo);
+    OPS_USED(errors);
+
+    if(!feed_wait(arg))
+	return 0;
+
+    *span=arg->buffer+arg->offset;
+    if(arg->length-arg->offset > INT_MAX)
+	return INT_MAX;
+    return arg->length-arg->offset;
+    }
+
+static void feed_consume(const unsigned char *span,size_t length,
+			 ops_reader_info_t *rinfo)
+    {
+    feed_arg_t *arg=ops_reader_get_arg(rinfo);
+
+    OPS_USED(span);
+    assert(length <= arg->length-arg->offset);
+    arg->offset+=length;
+    }
+
+static void feed_destroyer(ops_reader_info_t *rinfo)
+    {
+    feed_arg_t *arg=ops_reader_get_arg(rinfo);
+
+    ops_coroutine_delete(arg->parse);
+    free(arg);
+    }
+
+/* The coroutine: parse until EOF or an error */
+static void feed_parse(void *arg_)
+    {
+    feed_arg_t *arg=arg_;
+    unsigned long pktlen;
+    int r;
+
+    do
+	r=ops_parse_one_packet(arg->pinfo,&pktlen);
+    while(r > 0);
+
+    /* -1 is EOF, unless the input has not ended */
+    if(r == 0 || !arg->finished)
+	arg->failed=ops_true;
+    arg->pinfo->suspended=NULL;
+    }
+
+static feed_arg_t *get_feed(ops_parse_info_t *pinfo)
+    {
+    ops_reader_info_t *base;
+    feed_arg_t *arg;
+
+    /* the feed is the base reader, under whatever the parse pushed */
+    for(base=&pinfo->rinfo ; base->next ; base=base->next)
+	;
+    if(base->reader == feed_reader)
+	return ops_reader_get_arg(base);
+
+    assert(!base->reader && !pinfo->suspended);
+    arg=ops_mallocz(sizeof *arg);
+    arg->pinfo=pinfo;
+    ops_reader_set(pinfo,feed_reader,feed_destroyer,arg);
+    ops_reader_set_span(pinfo,feed_peek,feed_consume);
+
+    arg->parse=ops_coroutine_new(feed_parse,arg);
+    if(!arg->parse)
+	{
+	OPS_ERROR(&pinfo->errors,OPS_E_FAIL,"No memory for a parse stack");
+	arg->failed=ops_true;
+	}
+    pinfo->suspended=arg->parse;
+    return arg;
+    }
+
+/* Let the parse run until it has read all of buf */
+static ops_parse_feed_t run_parse(feed_arg_t *arg,const unsigned char *buf,
+				  size_t length)
+    {
+    if(!arg->failed)
+	{
+	arg->buffer=buf;
+	arg->length=length;
+	arg->offset=0;
+	ops_coroutine_resume(arg->parse);
+	/* in case it stopped early, on an error */
+	arg->buffer=NULL;
+	arg->length=arg->offset=0;
+	}
+
+    return arg->failed ? OPS_PARSE_FEED_ERROR : OPS_PARSE_FEED_NEED_MORE;
+    }
+
+/**
+ * \ingroup Core_ReadPackets
+ * \brief Give the parser more input.
+ *
+ * The parse runs as far as \a buf takes it before this returns,
+ * calling the callbacks as ops_parse() would, including for the parts
+ * of a packet that have arrived so far. \a buf is not used after the
+ * call. Input passed this way must not also have a reader set, and
+ * must be binary: dearmour it first.
+ *
+ * The parse is suspended on a stack of its own between calls, so no
+ * thread is tied up waiting for input, and nothing is held beyond
+ * what the packets being parsed need. The callbacks run on that
+ * stack, which is 1MiB. Call ops_parse_finish() at the end of the
+ * input; if \a pinfo is deleted before that, the parse is unwound
+ * without calling the callbacks again.
+ *
+ * \param pinfo		Parse settings, with no reader set
+ * \param buf		The input
+ * \param length	Length of \a buf
+ * \return		OPS_PARSE_FEED_ERROR if a packet failed to parse,
+ *			in which case the parse is over, else
+ *			OPS_PARSE_FEED_NEED_MORE
+ * \sa ops_parse_finish()
+ */
+ops_parse_feed_t ops_parse_feed(ops_parse_info_t *pinfo,
+				const unsigned char *buf,size_t length)
+    { return run_parse(get_feed(pinfo),buf,length); }
+
+/**
+ * \ingroup Core_ReadPackets
+ * \brief Tell the parser there is no more input.
+ *
+ * The parse reads EOF and runs to its end. A packet cut short by the
+ * end of the input is an error.
+ *
+ * \param pinfo		Parse settings
+ * \return		1 if there were no errors in the parse, else 0,
+ *			as ops_parse() returns
+ */
+int ops_parse_finish(ops_parse_info_t *pinfo)
+    {
+    feed_arg_t *arg=get_feed(pinfo);
+
+    arg->finished=ops_true;
+    run_parse(arg,NULL,0);
+    return pinfo->errors ? 0 : 1;
+    }
+
+/* eof */
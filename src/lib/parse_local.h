@@ -31,8 +31,14 @@ struct ops_reader_info
                             data to be parsed */
     ops_reader_destroyer_t *destroyer;
     void *arg; /*!< the args to pass to the reader function */
+    ops_reader_borrow_t *borrow; /*!< set if the data can be used in place */
+    ops_reader_peek_t *peek; /*!< set if the data can be read a span at
+			       a time */
+    ops_reader_consume_t *consume; /*!< consumes what was peeked */
 
     ops_boolean_t accumulate:1;	/*!< set to accumulate packet data */
+    ops_boolean_t accumulated_borrowed:1; /*!< set if accumulated points
+					      into the reader's data */
     unsigned char *accumulated;	/*!< the accumulated data */
     unsigned asize;	/*!< size of the buffer */
     unsigned alength;	/*!< used buffer */
@@ -75,7 +81,11 @@ typedef struct
     unsigned char keyid[OPS_KEY_ID_SIZE];
     } ops_parse_hash_info_t;
 
+typedef struct ops_parse_iter ops_parse_iter_t;
+typedef struct ops_coroutine ops_coroutine_t;
+
 #define NTAGS	0x100
+#define NPTAGS	0x40 /* new format packet tags are 6 bits */
 /** \brief Structure to hold information about a packet parse.
  *
  *  This information includes options about the parse:
@@ -104,6 +114,10 @@ struct ops_parse_info
 				    set to get raw data */
     unsigned char ss_parsed[NTAGS/8]; /*!< one bit per signature-subpacket type;
 				       set to get parsed data */
+    unsigned char pkt_raw[NPTAGS/8]; /*!< one bit per packet tag; set to
+				      get the raw body */
+    unsigned char pkt_ignored[NPTAGS/8]; /*!< one bit per packet tag; set
+					  to skip the body */
 
     ops_reader_info_t rinfo;
     ops_parse_cb_info_t cbinfo;
@@ -112,7 +126,43 @@ struct ops_parse_info
     ops_crypt_info_t cryptinfo;
     size_t nhashes;
     ops_parse_hash_info_t *hashes;
+    size_t literal_chunk_size; /*!< most literal data to deliver at once */
+    unsigned char *literal_buffer; /*!< reused for literal data bodies */
+    ops_parse_iter_t *iter; /*!< set once ops_parse_next() is used */
+    ops_coroutine_t *suspended; /*!< the parse, while ops_parse_feed() or
+				  ops_parse_next() is running it */
     ops_boolean_t reading_v3_secret:1;
     ops_boolean_t reading_mpi_length:1;
     ops_boolean_t exact_read:1;
+    ops_boolean_t release_before_auth:1; /*!< set to stream SE IP
+					   plaintext before its MDC
+					   is checked */
+    ops_boolean_t lazy_mpis:1; /*!< set to keep public key and signature
+				 MPIs raw until they are needed */
+    ops_boolean_t abandoned:1; /*!< set when a suspended parse is
+				 deleted, to make it read EOF and
+				 unwind */
+    size_t max_decompressed; /*!< most bytes compressed packets may
+			       decompress to in all, 0 for no limit */
+    unsigned max_expansion; /*!< most a compressed packet may expand by,
+			      0 for no limit */
+    unsigned max_compressed_depth; /*!< most compressed packets may
+				     nest, 0 for no limit */
+    size_t decompressed; /*!< bytes decompressed so far */
+    unsigned compressed_depth; /*!< compressed packets being read */
+    unsigned decrypt_threads; /*!< threads to decrypt SE IP packets on,
+				0 or 1 to decrypt them serially */
+    size_t parallel_decrypt_min; /*!< least to decrypt on threads at
+				   once */
+    ops_crypt_backend_t crypt_backend; /*!< how to do the ciphers this
+					 sets up */
     };
+
+int ops_parse_one_packet(ops_parse_info_t *pinfo,unsigned long *pktlen);
+void ops_parse_iter_delete(ops_parse_iter_t *iter);
+
+typedef void ops_coroutine_fn_t(void *arg);
+ops_coroutine_t *ops_coroutine_new(ops_coroutine_fn_t *fn,void *arg);
+ops_boolean_t ops_coroutine_resume(ops_coroutine_t *co);
+void ops_coroutine_yield(ops_coroutine_t *co);
+void ops_coroutine_delete(ops_coroutine_t *co);
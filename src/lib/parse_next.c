@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) 2005-2008 Nominet UK (www.nic.uk)
+ * All rights reserved.
+ * Contributors: Ben Laurie, Rachel Willmer. The Contributors have asserted
+ * their moral rights under the UK Copyright Design and Patents Act 1988 to
+ * be recorded as the authors of this copyright work.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** \file
+ * Pull-style parsing: the caller asks for each item in turn.
+ *
+ * The parse runs as a coroutine (see coroutine.c). Each item it
+ * passes to the callbacks is handed to ops_parse_next(), with the
+ * parse suspended inside the callback until the next call, so that
+ * nothing is queued or copied.
+ */
+
+#include <openpgpsdk/packet-parse.h>
+#include <openpgpsdk/util.h>
+#include <openpgpsdk/errors.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "parse_local.h"
+
+#include <openpgpsdk/final.h>
+
+struct ops_parse_iter
+    {
+    ops_parse_info_t *pinfo;
+    ops_coroutine_t *parse; /*!< NULL if it could not be set up */
+    ops_parser_content_t item; /*!< the item being handed out */
+    };
+
+static ops_parse_cb_return_t
+iter_cb(const ops_parser_content_t *content_,ops_parse_cb_info_t *cbinfo)
+    {
+    ops_parse_iter_t *iter=ops_parse_cb_get_arg(cbinfo);
+    ops_parse_cb_return_t ret;
+
+    /* callbacks already set see everything first, and answer commands */
+    ret=ops_parse_stacked_cb(content_,cbinfo);
+    if(ret == OPS_KEEP_MEMORY)
+	return ret;
+    switch(content_->tag)
+	{
+    case OPS_PARSER_CMD_GET_SK_PASSPHRASE:
+    case OPS_PARSER_CMD_GET_SECRET_KEY:
+    case OPS_PARSER_CMD_GET_SK_PASSPHRASE_PREV_WAS_BAD:
+	return ret;
+
+    default:
+	break;
+	}
+
+    /* anything the item points to stays put until we are resumed */
+    iter->item=*content_;
+    ops_coroutine_yield(iter->parse);
+
+    /* the caller has it now */
+    return OPS_KEEP_MEMORY;
+    }
+
+/* The coroutine: parse until EOF or an error */
+static void iter_parse(void *iter_)
+    {
+    ops_parse_iter_t *iter=iter_;
+    unsigned long pktlen;
+
+    while(ops_parse_one_packet(iter->pinfo,&pktlen) > 0)
+	;
+    iter->pinfo->suspended=NULL;
+    }
+
+/**
+ * \ingroup Core_ReadPackets
+ * \brief Get the next item from the parse.
+ *
+ * An alternative to handling the items in a callback: the parse runs
+ * only as far as the next item, so the caller can stop at any point
+ * and just delete \a pinfo. Any callbacks already set still see each
+ * item first and answer requests for keys and passphrases; the items
+ * they return OPS_KEEP_MEMORY for are not returned here.
+ *
+ * The caller owns what \a content points to and frees it with
+ * ops_parser_content_free(). The data of literal data bodies, signed
+ * cleartext bodies and unarmoured text points into the parser's
+ * buffers, and is only valid until the next call.
+ *
+ * Items come out as they are parsed, the contents of compressed and
+ * encrypted packets included. The parse runs on a stack of its own,
+ * suspended between calls; the callbacks run on that stack too, which
+ * is 1MiB.
+ *
+ * \param pinfo		Parse settings, with a reader set
+ * \param content	Where to put the item
+ * \return		ops_false at the end of the input or after an
+ *			error, which is in pinfo's errors
+ */
+ops_boolean_t ops_parse_next(ops_parse_info_t *pinfo,
+			     ops_parser_content_t *content)
+    {
+    ops_parse_iter_t *iter=pinfo->iter;
+
+    if(!iter)
+	{
+	assert(!pinfo->suspended);
+	iter=pinfo->iter=ops_mallocz(sizeof *iter);
+	iter->pinfo=pinfo;
+	iter->parse=ops_coroutine_new(iter_parse,iter);
+	if(!iter->parse)
+	    {
+	    OPS_ERROR(&pinfo->errors,OPS_E_FAIL,"No memory for a parse stack");
+	    return ops_false;
+	    }
+	ops_parse_cb_push(pinfo,iter_cb,iter);
+	pinfo->suspended=iter->parse;
+	}
+
+    if(!iter->parse || !ops_coroutine_resume(iter->parse))
+	return ops_false;
+
+    *content=iter->item;
+    return ops_true;
+    }
+
+/* Free the iterator; by now the parse has been run to its end */
+void ops_parse_iter_delete(ops_parse_iter_t *iter)
+    {
+    if(!iter)
+	return;
+    ops_coroutine_delete(iter->parse);
+    free(iter);
+    }
+
+/* eof */
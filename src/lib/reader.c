@@ -48,8 +48,52 @@ void ops_reader_set(ops_parse_info_t *pinfo,ops_reader_t *reader,ops_reader_dest
     pinfo->rinfo.reader=reader;
     pinfo->rinfo.destroyer=destroyer;
     pinfo->rinfo.arg=arg;
+    pinfo->rinfo.borrow=NULL;
+    pinfo->rinfo.peek=NULL;
+    pinfo->rinfo.consume=NULL;
     }
 
+/**
+ * \ingroup Internal_Readers_Generic
+ * \brief Lets the parser use the base reader's data in place
+ * \param pinfo Parse settings
+ * \param borrow Borrower for the reader set with ops_reader_set()
+ * \note Data parsed while borrowing points into the reader's buffer
+ * and is only valid until the reader is destroyed.
+ */
+void ops_reader_set_borrow(ops_parse_info_t *pinfo,ops_reader_borrow_t *borrow)
+    {
+    assert(!pinfo->rinfo.next);
+    pinfo->rinfo.borrow=borrow;
+    }
+
+/**
+ * \ingroup Internal_Readers_Generic
+ * \brief Lets the top reader be read a span at a time
+ * \param pinfo Parse settings
+ * \param peek Peeker for the reader most recently set or pushed
+ * \param consume Consumer for the same reader
+ * \sa ops_reader_peek_t
+ */
+void ops_reader_set_span(ops_parse_info_t *pinfo,ops_reader_peek_t *peek,
+			 ops_reader_consume_t *consume)
+    {
+    assert(peek && consume);
+    pinfo->rinfo.peek=peek;
+    pinfo->rinfo.consume=consume;
+    }
+
+/**
+ * \ingroup Internal_Readers_Generic
+ * \brief Tells whether the top reader can be read a span at a time
+ * \param pinfo Parse settings
+ * \return ops_true if it can
+ * \note A reader that passes through the spans of the one below should
+ * check this before it is pushed, and only then set its own.
+ */
+ops_boolean_t ops_reader_has_span(ops_parse_info_t *pinfo)
+    { return pinfo->rinfo.peek != NULL; }
+
 /**
  * \ingroup Internal_Readers_Generic
  * \brief Adds to reader stack
@@ -83,7 +127,8 @@ void ops_reader_pop(ops_parse_info_t *pinfo)
     ops_reader_info_t *next=pinfo->rinfo.next;
     // We are about to overwrite pinfo->rinfo, so free any data in the
     // old rinfo structure first.
-    free(pinfo->rinfo.accumulated);
+    if(!pinfo->rinfo.accumulated_borrowed)
+	free(pinfo->rinfo.accumulated);
     pinfo->rinfo=*next;
     free(next);
     }
@@ -39,6 +39,7 @@
 
 #include <string.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include <openpgpsdk/final.h>
 
@@ -110,6 +111,11 @@ typedef struct
     unsigned npushed_back;
     // armoured block headers
     ops_headers_t headers;
+    // if the reader below has spans, the one we are reading from
+    ops_boolean_t use_span:1;
+    const unsigned char *span;
+    size_t span_length;
+    size_t span_used;
     } dearmour_arg_t;
 
 static void push_back(dearmour_arg_t *arg,const unsigned char *buf,
@@ -218,6 +224,35 @@ static int set_lastseen_headerline(dearmour_arg_t* arg, char* buf, ops_error_t *
     return 1;
     }
 
+/* Hand back what we've used of the span from the reader below. This
+   must be done before we return, as the span is only good until the
+   next call to that reader. */
+static void release_span(dearmour_arg_t *arg,ops_reader_info_t *rinfo)
+    {
+    ops_stacked_consume(arg->span,arg->span_used,rinfo);
+    arg->span=NULL;
+    arg->span_length=arg->span_used=0;
+    }
+
+/* Make sure there is something left in the span. Returns ops_false at
+   EOF or on error. */
+static ops_boolean_t fill_span(dearmour_arg_t *arg,ops_error_t **errors,
+			       ops_reader_info_t *rinfo,
+			       ops_parse_cb_info_t *cbinfo)
+    {
+    int n;
+
+    if(arg->span_used < arg->span_length)
+	return ops_true;
+
+    release_span(arg,rinfo);
+    n=ops_stacked_peek(&arg->span,errors,rinfo,cbinfo);
+    if(n <= 0)
+	return ops_false;
+    arg->span_length=n;
+    return ops_true;
+    }
+
 static int read_char(dearmour_arg_t *arg,ops_error_t **errors,
 		     ops_reader_info_t *rinfo,
 		     ops_parse_cb_info_t *cbinfo,
@@ -236,6 +271,12 @@ static int read_char(dearmour_arg_t *arg,ops_error_t **errors,
 		arg->pushed_back=NULL;
 		}
 	    }
+	else if(arg->use_span)
+	    {
+	    if(!fill_span(arg,errors,rinfo,cbinfo))
+		return -1;
+	    c[0]=arg->span[arg->span_used++];
+	    }
 	/* XXX: should ops_stacked_read exist? Shouldn't this be a limited_read? */
 	else if(ops_stacked_read(c,1,errors,rinfo,cbinfo) != 1)
 	    return -1;
@@ -396,6 +437,36 @@ static int process_dash_escaped(dearmour_arg_t *arg,ops_error_t **errors,
 	int c;
 	unsigned count;
 
+	/* the rest of a line can be copied straight from the span */
+	if(!arg->seen_nl && !arg->npushed_back
+	   && arg->span_used < arg->span_length)
+	    {
+	    const unsigned char *s=arg->span+arg->span_used;
+	    const unsigned char *e;
+	    size_t n=arg->span_length-arg->span_used;
+
+	    if(n > BODYSIZE-body->length)
+		n=BODYSIZE-body->length;
+	    if((e=memchr(s,'\n',n)))
+		n=e-s;
+	    if((e=memchr(s,'\r',n)))
+		n=e-s;
+	    if(n)
+		{
+		memcpy(body->data+body->length,s,n);
+		body->length+=n;
+		total+=n;
+		arg->span_used+=n;
+		arg->prev_nl=ops_false;
+		if(body->length == BODYSIZE)
+		    {
+		    CB(cbinfo,OPS_PTAG_CT_SIGNED_CLEARTEXT_BODY,&content);
+		    body->length=0;
+		    }
+		continue;
+		}
+	    }
+
 	if((c=read_char(arg,errors,rinfo,cbinfo,ops_true)) < 0)
 	    return -1;
 	if(arg->prev_nl && c == '-')
@@ -574,6 +645,27 @@ static int parse_headers(dearmour_arg_t *arg,ops_error_t **errors,
     return rtn;
     }
 
+/* The value of each base64 character, -1 for anything else */
+static const signed char decode_table[256]=
+    {
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,62,-1,-1,-1,63,
+    52,53,54,55,56,57,58,59,60,61,-1,-1,-1,-1,-1,-1,
+    -1, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9,10,11,12,13,14,
+    15,16,17,18,19,20,21,22,23,24,25,-1,-1,-1,-1,-1,
+    -1,26,27,28,29,30,31,32,33,34,35,36,37,38,39,40,
+    41,42,43,44,45,46,47,48,49,50,51,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    };
+
 static int read4(dearmour_arg_t *arg,ops_error_t **errors,
 		 ops_reader_info_t *rinfo,ops_parse_cb_info_t *cbinfo,
 		 int *pc,unsigned *pn,unsigned long *pl)
@@ -593,22 +685,10 @@ static int read4(dearmour_arg_t *arg,ops_error_t **errors,
 	    break;
 	if(c == '=')
 	    break;
-	l <<= 6;
-	if(c >= 'A' && c <= 'Z')
-	    l+=c-'A';
-	else if(c >= 'a' && c <= 'z')
-	    l+=c-'a'+26;
-	else if(c >= '0' && c <= '9')
-	    l+=c-'0'+52;
-	else if(c == '+')
-	    l+=62;
-	else if(c == '/')
-	    l+=63;
-	else
-	    {
+	if(decode_table[c] < 0)
 	    --n;
-	    l >>= 6;
-	    }
+	else
+	    l=(l << 6)+decode_table[c];
 	}
 
     *pc=c;
@@ -618,18 +698,68 @@ static int read4(dearmour_arg_t *arg,ops_error_t **errors,
     return 4;
     }
 
-unsigned ops_crc24(unsigned checksum,unsigned char c)
+/* The CRC is kept in the top 24 bits of 32, so a byte goes in at the
+   top. crc24_table[k][i] is byte i followed by k zero bytes. */
+static unsigned crc24_table[8][256];
+static pthread_once_t crc24_once=PTHREAD_ONCE_INIT;
+
+static void crc24_init(void)
     {
     unsigned i;
+    unsigned k;
+
+    for(i=0 ; i < 256 ; ++i)
+	{
+	unsigned t=i << 24;
+
+	for(k=0 ; k < 8 ; ++k)
+	    t=(t << 1)^(t&0x80000000U ? CRC24_POLY << 8 : 0);
+	crc24_table[0][i]=t&0xffffffffU;
+	}
+    for(k=1 ; k < 8 ; ++k)
+	for(i=0 ; i < 256 ; ++i)
+	    crc24_table[k][i]=((crc24_table[k-1][i] << 8)
+			       ^crc24_table[0][crc24_table[k-1][i] >> 24])
+		&0xffffffffU;
+    }
+
+/**
+ * \ingroup Core_Readers_Armour
+ * \brief Add data to an armour checksum.
+ *
+ * Eight bytes are done at a time, by table lookup.
+ *
+ * \param checksum	The checksum so far, CRC24_INIT to start
+ * \param buf		The data
+ * \param length	Length of \a buf
+ * \return		The new checksum
+ */
+unsigned ops_crc24_update(unsigned checksum,const unsigned char *buf,
+			  size_t length)
+    {
+    unsigned c=(checksum&0xffffffU) << 8;
+
+    pthread_once(&crc24_once,crc24_init);
 
-    checksum ^= c << 16;
-    for(i=0 ; i < 8 ; i++)
+    for( ; length >= 8 ; buf+=8,length-=8)
 	{
-	checksum <<= 1;
-	if(checksum & 0x1000000)
-	    checksum ^= CRC24_POLY;
+	unsigned a=c^((unsigned)buf[0] << 24)^(buf[1] << 16)^(buf[2] << 8)
+	    ^buf[3];
+
+	c=crc24_table[7][a >> 24]^crc24_table[6][(a >> 16)&0xff]
+	    ^crc24_table[5][(a >> 8)&0xff]^crc24_table[4][a&0xff]
+	    ^crc24_table[3][buf[4]]^crc24_table[2][buf[5]]
+	    ^crc24_table[1][buf[6]]^crc24_table[0][buf[7]];
 	}
-    return checksum&0xffffffL;
+    for( ; length ; ++buf,--length)
+	c=((c << 8)^crc24_table[0][(c >> 24)^*buf])&0xffffffffU;
+
+    return c >> 8;
+    }
+
+unsigned ops_crc24(unsigned checksum,unsigned char c)
+    {
+    return ops_crc24_update(checksum,&c,1);
     }
 
 static int decode64(dearmour_arg_t *arg,ops_error_t **errors,
@@ -768,6 +898,76 @@ static int decode64(dearmour_arg_t *arg,ops_error_t **errors,
     return 1;
     }
 
+/* Decode whole groups of four base64 characters straight from the
+   span of the reader below, skipping line ends as read4() does. This
+   stops at anything else, leaving padding, the checksum, the end of
+   the block and malformed input to decode64(), and at the end of the
+   span, so a group split across spans also goes the slow way. Returns
+   the number of bytes put in dest. */
+static unsigned decode64_span(dearmour_arg_t *arg,unsigned char *dest,
+			      unsigned length)
+    {
+    const unsigned char *s=arg->span+arg->span_used;
+    const unsigned char *end=arg->span+arg->span_length;
+    ops_boolean_t nl=arg->seen_nl;
+    ops_boolean_t prev_nl=arg->prev_nl;
+    unsigned out=0;
+
+    while(length-out >= 3)
+	{
+	const unsigned char *p=s;
+	ops_boolean_t group_nl=nl;
+	ops_boolean_t group_prev_nl=prev_nl;
+	unsigned long l=0;
+	unsigned n=0;
+
+	/* the usual case: four characters in a row */
+	if(end-p >= 4 && (decode_table[p[0]] | decode_table[p[1]]
+			  | decode_table[p[2]] | decode_table[p[3]]) >= 0)
+	    {
+	    l=(decode_table[p[0]] << 18)+(decode_table[p[1]] << 12)
+		+(decode_table[p[2]] << 6)+decode_table[p[3]];
+	    p+=4;
+	    group_prev_nl=ops_false;
+	    group_nl=ops_false;
+	    }
+	else
+	    {
+	    for( ; n < 4 && p < end ; ++p)
+		{
+		if(*p == '\r')
+		    continue;
+		group_prev_nl=group_nl;
+		group_nl=*p == '\n';
+		if(group_nl)
+		    continue;
+		if(decode_table[*p] < 0)
+		    break;
+		l=(l << 6)+decode_table[*p];
+		++n;
+		}
+	    if(n < 4)
+		break;
+	    }
+
+	dest[out]=l >> 16;
+	dest[out+1]=l >> 8;
+	dest[out+2]=l;
+	out+=3;
+
+	s=p;
+	nl=group_nl;
+	prev_nl=group_prev_nl;
+	}
+
+    arg->checksum=ops_crc24_update(arg->checksum,dest,out);
+    arg->span_used=s-arg->span;
+    arg->seen_nl=nl;
+    arg->prev_nl=prev_nl;
+
+    return out;
+    }
+
 static void base64(dearmour_arg_t *arg)
     {
     arg->state=BASE64;
@@ -780,9 +980,8 @@ static void base64(dearmour_arg_t *arg)
 // content - this is because plaintext is not encapsulated in PGP
 // packets... it also calls back for the text between the blocks.
 
-static int armoured_data_reader(void *dest_,size_t length,ops_error_t **errors,
-				ops_reader_info_t *rinfo,
-				ops_parse_cb_info_t *cbinfo)
+static int dearmour(void *dest_,size_t length,ops_error_t **errors,
+		    ops_reader_info_t *rinfo,ops_parse_cb_info_t *cbinfo)
      {
      dearmour_arg_t *arg=ops_reader_get_arg(rinfo);
      ops_parser_content_t content;
@@ -893,6 +1092,20 @@ static int armoured_data_reader(void *dest_,size_t length,ops_error_t **errors,
 	     first=ops_true;
 	     while(length > 0)
 		 {
+		 if(length >= 3 && !arg->buffered && !arg->eof64
+		    && arg->use_span && !arg->npushed_back
+		    && fill_span(arg,errors,rinfo,cbinfo))
+		     {
+		     n=decode64_span(arg,dest,length);
+		     if(n)
+			 {
+			 dest+=n;
+			 length-=n;
+			 first=ops_false;
+			 continue;
+			 }
+		     }
+
 		 if(!arg->buffered)
 		     {
 		     if(!arg->eof64)
@@ -990,6 +1203,19 @@ static int armoured_data_reader(void *dest_,size_t length,ops_error_t **errors,
     return saved;
     }
 
+static int armoured_data_reader(void *dest,size_t length,ops_error_t **errors,
+				ops_reader_info_t *rinfo,
+				ops_parse_cb_info_t *cbinfo)
+    {
+    dearmour_arg_t *arg=ops_reader_get_arg(rinfo);
+    int r=dearmour(dest,length,errors,rinfo,cbinfo);
+
+    if(arg->use_span)
+	release_span(arg,rinfo);
+
+    return r;
+    }
+
 static void armoured_data_destroyer(ops_reader_info_t *rinfo)
     { free(ops_reader_get_arg(rinfo)); }
 
@@ -1030,6 +1256,7 @@ void ops_reader_push_dearmour(ops_parse_info_t *parse_info)
 */
     arg->expect_sig=ops_false;
     arg->got_sig=ops_false;
+    arg->use_span=ops_reader_has_span(parse_info);
 
     ops_reader_push(parse_info,armoured_data_reader,armoured_data_destroyer,arg);
     }
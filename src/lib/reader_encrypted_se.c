@@ -113,7 +113,7 @@ static int encrypted_data_reader(void *dest,size_t length,ops_error_t **errors,
 	    unsigned n=arg->region->length;
 	    unsigned char buffer[1024];
 
-	    if(!n)
+	    if(!n && !arg->region->indeterminate)
             {
 		return -1;
             }
@@ -143,12 +143,26 @@ static int encrypted_data_reader(void *dest,size_t length,ops_error_t **errors,
 		return -1;
             }
 
+	    if(arg->region->indeterminate)
+		{
+		n=arg->region->last_read;
+		if(n == 0)
+		    return saved-length;
+		}
+
 	    if(!rinfo->pinfo->reading_v3_secret
 	       || !rinfo->pinfo->reading_mpi_length)
                 {
                 arg->decrypted_count=ops_decrypt_se_ip(arg->decrypt,
                                   arg->decrypted,
                                   buffer,n);
+                if(arg->decrypted_count == (size_t)-1)
+                    {
+                    arg->decrypted_count=0;
+                    OPS_ERROR(errors,OPS_E_PROTO_BAD_SYMMETRIC_DECRYPT,
+                              "Symmetric decryption failed");
+                    return -1;
+                    }
 
                 if (debug)
                     {
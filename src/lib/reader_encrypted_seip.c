@@ -44,172 +44,455 @@
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #ifndef WIN32
 #include <unistd.h>
 #endif
 #include <errno.h>
 #include <limits.h>
+#include <pthread.h>
 
 #include <openpgpsdk/final.h>
 
-static int debug=0;
+/* size of the trailing MDC packet: tag, length and SHA-1 hash */
+#define MDC_SIZE	(1+1+OPS_SHA1_HASH_SIZE)
+
+/* how much plaintext to decrypt at a time when streaming */
+#define SE_IP_WINDOW	8192
 
+/* least to give each thread when decrypting on several */
+#define SEGMENT_MIN	16384
+
+/* A segment of the buffer for a worker thread to decrypt in place */
+typedef struct cfb_job
+    {
+    unsigned char *data;
+    size_t length;
+    unsigned char iv[OPS_MAX_BLOCK_SIZE]; /*!< the ciphertext before it */
+    ops_boolean_t done:1;
+    ops_boolean_t failed:1; /*!< set if the crypt failed */
+    struct cfb_job *next_queued;
+    } cfb_job_t;
+
+/* A worker thread. Its crypt is copied from the reader's before the
+   thread starts, while nothing else is using that. */
 typedef struct
     {
-    // boolean: false once we've done the preamble/MDC checks
-    // and are reading from the plaintext
-    int passed_checks; 
-    unsigned char *plaintext;
-    size_t plaintext_available;
-    size_t plaintext_offset;
-    ops_region_t *region;
+    pthread_t thread;
+    ops_crypt_t crypt;
+    struct decrypt_se_ip_arg *arg;
+    } decrypt_worker_t;
+
+typedef struct decrypt_se_ip_arg
+    {
     ops_crypt_t *decrypt;
+    ops_region_t *region;
+    // release plaintext before the MDC has been checked
+    ops_boolean_t release_before_auth:1;
+    // set once the preamble has been checked
+    ops_boolean_t started:1;
+    // set once the MDC has been checked
+    ops_boolean_t finished:1;
+    ops_hash_t hash; /*!< MDC hash, fed as plaintext is decrypted */
+    /* Decrypted data. The last MDC_SIZE bytes are held back until
+       we know whether they are the MDC. */
+    unsigned char *buffer;
+    size_t size; /*!< allocated size of buffer */
+    size_t length; /*!< bytes in buffer */
+    size_t offset; /*!< bytes of buffer already returned */
+    size_t hashed; /*!< bytes of buffer already hashed */
+    /* Set if we decrypt, on several threads, rather than a reader
+       below us */
+    unsigned nthreads;
+    size_t parallel_min; /*!< least to decrypt on threads at once */
+    size_t decrypted; /*!< bytes decrypted so far */
+    decrypt_worker_t *workers; /*!< nthreads-1, started when needed */
+    unsigned nworkers; /*!< how many of them did start */
+    pthread_mutex_t lock;
+    pthread_cond_t work; /*!< signalled when a job is queued */
+    pthread_cond_t done; /*!< signalled when a job is done */
+    ops_boolean_t stop:1; /*!< tells the workers to exit */
+    cfb_job_t *jobs; /*!< one per thread */
+    cfb_job_t *queue;
     } decrypt_se_ip_arg_t;
 
-static int se_ip_data_reader(void *dest_, size_t len, ops_error_t **errors,
-                             ops_reader_info_t *rinfo,
-                             ops_parse_cb_info_t *cbinfo)
+static void *decrypt_worker(void *worker_)
+    {
+    decrypt_worker_t *worker=worker_;
+    decrypt_se_ip_arg_t *arg=worker->arg;
+    ops_crypt_t *crypt=&worker->crypt;
+
+    pthread_mutex_lock(&arg->lock);
+    for( ; ; )
+	{
+	cfb_job_t *job;
+
+	while(!arg->queue && !arg->stop)
+	    pthread_cond_wait(&arg->work,&arg->lock);
+	if(!arg->queue)
+	    break;
+	job=arg->queue;
+	arg->queue=job->next_queued;
+	pthread_mutex_unlock(&arg->lock);
+
+	crypt->set_iv(crypt,job->iv);
+	crypt->cfb_decrypt(crypt,job->data,job->data,job->length);
+
+	pthread_mutex_lock(&arg->lock);
+	job->failed=crypt->failed;
+	job->done=ops_true;
+	pthread_cond_broadcast(&arg->done);
+	}
+    pthread_mutex_unlock(&arg->lock);
+
+    crypt->decrypt_finish(crypt);
+
+    return NULL;
+    }
+
+/* Read ciphertext from below. A short read means the end of the
+   packet. */
+static int read_ciphertext(decrypt_se_ip_arg_t *arg,unsigned char *dest,
+			   size_t length,ops_error_t **errors,
+			   ops_reader_info_t *rinfo,
+			   ops_parse_cb_info_t *cbinfo)
+    {
+    ops_region_t *region=arg->region;
+
+    if(length > INT_MAX)
+	length=INT_MAX;
+    if(!region->indeterminate
+       && length > region->length-region->length_read)
+	length=region->length-region->length_read;
+    if(!length)
+	return 0;
+
+    if(!ops_stacked_limited_read(dest,length,region,errors,rinfo,cbinfo))
+	return -1;
+    if(region->indeterminate)
+	length=region->last_read;
+
+    return length;
+    }
+
+/* Reads and checks the preamble, RFC4880 5.13 */
+static ops_boolean_t read_preamble(decrypt_se_ip_arg_t *arg,
+				   ops_error_t **errors,
+				   ops_reader_info_t *rinfo,
+				   ops_parse_cb_info_t *cbinfo)
+    {
+    unsigned char preamble[OPS_MAX_BLOCK_SIZE+2];
+    size_t b=arg->decrypt->blocksize;
+
+    if(arg->nthreads)
+	{
+	if(read_ciphertext(arg,preamble,b+2,errors,rinfo,cbinfo) != (int)(b+2))
+	    {
+	    OPS_ERROR(errors,OPS_E_R_EARLY_EOF,"SE IP packet too short");
+	    return ops_false;
+	    }
+	arg->decrypt->cfb_decrypt(arg->decrypt,preamble,preamble,b+2);
+	arg->decrypted=b+2;
+	if(arg->decrypt->failed)
+	    {
+	    OPS_ERROR(errors,OPS_E_PROTO_BAD_SYMMETRIC_DECRYPT,
+		      "Symmetric decryption failed");
+	    return ops_false;
+	    }
+	}
+    else if(ops_stacked_read(preamble,b+2,errors,rinfo,cbinfo) != (int)(b+2))
+	{
+	OPS_ERROR(errors,OPS_E_R_EARLY_EOF,"SE IP packet too short");
+	return ops_false;
+	}
+
+    if(preamble[b-2] != preamble[b] || preamble[b-1] != preamble[b+1])
+	{
+	OPS_ERROR_4(errors,OPS_E_PROTO_BAD_SYMMETRIC_DECRYPT,
+		    "Bad symmetric decrypt when parsing SE IP packet "
+		    "(%02x%02x vs %02x%02x)",
+		    preamble[b-2],preamble[b-1],preamble[b],preamble[b+1]);
+	return ops_false;
+	}
+
+    ops_hash_any(&arg->hash,OPS_HASH_SHA1);
+    arg->hash.init(&arg->hash);
+    arg->hash.add(&arg->hash,preamble,b+2);
+
+    return ops_true;
+    }
+
+/* Hash whatever is now known not to be part of the MDC */
+static void hash_plaintext(decrypt_se_ip_arg_t *arg)
+    {
+    if(arg->length < MDC_SIZE || arg->length-MDC_SIZE <= arg->hashed)
+	return;
+    arg->hash.add(&arg->hash,arg->buffer+arg->hashed,
+		  arg->length-MDC_SIZE-arg->hashed);
+    arg->hashed=arg->length-MDC_SIZE;
+    }
+
+/* Start the worker threads. If none start, we decrypt serially. */
+static void start_workers(decrypt_se_ip_arg_t *arg)
+    {
+    unsigned n;
+
+    arg->workers=malloc((arg->nthreads-1)*sizeof *arg->workers);
+    for(n=0 ; n < arg->nthreads-1 ; ++n)
+	{
+	decrypt_worker_t *worker=&arg->workers[n];
+
+	worker->arg=arg;
+	ops_crypt_clone(&worker->crypt,arg->decrypt);
+	if(pthread_create(&worker->thread,NULL,decrypt_worker,worker) != 0)
+	    {
+	    worker->crypt.decrypt_finish(&worker->crypt);
+	    break;
+	    }
+	}
+    arg->nworkers=n;
+    }
+
+/*
+ * Decrypt the length bytes of ciphertext just read into the buffer, in
+ * place, and hash them. If there's enough, the whole blocks are cut
+ * into a segment per thread, each decrypted with the ciphertext block
+ * before it as the IV; we do the first segment with the crypt itself,
+ * and hash each one as soon as it's done. The crypt is then set to be
+ * where it would be after decrypting them all, for what follows.
+ */
+static void decrypt_window(decrypt_se_ip_arg_t *arg,size_t length)
     {
+    ops_crypt_t *decrypt=arg->decrypt;
+    size_t b=decrypt->blocksize;
+    unsigned char *data=arg->buffer+arg->length;
+    unsigned char last[OPS_MAX_BLOCK_SIZE];
+    size_t head,body=0,segment;
+    unsigned n,njobs;
+
+    /* up to the next block boundary */
+    head=(b-arg->decrypted%b)%b;
+    arg->decrypted+=length;
+    if(length < arg->parallel_min || head >= length)
+	njobs=0;
+    else
+	{
+	body=(length-head)/b*b;
+	njobs=body/SEGMENT_MIN;
+	if(njobs > arg->nthreads)
+	    njobs=arg->nthreads;
+	}
+    if(njobs >= 2 && !arg->workers)
+	start_workers(arg);
+    // we do one of the jobs ourselves
+    if(njobs > arg->nworkers+1)
+	njobs=arg->nworkers+1;
+    if(njobs < 2)
+	{
+	decrypt->cfb_decrypt(decrypt,data,data,length);
+	arg->length+=length;
+	hash_plaintext(arg);
+	return;
+	}
+
+    /* the IVs have to be taken before any of it is decrypted */
+    segment=body/njobs/b*b;
+    memcpy(last,data+head+body-b,b);
+    for(n=1 ; n < njobs ; ++n)
+	{
+	cfb_job_t *job=&arg->jobs[n];
+
+	job->data=data+head+n*segment;
+	job->length=n == njobs-1 ? body-n*segment : segment;
+	memcpy(job->iv,job->data-b,b);
+	job->done=ops_false;
+	job->next_queued=n == njobs-1 ? NULL : &arg->jobs[n+1];
+	}
+    pthread_mutex_lock(&arg->lock);
+    arg->queue=&arg->jobs[1];
+    pthread_cond_broadcast(&arg->work);
+    pthread_mutex_unlock(&arg->lock);
+
+    decrypt->cfb_decrypt(decrypt,data,data,head+segment);
+    arg->length+=head+segment;
+    hash_plaintext(arg);
+
+    for(n=1 ; n < njobs ; ++n)
+	{
+	cfb_job_t *job=&arg->jobs[n];
+
+	pthread_mutex_lock(&arg->lock);
+	while(!job->done)
+	    pthread_cond_wait(&arg->done,&arg->lock);
+	pthread_mutex_unlock(&arg->lock);
+	if(job->failed)
+	    decrypt->failed=ops_true;
+	arg->length+=job->length;
+	hash_plaintext(arg);
+	}
+
+    decrypt->set_iv(decrypt,last);
+    length-=head+body;
+    decrypt->cfb_decrypt(decrypt,data+head+body,data+head+body,length);
+    arg->length+=length;
+    hash_plaintext(arg);
+    }
 
-    /*
-      Gets entire SE_IP data packet.
-      Verifies leading preamble
-      Verifies trailing MDC packet
-      Then passes up plaintext as requested
-    */
+/* Called at the end of the packet: the held back bytes should be the
+   MDC packet, and it should match what we have hashed */
+static ops_boolean_t check_mdc(decrypt_se_ip_arg_t *arg,ops_error_t **errors)
+    {
+    unsigned char hashed[OPS_SHA1_HASH_SIZE];
+    const unsigned char *mdc;
+
+    arg->finished=ops_true;
+
+    if(arg->length < MDC_SIZE)
+	{
+	arg->hash.finish(&arg->hash,hashed);
+	OPS_ERROR(errors,OPS_E_R_EARLY_EOF,"SE IP packet too short");
+	return ops_false;
+	}
+
+    mdc=arg->buffer+arg->length-MDC_SIZE;
+    // the MDC packet's tag and length are hashed too
+    arg->hash.add(&arg->hash,mdc,2);
+    arg->hash.finish(&arg->hash,hashed);
+
+    if(mdc[0] != 0xD3 || mdc[1] != 0x14
+       || memcmp(mdc+2,hashed,OPS_SHA1_HASH_SIZE))
+	{
+	OPS_ERROR(errors,OPS_E_V_BAD_HASH,"Bad hash in MDC packet");
+	return ops_false;
+	}
+
+    return ops_true;
+    }
 
-    unsigned int n=0;
+/* Decrypt more of the packet into the buffer. When streaming, we
+   keep only the held back bytes and read one window; otherwise we
+   read the rest of the packet. */
+static int fill_buffer(decrypt_se_ip_arg_t *arg,ops_error_t **errors,
+		       ops_reader_info_t *rinfo,ops_parse_cb_info_t *cbinfo)
+    {
+    for( ; ; )
+	{
+	size_t n;
+	int r;
+
+	if(arg->release_before_auth)
+	    {
+	    if(arg->length > MDC_SIZE)
+		{
+		size_t keep=MDC_SIZE;
+
+		memmove(arg->buffer,arg->buffer+arg->length-keep,keep);
+		arg->length=keep;
+		arg->offset=arg->hashed=0;
+		}
+	    }
+	else if(arg->length == arg->size)
+	    {
+	    arg->size=arg->size*2+SE_IP_WINDOW;
+	    arg->buffer=realloc(arg->buffer,arg->size);
+	    }
+
+	n=arg->size-arg->length;
+	if(arg->nthreads)
+	    {
+	    r=read_ciphertext(arg,arg->buffer+arg->length,n,errors,rinfo,
+			      cbinfo);
+	    if(r < 0)
+		return r;
+	    decrypt_window(arg,r);
+	    if(arg->decrypt->failed)
+		{
+		OPS_ERROR(errors,OPS_E_PROTO_BAD_SYMMETRIC_DECRYPT,
+			  "Symmetric decryption failed");
+		return -1;
+		}
+	    }
+	else
+	    {
+	    r=ops_stacked_read(arg->buffer+arg->length,n,errors,rinfo,cbinfo);
+	    if(r < 0)
+		return r;
+	    arg->length+=r;
+	    hash_plaintext(arg);
+	    }
+
+	// a short read means we've reached the end of the packet
+	if((size_t)r < n)
+	    return check_mdc(arg,errors) ? 1 : -1;
+
+	if(arg->release_before_auth)
+	    return 1;
+	}
+    }
 
-    ops_region_t decrypted_region;
+/*
+  Returns the plaintext of an SE IP data packet, checking the leading
+  preamble and trailing MDC packet.
+
+  By default, the whole packet is read (hashing it as we go) and the
+  MDC checked before any plaintext is returned. If the parse was set
+  up with ops_parse_options_release_before_auth(), plaintext is returned
+  a window at a time as it is decrypted, so memory use is constant,
+  but a bad MDC is only reported (as an error return) once the end of
+  the packet is reached, after the bad plaintext has been returned.
+ */
+static int se_ip_data_peek(const unsigned char **span,ops_error_t **errors,
+			   ops_reader_info_t *rinfo,
+			   ops_parse_cb_info_t *cbinfo)
+    {
+    decrypt_se_ip_arg_t *arg=ops_reader_get_arg(rinfo);
 
+    if(!arg->started)
+	{
+	if(!read_preamble(arg,errors,rinfo,cbinfo))
+	    return -1;
+	arg->started=ops_true;
+	}
+
+    // only hashed bytes can be returned: the rest may be the MDC
+    while(arg->offset >= arg->hashed)
+	{
+	if(arg->finished)
+	    return 0;
+	if(fill_buffer(arg,errors,rinfo,cbinfo) < 0)
+	    return -1;
+	}
+
+    *span=arg->buffer+arg->offset;
+    if(arg->hashed-arg->offset > INT_MAX)
+	return INT_MAX;
+    return arg->hashed-arg->offset;
+    }
+
+static void se_ip_data_consume(const unsigned char *span,size_t length,
+			       ops_reader_info_t *rinfo)
+    {
     decrypt_se_ip_arg_t *arg=ops_reader_get_arg(rinfo);
 
-    if (!arg->passed_checks)
-        {
-        unsigned char*buf=NULL;
-
-        ops_hash_t hash;
-        unsigned char hashed[SHA_DIGEST_LENGTH];
-
-        size_t b;
-        size_t sz_preamble;
-        size_t sz_mdc_hash;
-        size_t sz_mdc;
-        size_t sz_plaintext;
-
-        unsigned char* preamble;
-        unsigned char* plaintext;
-        unsigned char* mdc;
-        unsigned char* mdc_hash;
-
-        ops_hash_any(&hash,OPS_HASH_SHA1);
-        hash.init(&hash);
-
-        ops_init_subregion(&decrypted_region,NULL);
-        decrypted_region.length = arg->region->length - arg->region->length_read;
-        buf=ops_mallocz(decrypted_region.length);
-
-        // read entire SE IP packet
-        
-        if (!ops_stacked_limited_read(buf,decrypted_region.length, &decrypted_region,errors,rinfo,cbinfo))
-            {
-            free (buf);
-            return -1;
-            }
-
-        if (debug)
-            {
-            unsigned int i=0;
-            fprintf(stderr,"\n\nentire SE IP packet (len=%d):\n",decrypted_region.length);
-            for (i=0; i<decrypted_region.length; i++)
-                {
-                fprintf(stderr,"0x%02x ", buf[i]);
-                if (!((i+1)%8))
-                    fprintf(stderr,"\n");
-                }
-            fprintf(stderr,"\n");
-            fprintf(stderr,"\n");
-            }
-
-        // verify leading preamble
-
-        if (debug)
-            {
-            unsigned int i=0;
-            fprintf(stderr,"\npreamble: ");
-            for (i=0; i<arg->decrypt->blocksize+2;i++)
-                fprintf(stderr," 0x%02x", buf[i]);
-            fprintf(stderr,"\n");
-            }
-
-        b=arg->decrypt->blocksize;
-        if(buf[b-2] != buf[b] || buf[b-1] != buf[b+1])
-            {
-            fprintf(stderr,"Bad symmetric decrypt (%02x%02x vs %02x%02x)\n",
-                    buf[b-2],buf[b-1],buf[b],buf[b+1]);
-            OPS_ERROR(errors, OPS_E_PROTO_BAD_SYMMETRIC_DECRYPT,"Bad symmetric decrypt when parsing SE IP packet");
-            free(buf);
-            return -1;
-            }
-
-        // Verify trailing MDC hash
-
-        sz_preamble=arg->decrypt->blocksize+2;
-        sz_mdc_hash=OPS_SHA1_HASH_SIZE;
-        sz_mdc=1+1+sz_mdc_hash;
-        sz_plaintext=decrypted_region.length-sz_preamble-sz_mdc;
-
-        preamble=buf;
-        plaintext=buf+sz_preamble;
-        mdc=plaintext+sz_plaintext;
-        mdc_hash=mdc+2;
-    
-#ifdef DEBUG
-        if (debug)
-            {
-            unsigned int i=0;
-
-            fprintf(stderr,"\nplaintext (len=%ld): ",sz_plaintext);
-            for (i=0; i<sz_plaintext;i++)
-                fprintf(stderr," 0x%02x", plaintext[i]);
-            fprintf(stderr,"\n");
-
-            fprintf(stderr,"\nmdc (len=%ld): ",sz_mdc);
-            for (i=0; i<sz_mdc;i++)
-                fprintf(stderr," 0x%02x", mdc[i]);
-            fprintf(stderr,"\n");
-            }
-#endif /*DEBUG*/
-
-        ops_calc_mdc_hash(preamble,sz_preamble,plaintext,sz_plaintext,&hashed[0]);
-
-        if (memcmp(mdc_hash,hashed,OPS_SHA1_HASH_SIZE))
-            {
-            OPS_ERROR(errors, OPS_E_V_BAD_HASH, "Bad hash in MDC packet");
-            free(buf);
-            return 0;
-            }
-
-        // all done with the checks
-        // now can start reading from the plaintext
-        assert(!arg->plaintext);
-        arg->plaintext=ops_mallocz(sz_plaintext);
-        memcpy(arg->plaintext, plaintext, sz_plaintext);
-        arg->plaintext_available=sz_plaintext;
-
-        arg->passed_checks=1;
-
-        free(buf);
-        }
-
-    n=len;
-    if (n > arg->plaintext_available)
-        n=arg->plaintext_available;
-
-    memcpy(dest_, arg->plaintext+arg->plaintext_offset, n);
-    arg->plaintext_available-=n;
-    arg->plaintext_offset+=n;
-    len-=n;
+    OPS_USED(span);
+    assert(length <= arg->hashed-arg->offset);
+    arg->offset+=length;
+    }
+
+static int se_ip_data_reader(void *dest_, size_t len, ops_error_t **errors,
+                             ops_reader_info_t *rinfo,
+                             ops_parse_cb_info_t *cbinfo)
+    {
+    const unsigned char *span;
+    int n=se_ip_data_peek(&span,errors,rinfo,cbinfo);
+
+    if(n <= 0)
+	return n;
+    if((size_t)n > len)
+	n=len;
+
+    memcpy(dest_,span,n);
+    se_ip_data_consume(span,n,rinfo);
 
     return n;
     }
@@ -217,13 +500,42 @@ static int se_ip_data_reader(void *dest_, size_t len, ops_error_t **errors,
 static void se_ip_data_destroyer(ops_reader_info_t *rinfo)
     {
     decrypt_se_ip_arg_t* arg=ops_reader_get_arg(rinfo);
-    free (arg->plaintext);
-    free (arg);
-    //    free(ops_reader_get_arg(rinfo));
+
+    if(arg->started && !arg->finished)
+	{
+	unsigned char hashed[OPS_SHA1_HASH_SIZE];
+
+	arg->hash.finish(&arg->hash,hashed);
+	}
+    if(arg->nthreads)
+	{
+	unsigned n;
+
+	if(arg->workers)
+	    {
+	    pthread_mutex_lock(&arg->lock);
+	    arg->stop=ops_true;
+	    pthread_cond_broadcast(&arg->work);
+	    pthread_mutex_unlock(&arg->lock);
+	    for(n=0 ; n < arg->nworkers ; ++n)
+		pthread_join(arg->workers[n].thread,NULL);
+	    free(arg->workers);
+	    }
+	pthread_cond_destroy(&arg->done);
+	pthread_cond_destroy(&arg->work);
+	pthread_mutex_destroy(&arg->lock);
+	free(arg->jobs);
+	}
+    free(arg->buffer);
+    free(arg);
     }
 
 /**
    \ingroup Internal_Readers_SEIP
+
+   If the parse decrypts on several threads (see
+   ops_parse_options_parallel_decrypt()), the reader below should not
+   decrypt: this one does, starting from decrypt as it is.
 */
 void ops_reader_push_se_ip_data(ops_parse_info_t *pinfo, ops_crypt_t *decrypt,
                                 ops_region_t *region)
@@ -231,8 +543,27 @@ void ops_reader_push_se_ip_data(ops_parse_info_t *pinfo, ops_crypt_t *decrypt,
     decrypt_se_ip_arg_t *arg=ops_mallocz(sizeof *arg);
     arg->region=region;
     arg->decrypt=decrypt;
+    arg->release_before_auth=pinfo->release_before_auth;
+    if(pinfo->decrypt_threads > 1)
+	{
+	arg->nthreads=pinfo->decrypt_threads;
+	arg->parallel_min=pinfo->parallel_decrypt_min;
+	arg->jobs=ops_mallocz(arg->nthreads*sizeof *arg->jobs);
+	pthread_mutex_init(&arg->lock,NULL);
+	pthread_cond_init(&arg->work,NULL);
+	pthread_cond_init(&arg->done,NULL);
+	}
+    if(arg->release_before_auth)
+	{
+	arg->size=SE_IP_WINDOW;
+	if(arg->nthreads && arg->size < arg->parallel_min)
+	    arg->size=arg->parallel_min;
+	arg->size+=MDC_SIZE;
+	arg->buffer=malloc(arg->size);
+	}
 
     ops_reader_push(pinfo, se_ip_data_reader, se_ip_data_destroyer,arg);
+    ops_reader_set_span(pinfo,se_ip_data_peek,se_ip_data_consume);
     }
 
 /**
@@ -240,8 +571,7 @@ void ops_reader_push_se_ip_data(ops_parse_info_t *pinfo, ops_crypt_t *decrypt,
  */
 void ops_reader_pop_se_ip_data(ops_parse_info_t* pinfo)
     {
-    //    decrypt_se_ip_arg_t *arg=ops_reader_get_arg(ops_parse_get_rinfo(pinfo));
-    //    free(arg);
+    se_ip_data_destroyer(ops_parse_get_rinfo(pinfo));
     ops_reader_pop(pinfo);
     }
 
@@ -42,14 +42,33 @@ static int hash_reader(void *dest,size_t length,ops_error_t **errors,
     return r;
     }
 
+/* If the reader below has spans, we pass them through, hashing what
+   is consumed */
+static int hash_peek(const unsigned char **span,ops_error_t **errors,
+		     ops_reader_info_t *rinfo,ops_parse_cb_info_t *cbinfo)
+    { return ops_stacked_peek(span,errors,rinfo,cbinfo); }
+
+static void hash_consume(const unsigned char *span,size_t length,
+			 ops_reader_info_t *rinfo)
+    {
+    ops_hash_t *hash=ops_reader_get_arg(rinfo);
+
+    hash->add(hash,span,length);
+    ops_stacked_consume(span,length,rinfo);
+    }
+
 /**
    \ingroup Internal_Readers_Hash
    \brief Push hashed data reader on stack
 */
 void ops_reader_push_hash(ops_parse_info_t *pinfo,ops_hash_t *hash)
     {
+    ops_boolean_t span=ops_reader_has_span(pinfo);
+
     hash->init(hash);
     ops_reader_push(pinfo,hash_reader,NULL,hash);
+    if(span)
+	ops_reader_set_span(pinfo,hash_peek,hash_consume);
     }
 
 /**
@@ -35,6 +35,7 @@
 #endif
 
 #include <string.h>
+#include <limits.h>
 
 #include <openpgpsdk/final.h>
 
@@ -68,6 +69,31 @@ static int mem_reader(void *dest,size_t length,ops_error_t **errors,
     return n;
     }
 
+static int mem_peek(const unsigned char **span,ops_error_t **errors,
+		    ops_reader_info_t *rinfo,ops_parse_cb_info_t *cbinfo)
+    {
+    reader_mem_arg_t *arg=ops_reader_get_arg(rinfo);
+
+    OPS_USED(cbinfo);
+    OPS_USED(errors);
+
+    *span=arg->buffer+arg->offset;
+    /* a reader never returns more than INT_MAX at once */
+    if(arg->length-arg->offset > INT_MAX)
+	return INT_MAX;
+    return arg->length-arg->offset;
+    }
+
+static void mem_consume(const unsigned char *span,size_t length,
+			ops_reader_info_t *rinfo)
+    {
+    reader_mem_arg_t *arg=ops_reader_get_arg(rinfo);
+
+    OPS_USED(span);
+    assert(length <= arg->length-arg->offset);
+    arg->offset+=length;
+    }
+
 static void mem_destroyer(ops_reader_info_t *rinfo)
     { free(ops_reader_get_arg(rinfo)); }
 
@@ -85,6 +111,7 @@ void ops_reader_set_memory(ops_parse_info_t *pinfo,const void *buffer,
     arg->length=length;
     arg->offset=0;
     ops_reader_set(pinfo,mem_reader,mem_destroyer,arg);
+    ops_reader_set_span(pinfo,mem_peek,mem_consume);
     }
 
 /* eof */
@@ -0,0 +1,188 @@
+/*
+ * Copyright (c) 2005-2008 Nominet UK (www.nic.uk)
+ * All rights reserved.
+ * Contributors: Ben Laurie, Rachel Willmer. The Contributors have asserted
+ * their moral rights under the UK Copyright Design and Patents Act 1988 to
+ * be recorded as the authors of this copyright work.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. 
+ * 
+ * You may obtain a copy of the License at 
+ *     http://www.apache.org/licenses/LICENSE-2.0 
+ * 
+ * Unless required by applicable law or agreed to in writing, software 
+ * distributed under the License is distributed on an "AS IS" BASIS, 
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. 
+ * 
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** \file 
+ */
+
+#include <openpgpsdk/util.h>
+#include <openpgpsdk/packet-parse.h>
+#include <openpgpsdk/readerwriter.h>
+#include <openpgpsdk/errors.h>
+#include <stdio.h>
+#include <assert.h>
+
+#ifndef WIN32
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
+
+#include <string.h>
+#include <limits.h>
+
+#include <openpgpsdk/final.h>
+
+#ifndef WIN32
+
+/** Arguments for reader_mmap
+ */
+typedef struct
+    {
+    void *map; /*!< start of the mapping */
+    size_t map_length; /*!< length of the mapping */
+    const unsigned char *buffer; /*!< the data to be read */
+    size_t length; /*!< length of the data */
+    size_t offset; /*!< how much has been read */
+    } reader_mmap_arg_t;
+
+static int mmap_reader(void *dest,size_t length,ops_error_t **errors,
+		       ops_reader_info_t *rinfo,ops_parse_cb_info_t *cbinfo)
+    {
+    reader_mmap_arg_t *arg=ops_reader_get_arg(rinfo);
+    size_t n;
+
+    OPS_USED(cbinfo);
+    OPS_USED(errors);
+
+    n=arg->length-arg->offset;
+    if(n > length)
+	n=length;
+
+    if(n == 0)
+	return 0;
+
+    memcpy(dest,arg->buffer+arg->offset,n);
+    arg->offset+=n;
+
+    return n;
+    }
+
+static const unsigned char *mmap_borrow(size_t length,ops_reader_info_t *rinfo)
+    {
+    reader_mmap_arg_t *arg=ops_reader_get_arg(rinfo);
+    const unsigned char *data;
+
+    if(length > arg->length-arg->offset)
+	return NULL;
+
+    data=arg->buffer+arg->offset;
+    arg->offset+=length;
+
+    return data;
+    }
+
+static int mmap_peek(const unsigned char **span,ops_error_t **errors,
+		     ops_reader_info_t *rinfo,ops_parse_cb_info_t *cbinfo)
+    {
+    reader_mmap_arg_t *arg=ops_reader_get_arg(rinfo);
+
+    OPS_USED(cbinfo);
+    OPS_USED(errors);
+
+    *span=arg->buffer+arg->offset;
+    /* a reader never returns more than INT_MAX at once */
+    if(arg->length-arg->offset > INT_MAX)
+	return INT_MAX;
+    return arg->length-arg->offset;
+    }
+
+static void mmap_consume(const unsigned char *span,size_t length,
+			 ops_reader_info_t *rinfo)
+    {
+    reader_mmap_arg_t *arg=ops_reader_get_arg(rinfo);
+
+    OPS_USED(span);
+    assert(length <= arg->length-arg->offset);
+    arg->offset+=length;
+    }
+
+static void mmap_destroyer(ops_reader_info_t *rinfo)
+    {
+    reader_mmap_arg_t *arg=ops_reader_get_arg(rinfo);
+
+    munmap(arg->map,arg->map_length);
+    free(arg);
+    }
+
+#endif
+
+/**
+   \ingroup Core_Readers_First
+   \brief Starts stack with a reader of a memory-mapped file
+
+   The file is mapped from its start, and reading begins at the
+   current offset of fd. While no other reader is pushed on top of
+   this one, the parser uses the mapping in place: #ops_data_t
+   contents and the raw packet data given with OPS_PARSER_PACKET_END
+   point into it (and are marked as borrowed) rather than being
+   copied. They are only valid until pinfo is deleted.
+
+   If the file cannot be mapped (for example, it is a pipe), this
+   falls back to ops_reader_set_fd_buffered().
+
+   \param pinfo Parse settings
+   \param fd File descriptor to read from
+   \note fd may be closed once the parse has finished; the mapping is
+   released when pinfo is deleted.
+*/
+void ops_reader_set_mmap(ops_parse_info_t *pinfo,int fd)
+    {
+#ifndef WIN32
+    reader_mmap_arg_t *arg;
+    struct stat st;
+    off_t start;
+    void *map;
+
+    start=lseek(fd,0,SEEK_CUR);
+    if(start < 0 || fstat(fd,&st) < 0 || !S_ISREG(st.st_mode)
+       || st.st_size == 0 || start > st.st_size
+       || (unsigned long long)st.st_size > (size_t)-1)
+	{
+	ops_reader_set_fd_buffered(pinfo,fd,0,ops_true);
+	return;
+	}
+
+    map=mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+    if(map == MAP_FAILED)
+	{
+	ops_reader_set_fd_buffered(pinfo,fd,0,ops_true);
+	return;
+	}
+#ifdef MADV_SEQUENTIAL
+    madvise(map,st.st_size,MADV_SEQUENTIAL);
+#endif
+
+    arg=ops_mallocz(sizeof *arg);
+    arg->map=map;
+    arg->map_length=st.st_size;
+    arg->buffer=map;
+    arg->length=st.st_size;
+    arg->offset=start;
+    ops_reader_set(pinfo,mmap_reader,mmap_destroyer,arg);
+    ops_reader_set_borrow(pinfo,mmap_borrow);
+    ops_reader_set_span(pinfo,mmap_peek,mmap_consume);
+#else
+    ops_reader_set_fd_buffered(pinfo,fd,0,ops_true);
+#endif
+    }
+
+// eof
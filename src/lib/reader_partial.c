@@ -0,0 +1,212 @@
+/*
+ * Copyright (c) 2005-2008 Nominet UK (www.nic.uk)
+ * All rights reserved.
+ * Contributors: Ben Laurie, Rachel Willmer. The Contributors have asserted
+ * their moral rights under the UK Copyright Design and Patents Act 1988 to
+ * be recorded as the authors of this copyright work.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. 
+ * 
+ * You may obtain a copy of the License at 
+ *     http://www.apache.org/licenses/LICENSE-2.0 
+ * 
+ * Unless required by applicable law or agreed to in writing, software 
+ * distributed under the License is distributed on an "AS IS" BASIS, 
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. 
+ * 
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** \file
+ * \brief Reader for new format packets with Partial Body Lengths
+ */
+
+#include <openpgpsdk/packet-parse.h>
+#include <openpgpsdk/readerwriter.h>
+#include <openpgpsdk/errors.h>
+#include <openpgpsdk/util.h>
+#include <string.h>
+#include <assert.h>
+
+#include "parse_local.h"
+
+#include <openpgpsdk/final.h>
+
+/** Arguments for reader_partial
+ */
+typedef struct
+    {
+    unsigned remaining; /*!< bytes left in the current chunk */
+    ops_boolean_t last; /*!< set if the current chunk is the final one */
+    } partial_arg_t;
+
+/* Read the length of the next chunk. RFC4880 4.2.2 */
+static ops_boolean_t read_chunk_length(partial_arg_t *arg,ops_error_t **errors,
+				       ops_reader_info_t *rinfo,
+				       ops_parse_cb_info_t *cbinfo)
+    {
+    unsigned char c[4];
+
+    if(ops_stacked_read(c,1,errors,rinfo,cbinfo) != 1)
+	return ops_false;
+
+    if(c[0] < 192)
+	{
+	arg->remaining=c[0];
+	arg->last=ops_true;
+	}
+    else if(c[0] < 224)
+	{
+	unsigned t=(c[0]-192) << 8;
+
+	if(ops_stacked_read(c,1,errors,rinfo,cbinfo) != 1)
+	    return ops_false;
+	arg->remaining=t+c[0]+192;
+	arg->last=ops_true;
+	}
+    else if(c[0] < 255)
+	arg->remaining=1 << (c[0]&0x1f);
+    else
+	{
+	if(ops_stacked_read(c,4,errors,rinfo,cbinfo) != 4)
+	    return ops_false;
+	arg->remaining=((unsigned)c[0] << 24)+(c[1] << 16)+(c[2] << 8)+c[3];
+	arg->last=ops_true;
+	}
+
+    return ops_true;
+    }
+
+/*
+ * Returns the body of a packet with Partial Body Lengths, reading
+ * each chunk's length as we come to it. Returns EOF after the final
+ * chunk, so the packet's parser should use an indeterminate region.
+ * Only one chunk's length is held at a time, so any length of body
+ * can be streamed.
+ */
+static int partial_reader(void *dest,size_t length,ops_error_t **errors,
+			  ops_reader_info_t *rinfo,ops_parse_cb_info_t *cbinfo)
+    {
+    partial_arg_t *arg=ops_reader_get_arg(rinfo);
+    int r;
+
+    while(arg->remaining == 0)
+	{
+	if(arg->last)
+	    return 0;
+	if(!read_chunk_length(arg,errors,rinfo,cbinfo))
+	    {
+	    OPS_ERROR(errors,OPS_E_R_EARLY_EOF,
+		      "Partial Body Length missing");
+	    return -1;
+	    }
+	}
+
+    if(length > arg->remaining)
+	length=arg->remaining;
+
+    r=ops_stacked_read(dest,length,errors,rinfo,cbinfo);
+    if(r < 0)
+	return r;
+    if(r == 0)
+	{
+	OPS_ERROR(errors,OPS_E_R_EARLY_EOF,"Partial Body Length chunk truncated");
+	return -1;
+	}
+
+    arg->remaining-=r;
+
+    return r;
+    }
+
+/* If the reader below has spans, we pass them through, cut short at
+   the end of each chunk */
+static int partial_peek(const unsigned char **span,ops_error_t **errors,
+			ops_reader_info_t *rinfo,ops_parse_cb_info_t *cbinfo)
+    {
+    partial_arg_t *arg=ops_reader_get_arg(rinfo);
+    int r;
+
+    while(arg->remaining == 0)
+	{
+	if(arg->last)
+	    return 0;
+	if(!read_chunk_length(arg,errors,rinfo,cbinfo))
+	    {
+	    OPS_ERROR(errors,OPS_E_R_EARLY_EOF,
+		      "Partial Body Length missing");
+	    return -1;
+	    }
+	}
+
+    r=ops_stacked_peek(span,errors,rinfo,cbinfo);
+    if(r < 0)
+	return r;
+    if(r == 0)
+	{
+	OPS_ERROR(errors,OPS_E_R_EARLY_EOF,"Partial Body Length chunk truncated");
+	return -1;
+	}
+
+    if((unsigned)r > arg->remaining)
+	r=arg->remaining;
+
+    return r;
+    }
+
+static void partial_consume(const unsigned char *span,size_t length,
+			    ops_reader_info_t *rinfo)
+    {
+    partial_arg_t *arg=ops_reader_get_arg(rinfo);
+
+    assert(length <= arg->remaining);
+    arg->remaining-=length;
+    ops_stacked_consume(span,length,rinfo);
+    }
+
+/**
+   \ingroup Core_Readers
+   \brief Pushes a reader for a packet body with Partial Body Lengths
+   \param pinfo Parse settings
+   \param length Length of the first chunk, as read with the packet tag
+   \sa ops_reader_pop_partial()
+*/
+void ops_reader_push_partial(ops_parse_info_t *pinfo,unsigned length)
+    {
+    partial_arg_t *arg=ops_mallocz(sizeof *arg);
+
+    ops_boolean_t span=ops_reader_has_span(pinfo);
+
+    arg->remaining=length;
+    arg->last=ops_false;
+    ops_reader_push(pinfo,partial_reader,NULL,arg);
+    if(span)
+	ops_reader_set_span(pinfo,partial_peek,partial_consume);
+    }
+
+/**
+   \ingroup Core_Readers
+   \brief Skips any unread chunks of the packet body and pops the reader
+   \param pinfo Parse settings
+   \return ops_true if the whole body was there to skip
+*/
+ops_boolean_t ops_reader_pop_partial(ops_parse_info_t *pinfo)
+    {
+    partial_arg_t *arg=ops_reader_get_arg(ops_parse_get_rinfo(pinfo));
+    unsigned char buf[1024];
+    int r;
+
+    do
+	r=partial_reader(buf,sizeof buf,&pinfo->errors,&pinfo->rinfo,
+			 &pinfo->cbinfo);
+    while(r > 0);
+
+    free(arg);
+    ops_reader_pop(pinfo);
+
+    return r == 0;
+    }
+
+// eof
@@ -233,7 +233,7 @@ int ops_setup_file_read(ops_parse_info_t **pinfo, const char *filename,
 
     *pinfo=ops_parse_info_new();
     ops_parse_cb_set(*pinfo,callback,arg);
-    ops_reader_set_fd(*pinfo,fd);
+    ops_reader_set_fd_buffered(*pinfo,fd,0,ops_true);
 
     if (accumulate)
         (*pinfo)->rinfo.accumulate=ops_true;
@@ -396,6 +396,7 @@ ops_boolean_t ops_check_signature(const unsigned char *hash, unsigned length,
 				     const ops_public_key_t *signer)
     {
     ops_boolean_t ret;
+    const ops_signature_info_t *info;
 
     /*
     printf(" hash=");
@@ -403,16 +404,19 @@ ops_boolean_t ops_check_signature(const unsigned char *hash, unsigned length,
     hexdump(hash,length);
     */
 
-    switch(sig->info.key_algorithm)
+    info=ops_signature_materialise(&sig->info);
+    signer=ops_public_key_materialise(signer);
+
+    switch(info->key_algorithm)
 	{
     case OPS_PKA_DSA:
-	ret=ops_dsa_verify(hash, length, &sig->info.signature.dsa,
+	ret=ops_dsa_verify(hash, length, &info->signature.dsa,
 			   &signer->key.dsa);
 	break;
 
     case OPS_PKA_RSA:
-	ret=rsa_verify(sig->info.hash_algorithm, hash, length,
-		       &sig->info.signature.rsa, &signer->key.rsa);
+	ret=rsa_verify(info->hash_algorithm, hash, length,
+		       &info->signature.rsa, &signer->key.rsa);
 	break;
 
     default:
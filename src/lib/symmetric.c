@@ -31,6 +31,8 @@
 # include <openssl/camellia.h>
 #endif
 #include <openssl/des.h>
+#include <openssl/evp.h>
+#include <limits.h>
 #include "parse_local.h"
 
 #include <openpgpsdk/packet-show.h>
@@ -48,6 +50,15 @@
 
 #endif /* ATTRIBUTE_UNUSED */
 
+/* The key schedule in *key, allocated the first time, so setting up a
+   crypt again reuses it */
+static void *schedule(void **key,size_t size)
+    {
+    if(!*key)
+	*key=malloc(size);
+    return *key;
+    }
+
 static void std_set_iv(ops_crypt_t *crypt,const unsigned char *iv)
     { 
     memcpy(crypt->iv,iv,crypt->blocksize); 
@@ -85,11 +96,9 @@ static void std_finish(ops_crypt_t *crypt)
 
 static void cast5_init(ops_crypt_t *crypt)
     {
-    if (crypt->encrypt_key)
-        free(crypt->encrypt_key);
-    crypt->encrypt_key=malloc(sizeof(CAST_KEY));
+    schedule(&crypt->encrypt_key,sizeof(CAST_KEY));
     CAST_set_key(crypt->encrypt_key,crypt->keysize,crypt->key);
-    crypt->decrypt_key=malloc(sizeof(CAST_KEY));
+    schedule(&crypt->decrypt_key,sizeof(CAST_KEY));
     CAST_set_key(crypt->decrypt_key,crypt->keysize,crypt->key);
     }
 
@@ -113,7 +122,7 @@ static void cast5_cfb_decrypt(ops_crypt_t *crypt,void *out,const void *in, size_
                        CAST_DECRYPT); 
     }
 
-#define TRAILER		"","","","",0,NULL,NULL
+#define TRAILER		"","","","",0,NULL,NULL,ops_false
 
 static ops_crypt_t cast5=
     {
@@ -137,16 +146,12 @@ static void idea_init(ops_crypt_t *crypt)
     {
     assert(crypt->keysize == IDEA_KEY_LENGTH);
 
-    if (crypt->encrypt_key)
-        free(crypt->encrypt_key);
-    crypt->encrypt_key=malloc(sizeof(IDEA_KEY_SCHEDULE));
+    schedule(&crypt->encrypt_key,sizeof(IDEA_KEY_SCHEDULE));
 
     // note that we don't invert the key when decrypting for CFB mode
     idea_set_encrypt_key(crypt->key,crypt->encrypt_key);
 
-    if (crypt->decrypt_key)
-        free(crypt->decrypt_key);
-    crypt->decrypt_key=malloc(sizeof(IDEA_KEY_SCHEDULE));
+    schedule(&crypt->decrypt_key,sizeof(IDEA_KEY_SCHEDULE));
 
     idea_set_decrypt_key(crypt->encrypt_key,crypt->decrypt_key);
     }
@@ -195,15 +200,11 @@ static const ops_crypt_t idea=
 
 static void aes128_init(ops_crypt_t *crypt)
     {
-    if (crypt->encrypt_key)
-        free(crypt->encrypt_key);
-    crypt->encrypt_key=malloc(sizeof(AES_KEY));
+    schedule(&crypt->encrypt_key,sizeof(AES_KEY));
     if (AES_set_encrypt_key(crypt->key,KEYBITS_AES128,crypt->encrypt_key))
         fprintf(stderr,"aes128_init: Error setting encrypt_key\n");
 
-    if (crypt->decrypt_key)
-        free(crypt->decrypt_key);
-    crypt->decrypt_key=malloc(sizeof(AES_KEY));
+    schedule(&crypt->decrypt_key,sizeof(AES_KEY));
     if (AES_set_decrypt_key(crypt->key,KEYBITS_AES128,crypt->decrypt_key))
         fprintf(stderr,"aes128_init: Error setting decrypt_key\n");
     }
@@ -251,15 +252,11 @@ static const ops_crypt_t aes128=
 
 static void aes256_init(ops_crypt_t *crypt)
     {
-    if (crypt->encrypt_key)
-        free(crypt->encrypt_key);
-    crypt->encrypt_key=malloc(sizeof(AES_KEY));
+    schedule(&crypt->encrypt_key,sizeof(AES_KEY));
     if (AES_set_encrypt_key(crypt->key,KEYBITS_AES256,crypt->encrypt_key))
         fprintf(stderr,"aes256_init: Error setting encrypt_key\n");
 
-    if (crypt->decrypt_key)
-        free(crypt->decrypt_key);
-    crypt->decrypt_key=malloc(sizeof(AES_KEY));
+    schedule(&crypt->decrypt_key,sizeof(AES_KEY));
     if (AES_set_decrypt_key(crypt->key,KEYBITS_AES256,crypt->decrypt_key))
         fprintf(stderr,"aes256_init: Error setting decrypt_key\n");
     }
@@ -289,15 +286,11 @@ static const ops_crypt_t aes256=
 
 static void camellia128_init(ops_crypt_t *crypt)
     {
-    if (crypt->encrypt_key)
-        free(crypt->encrypt_key);
-    crypt->encrypt_key=malloc(sizeof(CAMELLIA_KEY));
+    schedule(&crypt->encrypt_key,sizeof(CAMELLIA_KEY));
     if (Camellia_set_key(crypt->key,KEYBITS_CAMELLIA128,crypt->encrypt_key))
         fprintf(stderr,"camellia128_init: Error setting encrypt_key\n");
 
-    if (crypt->decrypt_key)
-        free(crypt->decrypt_key);
-    crypt->decrypt_key=malloc(sizeof(CAMELLIA_KEY));
+    schedule(&crypt->decrypt_key,sizeof(CAMELLIA_KEY));
     if (Camellia_set_key(crypt->key,KEYBITS_CAMELLIA128,crypt->decrypt_key))
         fprintf(stderr,"camellia128_init: Error setting decrypt_key\n");
     }
@@ -345,15 +338,11 @@ static const ops_crypt_t camellia128=
 
 static void camellia192_init(ops_crypt_t *crypt)
     {
-    if (crypt->encrypt_key)
-        free(crypt->encrypt_key);
-    crypt->encrypt_key=malloc(sizeof(CAMELLIA_KEY));
+    schedule(&crypt->encrypt_key,sizeof(CAMELLIA_KEY));
     if (Camellia_set_key(crypt->key,KEYBITS_CAMELLIA192,crypt->encrypt_key))
         fprintf(stderr,"camellia192_init: Error setting encrypt_key\n");
 
-    if (crypt->decrypt_key)
-        free(crypt->decrypt_key);
-    crypt->decrypt_key=malloc(sizeof(CAMELLIA_KEY));
+    schedule(&crypt->decrypt_key,sizeof(CAMELLIA_KEY));
     if (Camellia_set_key(crypt->key,KEYBITS_CAMELLIA192,crypt->decrypt_key))
         fprintf(stderr,"camellia192_init: Error setting decrypt_key\n");
     }
@@ -381,15 +370,11 @@ static const ops_crypt_t camellia192=
 
 static void camellia256_init(ops_crypt_t *crypt)
     {
-    if (crypt->encrypt_key)
-        free(crypt->encrypt_key);
-    crypt->encrypt_key=malloc(sizeof(CAMELLIA_KEY));
+    schedule(&crypt->encrypt_key,sizeof(CAMELLIA_KEY));
     if (Camellia_set_key(crypt->key,KEYBITS_CAMELLIA256,crypt->encrypt_key))
         fprintf(stderr,"camellia256_init: Error setting encrypt_key\n");
 
-    if (crypt->decrypt_key)
-        free(crypt->decrypt_key);
-    crypt->decrypt_key=malloc(sizeof(CAMELLIA_KEY));
+    schedule(&crypt->decrypt_key,sizeof(CAMELLIA_KEY));
     if (Camellia_set_key(crypt->key,KEYBITS_CAMELLIA256,crypt->decrypt_key))
         fprintf(stderr,"camellia256_init: Error setting decrypt_key\n");
     }
@@ -420,9 +405,7 @@ static void tripledes_init(ops_crypt_t *crypt)
     DES_key_schedule *keys;
     int n;
 
-    if (crypt->encrypt_key)
-        free(crypt->encrypt_key);
-    keys=crypt->encrypt_key=malloc(3*sizeof(DES_key_schedule));
+    keys=schedule(&crypt->encrypt_key,3*sizeof(DES_key_schedule));
 
     for(n=0 ; n < 3 ; ++n)
 	DES_set_key((DES_cblock *)(crypt->key+n*8),&keys[n]);
@@ -526,6 +509,220 @@ static const ops_crypt_t *get_proto(ops_symmetric_algorithm_t alg)
     return NULL;
     }
 
+/*
+ * The EVP backend: the same ciphers driven through EVP_CIPHER_CTXs, so
+ * OpenSSL can use whatever hardware support it has. The contexts are
+ * kept in encrypt_key, and are made once per crypt, those for CFB in
+ * each direction when first used. They hold the CFB state themselves,
+ * so iv and num are only used to start them off.
+ */
+
+typedef struct
+    {
+    EVP_CIPHER_CTX *ecb[2]; /*!< indexed by encrypt */
+    EVP_CIPHER_CTX *cfb[2];
+    } evp_keys_t;
+
+static const EVP_CIPHER *evp_cipher(ops_symmetric_algorithm_t alg,
+				    ops_boolean_t cfb)
+    {
+    switch(alg)
+	{
+    case OPS_SA_CAST5:
+	return cfb ? EVP_cast5_cfb64() : EVP_cast5_ecb();
+
+#ifndef OPENSSL_NO_IDEA
+    case OPS_SA_IDEA:
+	return cfb ? EVP_idea_cfb64() : EVP_idea_ecb();
+#endif /* OPENSSL_NO_IDEA */
+
+    case OPS_SA_AES_128:
+	return cfb ? EVP_aes_128_cfb128() : EVP_aes_128_ecb();
+
+    case OPS_SA_AES_256:
+	return cfb ? EVP_aes_256_cfb128() : EVP_aes_256_ecb();
+
+#ifndef OPENSSL_NO_CAMELLIA
+    case OPS_SA_CAMELLIA_128:
+	return cfb ? EVP_camellia_128_cfb128() : EVP_camellia_128_ecb();
+
+    case OPS_SA_CAMELLIA_192:
+	return cfb ? EVP_camellia_192_cfb128() : EVP_camellia_192_ecb();
+
+    case OPS_SA_CAMELLIA_256:
+	return cfb ? EVP_camellia_256_cfb128() : EVP_camellia_256_ecb();
+#endif  // ndef OPENSSL_NO_CAMELLIA
+
+    case OPS_SA_TRIPLEDES:
+	return cfb ? EVP_des_ede3_cfb64() : EVP_des_ede3_ecb();
+
+    default:
+	return NULL;
+	}
+    }
+
+static EVP_CIPHER_CTX *evp_ctx(ops_crypt_t *crypt,ops_boolean_t cfb,
+			       ops_boolean_t encrypt)
+    {
+    evp_keys_t *keys=crypt->encrypt_key;
+    EVP_CIPHER_CTX **ctx=cfb ? &keys->cfb[encrypt] : &keys->ecb[encrypt];
+
+    if(*ctx)
+	return *ctx;
+
+    *ctx=EVP_CIPHER_CTX_new();
+    if(!EVP_CipherInit_ex(*ctx,evp_cipher(crypt->algorithm,cfb),NULL,
+			  crypt->key,cfb ? crypt->iv : NULL,encrypt))
+	{
+	EVP_CIPHER_CTX_free(*ctx);
+	*ctx=NULL;
+	return NULL;
+	}
+    EVP_CIPHER_CTX_set_padding(*ctx,0);
+
+    return *ctx;
+    }
+
+static void evp_update(ops_crypt_t *crypt,ops_boolean_t cfb,
+		       ops_boolean_t encrypt,void *out_,const void *in_,
+		       size_t count)
+    {
+    EVP_CIPHER_CTX *ctx=evp_ctx(crypt,cfb,encrypt);
+    unsigned char *out=out_;
+    const unsigned char *in=in_;
+    int n;
+
+    while(count > 0)
+	{
+	int length=count > INT_MAX ? INT_MAX : count;
+
+	if(!ctx || !EVP_CipherUpdate(ctx,out,&n,in,length) || n != length)
+	    {
+	    /* rather than leave plaintext or garbage behind */
+	    memset(out,'\0',count);
+	    crypt->failed=ops_true;
+	    return;
+	    }
+	in+=n;
+	out+=n;
+	count-=n;
+	}
+    }
+
+static void evp_set_iv(ops_crypt_t *crypt,const unsigned char *iv)
+    {
+    evp_keys_t *keys=crypt->encrypt_key;
+    int n;
+
+    std_set_iv(crypt,iv);
+    if(!keys)
+	return;
+    for(n=0 ; n < 2 ; ++n)
+	if(keys->cfb[n])
+	    EVP_CipherInit_ex(keys->cfb[n],NULL,NULL,NULL,iv,-1);
+    }
+
+static void evp_finish(ops_crypt_t *crypt)
+    {
+    evp_keys_t *keys=crypt->encrypt_key;
+    int n;
+
+    if(!keys)
+	return;
+    for(n=0 ; n < 2 ; ++n)
+	{
+	EVP_CIPHER_CTX_free(keys->ecb[n]);
+	EVP_CIPHER_CTX_free(keys->cfb[n]);
+	}
+    free(keys);
+    crypt->encrypt_key=NULL;
+    }
+
+/*
+ * Go back to the low level functions for this crypt. The hooks are
+ * taken by copying the prototype whole, keeping what has been set
+ * up, rather than one by one, as some versions of OpenSSL #define
+ * set_key.
+ */
+static void use_low_level(ops_crypt_t *crypt)
+    {
+    ops_crypt_t state=*crypt;
+
+    *crypt=*get_proto(state.algorithm);
+    memcpy(crypt->iv,state.iv,sizeof crypt->iv);
+    memcpy(crypt->civ,state.civ,sizeof crypt->civ);
+    memcpy(crypt->siv,state.siv,sizeof crypt->siv);
+    memcpy(crypt->key,state.key,sizeof crypt->key);
+    crypt->num=state.num;
+    crypt->encrypt_key=state.encrypt_key;
+    crypt->decrypt_key=state.decrypt_key;
+    crypt->failed=state.failed;
+    }
+
+static void evp_init(ops_crypt_t *crypt)
+    {
+    evp_finish(crypt);
+    crypt->encrypt_key=ops_mallocz(sizeof(evp_keys_t));
+
+    /* OpenSSL may not provide this cipher through EVP, e.g. CAST5
+       without the legacy provider */
+    if(!evp_ctx(crypt,ops_false,ops_true))
+	{
+	evp_finish(crypt);
+	use_low_level(crypt);
+	crypt->base_init(crypt);
+	}
+    }
+
+static void evp_block_encrypt(ops_crypt_t *crypt,void *out,const void *in)
+    { evp_update(crypt,ops_false,ops_true,out,in,crypt->blocksize); }
+
+static void evp_block_decrypt(ops_crypt_t *crypt,void *out,const void *in)
+    { evp_update(crypt,ops_false,ops_false,out,in,crypt->blocksize); }
+
+static void evp_cfb_encrypt(ops_crypt_t *crypt,void *out,const void *in,
+			    size_t count)
+    { evp_update(crypt,ops_true,ops_true,out,in,count); }
+
+static void evp_cfb_decrypt(ops_crypt_t *crypt,void *out,const void *in,
+			    size_t count)
+    { evp_update(crypt,ops_true,ops_false,out,in,count); }
+
+/**
+ * \ingroup Core_Crypto
+ * \brief Choose how a crypt does its cipher.
+ *
+ * ops_crypt_any() sets crypts up to use OpenSSL's low level functions.
+ * With OPS_CRYPT_BACKEND_EVP they go through OpenSSL's EVP interface
+ * instead, which uses AES-NI and the like where the low level
+ * functions may not. A cipher EVP can't do falls back to the low
+ * level functions when it is initialised.
+ *
+ * This must be called after ops_crypt_any() and before the crypt is
+ * initialised.
+ *
+ * \param crypt	The crypt
+ * \param backend	The backend to use
+ */
+void ops_crypt_set_backend(ops_crypt_t *crypt,ops_crypt_backend_t backend)
+    {
+    assert(!crypt->encrypt_key && !crypt->decrypt_key);
+
+    if(backend == OPS_CRYPT_BACKEND_EVP && evp_cipher(crypt->algorithm,
+						      ops_false))
+	{
+	crypt->set_iv=evp_set_iv;
+	crypt->base_init=evp_init;
+	crypt->block_encrypt=evp_block_encrypt;
+	crypt->block_decrypt=evp_block_decrypt;
+	crypt->cfb_encrypt=evp_cfb_encrypt;
+	crypt->cfb_decrypt=evp_cfb_decrypt;
+	crypt->decrypt_finish=evp_finish;
+	}
+    else if(get_proto(crypt->algorithm))
+	use_low_level(crypt);
+    }
+
 int ops_crypt_any(ops_crypt_t *crypt,ops_symmetric_algorithm_t alg)
     { 
     const ops_crypt_t *ptr=get_proto(alg);
@@ -567,65 +764,206 @@ void ops_encrypt_init(ops_crypt_t * encrypt)
     ops_decrypt_init(encrypt);
     }
 
+/* Start the CFB state from the IV */
+static void start_cfb(ops_crypt_t *crypt)
+    {
+    crypt->block_encrypt(crypt,crypt->siv,crypt->iv);
+    memcpy(crypt->civ,crypt->siv,crypt->blocksize);
+    crypt->num=0;
+    }
+
 void ops_decrypt_init(ops_crypt_t *decrypt)
     {
     decrypt->base_init(decrypt);
-    decrypt->block_encrypt(decrypt,decrypt->siv,decrypt->iv);
-    memcpy(decrypt->civ,decrypt->siv,decrypt->blocksize);
-    decrypt->num=0;
+    start_cfb(decrypt);
     }
 
-size_t ops_decrypt_se
-(ops_crypt_t *decrypt,void *out_,const void *in_,
-		   size_t count)
+/**
+ * \ingroup Core_Crypto
+ * \brief Start an initialised crypt again with a new IV.
+ *
+ * The same as calling set_iv() and then ops_decrypt_init(), but the
+ * key schedule is kept rather than expanded again, so messages that
+ * share a key can each have their own IV cheaply.
+ *
+ * \param crypt	A crypt that has been through ops_decrypt_init()
+ *			or ops_encrypt_init()
+ * \param iv		The new IV, of crypt's block size
+ */
+void ops_crypt_reset(ops_crypt_t *crypt,const unsigned char *iv)
     {
-    unsigned char *out=out_;
-    const unsigned char *in=in_;
-    int saved=count;
+    crypt->set_iv(crypt,iv);
+    start_cfb(crypt);
+    }
 
-    /* in order to support v3's weird resyncing we have to implement CFB mode
-       ourselves */
-    while(count-- > 0)
+/* Size of each of the low level key schedules for alg */
+static size_t schedule_size(ops_symmetric_algorithm_t alg)
+    {
+    switch(alg)
 	{
-	unsigned char t;
+    case OPS_SA_CAST5:
+	return sizeof(CAST_KEY);
+
+#ifndef OPENSSL_NO_IDEA
+    case OPS_SA_IDEA:
+	return sizeof(IDEA_KEY_SCHEDULE);
+#endif /* OPENSSL_NO_IDEA */
 
-	if(decrypt->num == decrypt->blocksize)
+    case OPS_SA_AES_128:
+    case OPS_SA_AES_256:
+	return sizeof(AES_KEY);
+
+#ifndef OPENSSL_NO_CAMELLIA
+    case OPS_SA_CAMELLIA_128:
+    case OPS_SA_CAMELLIA_192:
+    case OPS_SA_CAMELLIA_256:
+	return sizeof(CAMELLIA_KEY);
+#endif  // ndef OPENSSL_NO_CAMELLIA
+
+    case OPS_SA_TRIPLEDES:
+	return 3*sizeof(DES_key_schedule);
+
+    default:
+	assert(0);
+	return 0;
+	}
+    }
+
+static void *copy_schedule(const void *key,size_t size)
+    {
+    void *copy;
+
+    if(!key)
+	return NULL;
+    copy=malloc(size);
+    memcpy(copy,key,size);
+    return copy;
+    }
+
+/**
+ * \ingroup Core_Crypto
+ * \brief Copy a crypt, key schedule and all.
+ *
+ * The copy has its own key schedule, copied rather than expanded
+ * again, and its own CFB state, so it can be used alongside the
+ * original, for instance on another thread, or kept as an initialised
+ * template to be copied and ops_crypt_reset() for each message. It is
+ * freed with decrypt_finish() as usual.
+ *
+ * \param dest	Where to put the copy
+ * \param src	The crypt to copy, which may or may not have been
+ *		initialised
+ */
+void ops_crypt_clone(ops_crypt_t *dest,const ops_crypt_t *src)
+    {
+    *dest=*src;
+
+    if(src->base_init == evp_init)
+	{
+	const evp_keys_t *keys=src->encrypt_key;
+	evp_keys_t *copy;
+	int n;
+
+	if(!keys)
+	    return;
+	copy=dest->encrypt_key=ops_mallocz(sizeof *copy);
+	for(n=0 ; n < 2 ; ++n)
 	    {
-	    memcpy(decrypt->siv,decrypt->civ,decrypt->blocksize);
-	    decrypt->block_decrypt(decrypt,decrypt->civ,decrypt->civ);
-	    decrypt->num=0;
+	    if(keys->ecb[n])
+		{
+		copy->ecb[n]=EVP_CIPHER_CTX_new();
+		EVP_CIPHER_CTX_copy(copy->ecb[n],keys->ecb[n]);
+		}
+	    if(keys->cfb[n])
+		{
+		copy->cfb[n]=EVP_CIPHER_CTX_new();
+		EVP_CIPHER_CTX_copy(copy->cfb[n],keys->cfb[n]);
+		}
 	    }
-	t=decrypt->civ[decrypt->num];
-	*out++=t^(decrypt->civ[decrypt->num++]=*in++);
+	return;
 	}
 
-    return saved;
+    dest->encrypt_key=copy_schedule(src->encrypt_key,
+				    schedule_size(src->algorithm));
+    dest->decrypt_key=copy_schedule(src->decrypt_key,
+				    schedule_size(src->algorithm));
     }
 
-size_t ops_encrypt_se(ops_crypt_t *encrypt,void *out_,const void *in_,
-		   size_t count)
+/*
+ * XOR a whole block of keystream in civ with in, a word at a time,
+ * feeding the ciphertext back into civ. in and out may be the same.
+ */
+static void cfb_block(unsigned char *civ,unsigned char *out,
+		      const unsigned char *in,size_t blocksize,
+		      ops_boolean_t encrypt)
     {
-    unsigned char *out=out_;
-    const unsigned char *in=in_;
-    int saved=count;
+    unsigned long k,t;
+    size_t n;
 
-    /* in order to support v3's weird resyncing we have to implement CFB mode
-       ourselves */
-    while(count-- > 0)
+    for(n=0 ; n < blocksize ; n+=sizeof k)
 	{
-	if(encrypt->num == encrypt->blocksize)
+	memcpy(&k,civ+n,sizeof k);
+	memcpy(&t,in+n,sizeof t);
+	k^=t;
+	memcpy(out+n,&k,sizeof k);
+	memcpy(civ+n,encrypt ? &k : &t,sizeof k);
+	}
+    }
+
+/*
+ * OpenPGP's CFB, done here rather than by OpenSSL because of v3's
+ * weird resyncing, which needs the previous block in siv. Whole
+ * blocks that start on a block boundary are done with cfb_block(),
+ * the rest a byte at a time; either way the state left in civ, siv
+ * and num is the same.
+ */
+static size_t se_cfb(ops_crypt_t *crypt,unsigned char *out,
+		     const unsigned char *in,size_t count,
+		     ops_boolean_t encrypt)
+    {
+    size_t blocksize=crypt->blocksize;
+    ops_boolean_t wide=blocksize%sizeof(unsigned long) == 0;
+    size_t n;
+
+    for(n=count ; n > 0 ; )
+	{
+	unsigned char c;
+
+	if(crypt->num == blocksize)
 	    {
-	    memcpy(encrypt->siv,encrypt->civ,encrypt->blocksize);
-	    encrypt->block_encrypt(encrypt,encrypt->civ,encrypt->civ);
-	    encrypt->num=0;
+	    memcpy(crypt->siv,crypt->civ,blocksize);
+	    crypt->block_encrypt(crypt,crypt->civ,crypt->civ);
+	    crypt->num=0;
 	    }
-	encrypt->civ[encrypt->num]=*out++=encrypt->civ[encrypt->num]^*in++;
-	++encrypt->num;
+
+	if(wide && crypt->num == 0 && n >= blocksize)
+	    {
+	    cfb_block(crypt->civ,out,in,blocksize,encrypt);
+	    crypt->num=blocksize;
+	    in+=blocksize;
+	    out+=blocksize;
+	    n-=blocksize;
+	    continue;
+	    }
+
+	c=crypt->civ[crypt->num]^*in;
+	crypt->civ[crypt->num++]=encrypt ? c : *in;
+	*out++=c;
+	++in;
+	--n;
 	}
 
-    return saved;
+    return count;
     }
 
+size_t ops_decrypt_se(ops_crypt_t *decrypt,void *out,const void *in,
+		      size_t count)
+    { return se_cfb(decrypt,out,in,count,ops_false); }
+
+size_t ops_encrypt_se(ops_crypt_t *encrypt,void *out,const void *in,
+		      size_t count)
+    { return se_cfb(encrypt,out,in,count,ops_true); }
+
 /**
 \ingroup HighLevel_Supported
 \brief Is this Symmetric Algorithm supported?
@@ -663,8 +1001,9 @@ size_t ops_encrypt_se_ip(ops_crypt_t *crypt,void *out_,const void *in_,
         return -1;
 
     crypt->cfb_encrypt(crypt, out_, in_, count);
+    if(crypt->failed)
+	return -1;
 
-    // \todo test this number was encrypted
     return count;
     }
 
@@ -675,8 +1014,9 @@ size_t ops_decrypt_se_ip(ops_crypt_t *crypt,void *out_,const void *in_,
         return -1;
 
     crypt->cfb_decrypt(crypt, out_, in_, count);
+    if(crypt->failed)
+	return -1;
 
-    // \todo check this number was in fact decrypted
     return count;
     }
 
@@ -144,6 +144,21 @@ static int sum16_reader(void *dest_,size_t length,ops_error_t **errors,
     return r;
     }
 
+static int sum16_peek(const unsigned char **span,ops_error_t **errors,
+		      ops_reader_info_t *rinfo,ops_parse_cb_info_t *cbinfo)
+    { return ops_stacked_peek(span,errors,rinfo,cbinfo); }
+
+static void sum16_consume(const unsigned char *span,size_t length,
+			  ops_reader_info_t *rinfo)
+    {
+    sum16_arg_t *arg=ops_reader_get_arg(rinfo);
+    size_t n;
+
+    for(n=0 ; n < length ; ++n)
+	arg->sum=(arg->sum+span[n])&0xffff;
+    ops_stacked_consume(span,length,rinfo);
+    }
+
 static void sum16_destroyer(ops_reader_info_t *rinfo)
     { free(ops_reader_get_arg(rinfo)); }
 
@@ -155,8 +170,11 @@ static void sum16_destroyer(ops_reader_info_t *rinfo)
 void ops_reader_push_sum16(ops_parse_info_t *pinfo)
     {
     sum16_arg_t *arg=ops_mallocz(sizeof *arg);
+    ops_boolean_t span=ops_reader_has_span(pinfo);
 
     ops_reader_push(pinfo,sum16_reader,sum16_destroyer,arg);
+    if(span)
+	ops_reader_set_span(pinfo,sum16_peek,sum16_consume);
     }
 
 /**
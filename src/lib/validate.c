@@ -37,23 +37,24 @@
 
 static int debug=0;
 
-static ops_boolean_t check_binary_signature(const unsigned len,
-                                            const unsigned char *data,
-                                            const ops_signature_t *sig, 
-                                            const ops_public_key_t *signer __attribute__((unused)))
+/* A running hash of Literal Data, for the signature from keyid */
+struct validate_data_hash
     {
-    // Does the signed hash match the given hash?
+    unsigned char keyid[OPS_KEY_ID_SIZE];
+    ops_hash_t hash;
+    };
 
+/* Add the signature's trailer to a hash of the signed data, and check
+   the result */
+static ops_boolean_t check_hashed_signature(ops_hash_t *hash,
+					    const ops_signature_t *sig,
+					    const ops_public_key_t *signer)
+    {
     int n=0;
-    ops_hash_t hash;
     unsigned char hashout[OPS_MAX_HASH_SIZE];
     unsigned char trailer[6];
     unsigned int hashedlen;
 
-    //common_init_signature(&hash,sig);
-    ops_hash_any(&hash,sig->info.hash_algorithm);
-    hash.init(&hash);
-    hash.add(&hash,data,len);
     switch (sig->info.version)
         {
     case OPS_V3:
@@ -62,11 +63,11 @@ static ops_boolean_t check_binary_signature(const unsigned len,
         trailer[2]=sig->info.creation_time >> 16;
         trailer[3]=sig->info.creation_time >> 8;
         trailer[4]=sig->info.creation_time;
-        hash.add(&hash,&trailer[0],5);
+        hash->add(hash,&trailer[0],5);
         break;
 
     case OPS_V4:
-        hash.add(&hash,sig->info.v4_hashed_data,sig->info.v4_hashed_data_length);
+        hash->add(hash,sig->info.v4_hashed_data,sig->info.v4_hashed_data_length);
 
         trailer[0]=0x04; // version
         trailer[1]=0xFF;
@@ -75,21 +76,38 @@ static ops_boolean_t check_binary_signature(const unsigned len,
         trailer[3]=hashedlen >> 16;
         trailer[4]=hashedlen >> 8;
         trailer[5]=hashedlen;
-        hash.add(&hash,&trailer[0],6);
+        hash->add(hash,&trailer[0],6);
 
         break;
 
     default:
         fprintf(stderr,"Invalid signature version %d\n", sig->info.version);
+        hash->finish(hash,hashout);
         return ops_false;
         }
 
-    n=hash.finish(&hash,hashout);
+    n=hash->finish(hash,hashout);
 
     //    return ops_false;
     return ops_check_signature(hashout,n,sig,signer);
     }
 
+static ops_boolean_t check_binary_signature(const unsigned len,
+                                            const unsigned char *data,
+                                            const ops_signature_t *sig, 
+                                            const ops_public_key_t *signer __attribute__((unused)))
+    {
+    // Does the signed hash match the given hash?
+
+    ops_hash_t hash;
+
+    //common_init_signature(&hash,sig);
+    ops_hash_any(&hash,sig->info.hash_algorithm);
+    hash.init(&hash);
+    hash.add(&hash,data,len);
+    return check_hashed_signature(&hash,sig,signer);
+    }
+
 static int keydata_reader(void *dest,size_t length,ops_error_t **errors,
 			  ops_reader_info_t *rinfo,
 			  ops_parse_cb_info_t *cbinfo)
@@ -118,6 +136,16 @@ static int keydata_reader(void *dest,size_t length,ops_error_t **errors,
 
 static void free_signature_info(ops_signature_info_t *sig)
     {
+    if(sig->raw_mpis.len)
+	{
+	// the copy's own, with any BIGNUMs made from them
+	ops_signature_t whole;
+
+	whole.info=*sig;
+	ops_signature_free(&whole);
+	free(sig);
+	return;
+	}
     free (sig->v4_hashed_data);
     free (sig);
     }
@@ -129,6 +157,15 @@ static void copy_signature_info(ops_signature_info_t* dst,
     dst->v4_hashed_data=ops_mallocz(src->v4_hashed_data_length);
     memcpy(dst->v4_hashed_data, src->v4_hashed_data,
 	   src->v4_hashed_data_length);
+    if(src->raw_mpis.len)
+	{
+	// any BIGNUMs are src's: the copy makes its own from raw_mpis
+	memset(&dst->signature,'\0',sizeof dst->signature);
+	dst->raw_mpis.contents=ops_mallocz(src->raw_mpis.len);
+	memcpy(dst->raw_mpis.contents,src->raw_mpis.contents,
+	       src->raw_mpis.len);
+	dst->raw_mpis.borrowed=ops_false;
+	}
     }
 
 static void add_sig_to_valid_list(ops_validate_result_t *result,
@@ -340,6 +377,35 @@ ops_validate_key_cb(const ops_parser_content_t *content_,
     return OPS_RELEASE_MEMORY;
     }
 
+/* The running hash for sig, if there is one */
+static struct validate_data_hash *find_data_hash(validate_data_cb_arg_t *arg,
+						 const ops_signature_t *sig)
+    {
+    unsigned n;
+
+    for(n=0 ; n < arg->nhashes ; ++n)
+	if(!memcmp(arg->hashes[n].keyid,sig->info.signer_id,
+		   OPS_KEY_ID_SIZE)
+	   && arg->hashes[n].hash.algorithm == sig->info.hash_algorithm)
+	    return &arg->hashes[n];
+    return NULL;
+    }
+
+/* Free the running hashes of signatures that never arrived */
+static void free_data_hashes(validate_data_cb_arg_t *arg)
+    {
+    unsigned char hashout[OPS_MAX_HASH_SIZE];
+
+    while(arg->nhashes)
+	{
+	--arg->nhashes;
+	arg->hashes[arg->nhashes].hash.finish(&arg->hashes[arg->nhashes].hash,
+					      hashout);
+	}
+    free(arg->hashes);
+    arg->hashes=NULL;
+    }
+
 ops_parse_cb_return_t
 validate_data_cb(const ops_parser_content_t *content_,
 		 ops_parse_cb_info_t *cbinfo)
@@ -350,6 +416,8 @@ validate_data_cb(const ops_parser_content_t *content_,
     const ops_keydata_t *signer;
     ops_boolean_t valid=ops_false;
     ops_memory_t* mem=NULL;
+    struct validate_data_hash *hash;
+    unsigned n;
 
     if (debug)
         printf("%s\n",ops_show_packet_tag(content_->tag));
@@ -364,14 +432,24 @@ validate_data_cb(const ops_parser_content_t *content_,
         // ignore
         break;
 
+    case OPS_PTAG_CT_ONE_PASS_SIGNATURE:
+	// start a hash of the data for the signature that will follow it
+	arg->hashes=realloc(arg->hashes,(arg->nhashes+1)*sizeof *arg->hashes);
+	hash=&arg->hashes[arg->nhashes++];
+	memcpy(hash->keyid,content->one_pass_signature.keyid,
+	       sizeof hash->keyid);
+	ops_hash_any(&hash->hash,content->one_pass_signature.hash_algorithm);
+	hash->hash.init(&hash->hash);
+	break;
+
     case OPS_PTAG_CT_LITERAL_DATA_BODY:
-	// These frees cause a core dump, but I think they're also needed
-	// to avoid a potential memory leak.
-	//if(arg->data.literal_data_body.data != NULL)
-	//    free(arg->data.literal_data_body.data);
-	arg->data.literal_data_body=content->literal_data_body;
+	// The body may arrive in several chunks, in a buffer the parser
+	// reuses, so hash each one as it comes rather than keep it
+	for(n=0 ; n < arg->nhashes ; ++n)
+	    arg->hashes[n].hash.add(&arg->hashes[n].hash,
+				    content->literal_data_body.data,
+				    content->literal_data_body.length);
         arg->use=LITERAL_DATA;
-        return OPS_KEEP_MEMORY;
         break;
 
     case OPS_PTAG_CT_SIGNED_CLEARTEXT_BODY:
@@ -417,9 +495,19 @@ validate_data_cb(const ops_parser_content_t *content_,
             {
         case OPS_SIG_BINARY:
         case OPS_SIG_TEXT:
+            hash=find_data_hash(arg,&content->signature);
+            if(hash)
+                {
+                valid=check_hashed_signature(&hash->hash,&content->signature,
+                                             ops_get_public_key_from_data(signer));
+                *hash=arg->hashes[--arg->nhashes];
+                break;
+                }
+
             switch(arg->use)
                 {
             case LITERAL_DATA:
+                // data given to us up front, for a detached signature
                 ops_memory_add(mem,
 			       arg->data.literal_data_body.data,
 			       arg->data.literal_data_body.length);
@@ -465,7 +553,6 @@ validate_data_cb(const ops_parser_content_t *content_,
  case OPS_PTAG_CT_SIGNATURE_HEADER:
  case OPS_PTAG_CT_ARMOUR_HEADER:
  case OPS_PTAG_CT_ARMOUR_TRAILER:
- case OPS_PTAG_CT_ONE_PASS_SIGNATURE:
  case OPS_PARSER_PACKET_END:
 	break;
 
@@ -701,6 +788,7 @@ ops_boolean_t ops_validate_file(ops_validate_result_t *result,
 
     if(validate_arg.data.literal_data_body.data != NULL)
 	free(validate_arg.data.literal_data_body.data);
+    free_data_hashes(&validate_arg);
 
     return validate_result_status(result);
     }
@@ -756,6 +844,7 @@ ops_boolean_t ops_validate_mem(ops_validate_result_t *result, ops_memory_t* mem,
 
     if(validate_arg.data.literal_data_body.data != NULL)
 	free(validate_arg.data.literal_data_body.data);
+    free_data_hashes(&validate_arg);
 
     return validate_result_status(result);
     }
@@ -832,6 +921,7 @@ ops_validate_detached_signature(const void *literal_data,
 
     if(validate_arg.data.literal_data_body.data != NULL)
 	free(validate_arg.data.literal_data_body.data);
+    free_data_hashes(&validate_arg);
 
     return res;
     }
@@ -34,7 +34,7 @@
 
 static int debug=0;
 
-#define LINE_LENGTH 63
+#define LINE_LENGTH 64 /* characters of base64, 48 bytes of data */
 
 static const char newline[] = "\r\n";
 
@@ -49,6 +49,54 @@ typedef struct
     ops_memory_t *trailing;
     } dash_escaped_arg_t;
 
+/* The general case, a character at a time */
+static ops_boolean_t dash_escape_char(dash_escaped_arg_t *arg,unsigned char c,
+				      ops_error_t **errors,
+				      ops_writer_info_t *winfo)
+    {
+    unsigned l;
+
+    if(arg->seen_nl)
+	{
+	if(c == '-' && !ops_stacked_write("- ",2,errors,winfo))
+	    return ops_false;
+	arg->seen_nl=ops_false;
+	}
+
+    arg->seen_nl=c == '\n';
+
+    if(arg->seen_nl && !arg->seen_cr)
+	{
+	if(!ops_stacked_write("\r",1,errors,winfo))
+	    return ops_false;
+	ops_signature_add_data(arg->sig,"\r",1);
+	}
+
+    arg->seen_cr=c == '\r';
+
+    if(!ops_stacked_write(&c,1,errors,winfo))
+	return ops_false;
+
+    /* trailing whitespace isn't included in the signature */
+    if(c == ' ' || c == '\t')
+	ops_memory_add(arg->trailing,&c,1);
+    else
+	{
+	if((l=ops_memory_get_length(arg->trailing)))
+	    {
+	    if(!arg->seen_nl && !arg->seen_cr)
+		ops_signature_add_data(arg->sig,
+				       ops_memory_get_data(arg->trailing),l);
+	    ops_memory_clear(arg->trailing);
+	    }
+	ops_signature_add_data(arg->sig,&c,1);
+	}
+
+    return ops_true;
+    }
+
+/* Escaping and hashing are done a line at a time, where the line has
+   no CRs but maybe one at the end */
 static ops_boolean_t dash_escaped_writer(const unsigned char *src,
 					 unsigned length,
 					 ops_error_t **errors,
@@ -72,10 +120,24 @@ static ops_boolean_t dash_escaped_writer(const unsigned char *src,
         fprintf(stderr,"\n");
         }
 
-    // XXX: make this efficient
-    for(n=0 ; n < length ; ++n)
+    for(n=0 ; n < length ; )
 	{
-	unsigned l;
+	const unsigned char *nl=memchr(src+n,'\n',length-n);
+	unsigned end=nl ? (unsigned)(nl-src) : length;
+	unsigned last=end;
+	unsigned k;
+
+	/* a CR of our own is fine at the end of a line, anywhere else
+	   it is left to dash_escape_char() */
+	if(nl && end > n && src[end-1] == '\r')
+	    --last;
+	if(memchr(src+n,'\r',last-n))
+	    {
+	    for(end+=nl != NULL ; n < end ; ++n)
+		if(!dash_escape_char(arg,src[n],errors,winfo))
+		    return ops_false;
+	    continue;
+	    }
 
 	if(arg->seen_nl)
 	    {
@@ -84,35 +146,58 @@ static ops_boolean_t dash_escaped_writer(const unsigned char *src,
 	    arg->seen_nl=ops_false;
 	    }
 
-	arg->seen_nl=src[n] == '\n';
+	/* trailing whitespace isn't included in the signature */
+	for(k=last ; k > n && (src[k-1] == ' ' || src[k-1] == '\t') ; --k)
+	    ;
+	if(k > n)
+	    {
+	    unsigned l=ops_memory_get_length(arg->trailing);
 
-	if(arg->seen_nl && !arg->seen_cr)
+	    if(l)
+		{
+		ops_signature_add_data(arg->sig,
+				       ops_memory_get_data(arg->trailing),l);
+		ops_memory_clear(arg->trailing);
+		}
+	    ops_signature_add_data(arg->sig,src+n,k-n);
+	    arg->seen_cr=ops_false;
+	    }
+	if(last > k)
 	    {
-	    if(!ops_stacked_write("\r",1,errors,winfo))
-		return ops_false;
+	    ops_memory_add(arg->trailing,src+k,last-k);
+	    arg->seen_cr=ops_false;
+	    }
+	if(last < end)
+	    {
+	    ops_memory_clear(arg->trailing);
 	    ops_signature_add_data(arg->sig,"\r",1);
+	    arg->seen_cr=ops_true;
 	    }
 
-	arg->seen_cr=src[n] == '\r';
-
-	if(!ops_stacked_write(&src[n],1,errors,winfo))
-	    return ops_false;
+	if(!nl)
+	    {
+	    if(!ops_stacked_write(src+n,end-n,errors,winfo))
+		return ops_false;
+	    break;
+	    }
 
-	/* trailing whitespace isn't included in the signature */
-	if(src[n] == ' ' || src[n] == '\t')
-	    ops_memory_add(arg->trailing,&src[n],1);
+	ops_memory_clear(arg->trailing);
+	if(arg->seen_cr)
+	    {
+	    if(!ops_stacked_write(src+n,end+1-n,errors,winfo))
+		return ops_false;
+	    ops_signature_add_data(arg->sig,"\n",1);
+	    }
 	else
 	    {
-	    if((l=ops_memory_get_length(arg->trailing)))
-		{
-		if(!arg->seen_nl && !arg->seen_cr)
-		    ops_signature_add_data(arg->sig,
-					   ops_memory_get_data(arg->trailing),
-					   l);
-		ops_memory_clear(arg->trailing);
-		}
-	    ops_signature_add_data(arg->sig,&src[n],1);
+	    if(!ops_stacked_write(src+n,end-n,errors,winfo)
+	       || !ops_stacked_write("\r\n",2,errors,winfo))
+		return ops_false;
+	    ops_signature_add_data(arg->sig,"\r\n",2);
 	    }
+	arg->seen_nl=ops_true;
+	arg->seen_cr=ops_false;
+	n=end+1;
 	}
 
     return ops_true;
@@ -168,24 +253,69 @@ ops_boolean_t ops_writer_push_clearsigned(ops_create_info_t *info,
  */
 typedef struct
     {
-    size_t chars_written;
-    ops_boolean_t writing_trailer;
-    unsigned pos;
-    unsigned char t;
+    unsigned char group[3]; /*!< input short of a whole group */
+    unsigned ngroup;
+    unsigned line; /*!< characters on the current line */
     unsigned checksum;
+    unsigned nout;
+    char out[8192]; /*!< encoded lines not yet written */
     } base64_arg_t;
 
 static char b64map[]="ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz"
 "0123456789+/";
 
-static ops_boolean_t check_newline(base64_arg_t* arg,
-                                   ops_error_t **errors,
+static void encode_group(char *out,const unsigned char *in)
+    {
+    out[0]=b64map[in[0] >> 2];
+    out[1]=b64map[((in[0]&3) << 4)|(in[1] >> 4)];
+    out[2]=b64map[((in[1]&0xf) << 2)|(in[2] >> 6)];
+    out[3]=b64map[in[2]&0x3f];
+    }
+
+static ops_boolean_t flush_base64(base64_arg_t *arg,ops_error_t **errors,
+				  ops_writer_info_t *winfo)
+    {
+    unsigned n=arg->nout;
+
+    arg->nout=0;
+    return ops_stacked_write(arg->out,n,errors,winfo);
+    }
+
+/* Encode length bytes, a multiple of 3, a line at a time. The newline
+   ending a full line is only added once there is more to go on the
+   next one. */
+static ops_boolean_t encode_groups(base64_arg_t *arg,const unsigned char *src,
+				   unsigned length,ops_error_t **errors,
 				   ops_writer_info_t *winfo)
     {
-    arg->chars_written++;
-    if (!arg->writing_trailer && arg->chars_written % LINE_LENGTH == 0)
-	if (!ops_stacked_write(newline, strlen(newline), errors, winfo))
+    while(length)
+	{
+	unsigned n;
+	char *out;
+
+	if(sizeof arg->out-arg->nout < LINE_LENGTH+sizeof newline-1
+	   && !flush_base64(arg,errors,winfo))
 	    return ops_false;
+	if(arg->line == LINE_LENGTH)
+	    {
+	    memcpy(arg->out+arg->nout,newline,sizeof newline-1);
+	    arg->nout+=sizeof newline-1;
+	    arg->line=0;
+	    }
+
+	n=(LINE_LENGTH-arg->line)/4*3;
+	if(n > length)
+	    n=length;
+	for(out=arg->out+arg->nout ; out < arg->out+arg->nout+n/3*4 ; out+=4)
+	    {
+	    encode_group(out,src);
+	    src+=3;
+	    }
+	arg->nout+=n/3*4;
+	arg->line+=n/3*4;
+	length-=n;
+	}
+
     return ops_true;
     }
 
@@ -196,120 +326,76 @@ static ops_boolean_t base64_writer(const unsigned char *src,
     base64_arg_t *arg=ops_writer_get_arg(winfo);
     unsigned n;
 
-    for(n=0 ; n < length ; )
+    arg->checksum=ops_crc24_update(arg->checksum,src,length);
+
+    /* complete the group left over from last time */
+    if(arg->ngroup)
 	{
-	arg->checksum=ops_crc24(arg->checksum,src[n]);
-	if(arg->pos == 0)
+	while(arg->ngroup < 3 && length)
 	    {
-	    /* XXXXXX00 00000000 00000000 */
-	    if(!ops_stacked_write(&b64map[src[n] >> 2],1,errors,winfo))
-		return ops_false;
-
-	    /* 000000XX xxxx0000 00000000 */
-	    arg->t=(src[n++]&3) << 4;
-	    arg->pos=1;
+	    arg->group[arg->ngroup++]=*src++;
+	    --length;
 	    }
-	else if(arg->pos == 1)
-	    {
-	    /* 000000xx XXXX0000 00000000 */
-	    arg->t+=src[n] >> 4;
-	    if(!ops_stacked_write(&b64map[arg->t],1,errors,winfo))
-		return ops_false;
+	if(arg->ngroup < 3)
+	    return ops_true;
+	if(!encode_groups(arg,arg->group,3,errors,winfo))
+	    return ops_false;
+	arg->ngroup=0;
+	}
 
-	    /* 00000000 0000XXXX xx000000 */
-	    arg->t=(src[n++]&0xf) << 2;
-	    arg->pos=2;
-	    }
-	else if(arg->pos == 2)
-	    {
-	    /* 00000000 0000xxxx XX000000 */
-	    arg->t+=src[n] >> 6;
-	    if(!ops_stacked_write(&b64map[arg->t],1,errors,winfo))
-		return ops_false;
-            if(!check_newline(arg, errors, winfo))
-		return ops_false;
+    n=length-length%3;
+    if(!encode_groups(arg,src,n,errors,winfo))
+	return ops_false;
 
-	    /* 00000000 00000000 00XXXXXX */
-	    if(!ops_stacked_write(&b64map[src[n++]&0x3f],1,errors,winfo))
-		return ops_false;
+    arg->ngroup=length-n;
+    memcpy(arg->group,src+n,arg->ngroup);
 
-	    arg->pos=0;
-	    }
-	if (!check_newline(arg, errors, winfo))
-	    return ops_false;
-        }
     return ops_true;
     }
 
-static ops_boolean_t signature_finaliser(ops_error_t **errors,
-					 ops_writer_info_t *winfo)
+/* Write out the last group, padded, and the checksum */
+static ops_boolean_t base64_finish(base64_arg_t *arg,ops_error_t **errors,
+				   ops_writer_info_t *winfo)
     {
-    base64_arg_t *arg=ops_writer_get_arg(winfo);
-    static char trailer[]="\r\n-----END PGP SIGNATURE-----\r\n";
     unsigned char c[3];
 
-    if(arg->pos)
+    if(arg->ngroup)
 	{
-	if(!ops_stacked_write(&b64map[arg->t],1,errors,winfo))
-	    return ops_false;
-	if(arg->pos == 1 && !ops_stacked_write("==",2,errors,winfo))
-	    return ops_false;
-	if(arg->pos == 2 && !ops_stacked_write("=",1,errors,winfo))
+	memset(arg->group+arg->ngroup,'\0',3-arg->ngroup);
+	if(!encode_groups(arg,arg->group,3,errors,winfo))
 	    return ops_false;
+	arg->out[arg->nout-1]='=';
+	if(arg->ngroup == 1)
+	    arg->out[arg->nout-2]='=';
+	arg->ngroup=0;
 	}
-    /* Ready for the checksum */
-    if(!ops_stacked_write("\r\n=",3,errors,winfo))
-	return ops_false;
 
-    arg->pos=0; /* get ready to write the checksum */
+    /* encode_groups() only makes room for a line before it writes
+       one, so out may be full */
+    if(sizeof arg->out-arg->nout < 7 && !flush_base64(arg,errors,winfo))
+	return ops_false;
+    memcpy(arg->out+arg->nout,"\r\n=",3);
+    arg->nout+=3;
 
     c[0]=arg->checksum >> 16;
     c[1]=arg->checksum >> 8;
     c[2]=arg->checksum;
-    /* push the checksum through our own writer. Turn off the
-       writing_body flag so we don't put a newline in the trailer.
-     */
-    arg->writing_trailer = ops_true;
-    if(!base64_writer(c,3,errors,winfo))
-	return ops_false;
+    encode_group(arg->out+arg->nout,c);
+    arg->nout+=4;
 
-    return ops_stacked_write(trailer,sizeof trailer-1,errors,winfo);
+    return flush_base64(arg,errors,winfo);
     }
 
-/**
- * \struct linebreak_arg_t
- */
-typedef struct
-    {
-    unsigned pos;
-    } linebreak_arg_t;
-
-#define BREAKPOS	64
-
-static ops_boolean_t linebreak_writer(const unsigned char *src,
-					 unsigned length,
-					 ops_error_t **errors,
+static ops_boolean_t signature_finaliser(ops_error_t **errors,
 					 ops_writer_info_t *winfo)
     {
-    linebreak_arg_t *arg=ops_writer_get_arg(winfo);
-    unsigned n;
-
-    for(n=0 ; n < length ; ++n,++arg->pos)
-	{
-	if(src[n] == '\r' || src[n] == '\n')
-	    arg->pos=0;
+    base64_arg_t *arg=ops_writer_get_arg(winfo);
+    static char trailer[]="\r\n-----END PGP SIGNATURE-----\r\n";
 
-	if(arg->pos == BREAKPOS)
-	    {
-	    if(!ops_stacked_write(newline,strlen(newline),errors,winfo))
-		return ops_false;
-	    arg->pos=0;
-	    }
-	if(!ops_stacked_write(&src[n],1,errors,winfo))
-	    return ops_false;
-	}
+    if(!base64_finish(arg,errors,winfo))
+	return ops_false;
 
-    return ops_true;
+    return ops_stacked_write(trailer,sizeof trailer-1,errors,winfo);
     }
 
 /**
@@ -330,9 +416,6 @@ ops_boolean_t ops_writer_switch_to_armoured_signature(ops_create_info_t *info)
         return ops_false;
         }
 
-    ops_writer_push(info,linebreak_writer,NULL,ops_writer_generic_destroyer,
-		    ops_mallocz(sizeof(linebreak_arg_t)));
-
     base64=ops_mallocz(sizeof *base64);
     if (!base64)
         {
@@ -348,34 +431,10 @@ ops_boolean_t ops_writer_switch_to_armoured_signature(ops_create_info_t *info)
 static ops_boolean_t armoured_message_finaliser(ops_error_t **errors,
 					 ops_writer_info_t *winfo)
     {
-    // TODO: This is same as signature_finaliser apart from trailer.
     base64_arg_t *arg=ops_writer_get_arg(winfo);
     static char trailer[]="\r\n-----END PGP MESSAGE-----\r\n";
-    unsigned char c[3];
 
-    if(arg->pos)
-	{
-	if(!ops_stacked_write(&b64map[arg->t],1,errors,winfo))
-	    return ops_false;
-	if(arg->pos == 1 && !ops_stacked_write("==",2,errors,winfo))
-	    return ops_false;
-	if(arg->pos == 2 && !ops_stacked_write("=",1,errors,winfo))
-	    return ops_false;
-	}
-    /* Ready for the checksum */
-    if(!ops_stacked_write("\r\n=",3,errors,winfo))
-	return ops_false;
-
-    arg->pos=0; /* get ready to write the checksum */
-
-    c[0]=arg->checksum >> 16;
-    c[1]=arg->checksum >> 8;
-    c[2]=arg->checksum;
-    /* push the checksum through our own writer. Turn off the
-       writing_body flag so we don't put a newline in the trailer.
-     */
-    arg->writing_trailer = ops_true;
-    if(!base64_writer(c,3,errors,winfo))
+    if(!base64_finish(arg,errors,winfo))
 	return ops_false;
 
     return ops_stacked_write(trailer,sizeof trailer-1,errors,winfo);
@@ -426,32 +485,8 @@ static ops_boolean_t armoured_finaliser(ops_armor_type_t type, ops_error_t **err
         }
 
     base64_arg_t *arg=ops_writer_get_arg(winfo);
-    unsigned char c[3];
 
-    if(arg->pos)
-	{
-	if(!ops_stacked_write(&b64map[arg->t],1,errors,winfo))
-	    return ops_false;
-	if(arg->pos == 1 && !ops_stacked_write("==",2,errors,winfo))
-	    return ops_false;
-	if(arg->pos == 2 && !ops_stacked_write("=",1,errors,winfo))
-	    return ops_false;
-	}
-
-    /* Ready for the checksum */
-    if(!ops_stacked_write("\r\n=",3,errors,winfo))
-	return ops_false;
-
-    arg->pos=0; /* get ready to write the checksum */
-
-    c[0]=arg->checksum >> 16;
-    c[1]=arg->checksum >> 8;
-    c[2]=arg->checksum;
-    /* push the checksum through our own writer. Turn off the
-       writing_body flag so we don't put a newline in the trailer.
-     */
-    arg->writing_trailer = ops_true;
-    if(!base64_writer(c,3,errors,winfo))
+    if(!base64_finish(arg,errors,winfo))
 	return ops_false;
 
     return ops_stacked_write(tail,sz_tail,errors,winfo);
@@ -505,9 +540,6 @@ void ops_writer_push_armoured(ops_create_info_t *info, ops_armor_type_t type)
 
     ops_write(header,sz_hdr,info);
 
-    ops_writer_push(info,linebreak_writer,NULL,ops_writer_generic_destroyer,
-		    ops_mallocz(sizeof(linebreak_arg_t)));
-
     base64_arg_t *arg=ops_mallocz(sizeof *arg);
     arg->checksum=CRC24_INIT;
     ops_writer_push(info,base64_writer,finaliser,ops_writer_generic_destroyer,arg);
@@ -61,6 +61,11 @@ static ops_boolean_t encrypt_writer(const unsigned char *src,
         //        memcpy(buf,src,len); // \todo copy needed here?
         
         arg->crypt->cfb_encrypt(arg->crypt, encbuf, src+done, len);
+        if (arg->crypt->failed)
+            {
+            OPS_ERROR(errors, OPS_E_W, "Symmetric encryption failed");
+            return ops_false;
+            }
 
         if (debug)
             {
@@ -38,6 +38,7 @@
 #include <openpgpsdk/keyring.h>
 #include <openpgpsdk/random.h>
 #include <openpgpsdk/readerwriter.h>
+#include <openpgpsdk/streamwriter.h>
 
 static int debug=0;
 
@@ -92,53 +93,37 @@ void ops_writer_push_encrypt_se_ip(ops_create_info_t *cinfo,
     free(iv);
     }
 
+/* The bottom of the stack encrypt_se_ip_writer() builds: writes to
+   the writer below it */
+static ops_boolean_t next_writer(const unsigned char *src,
+				 unsigned length,
+				 ops_error_t **errors,
+				 ops_writer_info_t *winfo)
+    {
+    return ops_stacked_write(src, length, errors, ops_writer_get_arg(winfo));
+    }
+
 static ops_boolean_t encrypt_se_ip_writer(const unsigned char *src,
                                           unsigned length,
                                           ops_error_t **errors,
                                           ops_writer_info_t *winfo)
     {
     encrypt_se_ip_arg_t *arg=ops_writer_get_arg(winfo);
+    ops_create_info_t *cinfo=ops_create_info_new();
+    ops_boolean_t rtn;
 
-    ops_boolean_t rtn=ops_true;
-
-    ops_memory_t *mem_literal;
-    ops_create_info_t *cinfo_literal;
-
-    ops_memory_t *mem_compressed;
-    ops_create_info_t *cinfo_compressed;
+    // Write the literal data packet through a compressed packet and
+    // an SE IP packet, streaming, so that memory use stays the same
+    // however much is written
+    ops_writer_set(cinfo, next_writer, NULL, NULL, winfo);
+    ops_writer_push_stream_encrypt_se_ip_crypt(cinfo, arg->crypt);
+    ops_writer_push_compressed(cinfo);
 
-    ops_memory_t *my_mem;
-    ops_create_info_t *my_cinfo;
+    rtn=ops_write_literal_data_from_buf(src, length, OPS_LDT_BINARY, cinfo);
+    rtn=ops_writer_close(cinfo) && rtn;
 
-    const unsigned int bufsz=128; // initial value; gets expanded as necessary
-    ops_setup_memory_write(&cinfo_literal, &mem_literal, bufsz);
-    ops_setup_memory_write(&cinfo_compressed, &mem_compressed, bufsz);
-    ops_setup_memory_write(&my_cinfo, &my_mem, bufsz);
-
-    // create literal data packet from source data
-    ops_write_literal_data_from_buf(src, length, OPS_LDT_BINARY, cinfo_literal);
-    assert(ops_memory_get_length(mem_literal) > length);
-
-    // create compressed packet from literal data packet
-    ops_write_compressed(ops_memory_get_data(mem_literal),
-                         ops_memory_get_length(mem_literal),
-                         cinfo_compressed);
-
-    // create SE IP packet set from this compressed literal data
-    ops_write_se_ip_pktset(ops_memory_get_data(mem_compressed), 
-                           ops_memory_get_length(mem_compressed), 
-                           arg->crypt, my_cinfo);
-    assert(ops_memory_get_length(my_mem)
-	   > ops_memory_get_length(mem_compressed));
-
-    // now write memory to next writer
-    rtn=ops_stacked_write(ops_memory_get_data(my_mem),
-                          ops_memory_get_length(my_mem),
-                          errors, winfo);
-    
-    ops_memory_free(my_mem);
-    ops_memory_free(mem_compressed);
-    ops_memory_free(mem_literal);
+    ops_move_errors(cinfo, errors);
+    ops_create_info_delete(cinfo);
 
     return rtn;
     }
@@ -148,6 +133,7 @@ static void encrypt_se_ip_destroyer (ops_writer_info_t *winfo)
     {
     encrypt_se_ip_arg_t *arg=ops_writer_get_arg(winfo);
 
+    arg->crypt->decrypt_finish(arg->crypt);
     free(arg->crypt);
     free(arg);
     }
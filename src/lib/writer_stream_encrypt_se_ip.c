@@ -39,11 +39,13 @@
 #include <openpgpsdk/random.h>
 #include <openpgpsdk/streamwriter.h>
 
+/* how much to hash and encrypt at a time: small enough to stay in
+   cache between the two */
+#define SE_IP_CHUNK	4096
+
 typedef struct 
     {
     ops_crypt_t*crypt;
-    ops_memory_t *mem_se_ip;
-    ops_create_info_t *cinfo_se_ip;
     ops_hash_t hash;
     } stream_encrypt_se_ip_arg_t;
 
@@ -61,6 +63,9 @@ static ops_boolean_t stream_encrypt_se_ip_finaliser(ops_error_t **errors,
 
 static void stream_encrypt_se_ip_destroyer (ops_writer_info_t *winfo);
 
+static void push_stream_encrypt_se_ip(ops_create_info_t *cinfo,
+				      ops_crypt_t *crypt);
+
 
 /**
 \ingroup Core_WritersNext
@@ -89,18 +94,13 @@ void ops_writer_push_stream_encrypt_se_ip(ops_create_info_t *cinfo,
     {
     ops_crypt_t *encrypt;
     unsigned char *iv=NULL;
-    const unsigned int bufsz=1024; // initial value; gets expanded as necessary
-
-    // Create arg to be used with this writer
-    // Remember to free this in the destroyer
-    stream_encrypt_se_ip_arg_t *arg=ops_mallocz(sizeof *arg);
 
     // Create and write encrypted PK session key
     ops_pk_session_key_t *encrypted_pk_session_key;
     encrypted_pk_session_key=ops_create_pk_session_key(pub_key);
     ops_write_pk_session_key(cinfo, encrypted_pk_session_key);
 
-    // Setup the arg
+    // Setup the cipher
     encrypt=ops_mallocz(sizeof *encrypt);
     ops_crypt_any(encrypt, encrypted_pk_session_key->symmetric_algorithm);
     iv=ops_mallocz(encrypt->blocksize);
@@ -108,9 +108,49 @@ void ops_writer_push_stream_encrypt_se_ip(ops_create_info_t *cinfo,
     encrypt->set_key(encrypt, &encrypted_pk_session_key->key[0]);
     ops_encrypt_init(encrypt);
 
-    arg->crypt=encrypt;
+    push_stream_encrypt_se_ip(cinfo, encrypt);
+
+    // tidy up
+    ops_pk_session_key_free(encrypted_pk_session_key);
+    free(encrypted_pk_session_key);
+    free(iv);
+    }
+
+/**
+\ingroup Core_WritersNext
+\brief Pushes a streaming encryption writer using a cipher already
+       set up.
+
+As ops_writer_push_stream_encrypt_se_ip(), but the session key has
+already been written, and the SE IP packet is encrypted with crypt,
+starting from a zero IV. The writer works on its own copy of crypt,
+made with ops_crypt_clone() and ops_crypt_reset(), so the key
+schedule is not expanded again and crypt is left as it was, ready to
+be used for another packet.
+
+\param cinfo Write settings
+\param crypt The cipher, with the session key set and initialised
+*/
+void ops_writer_push_stream_encrypt_se_ip_crypt(ops_create_info_t *cinfo,
+						const ops_crypt_t *crypt)
+    {
+    unsigned char iv[OPS_MAX_BLOCK_SIZE];
+    ops_crypt_t *encrypt=ops_mallocz(sizeof *encrypt);
+
+    memset(iv, '\0', crypt->blocksize);
+    ops_crypt_clone(encrypt, crypt);
+    ops_crypt_reset(encrypt, iv);
+    push_stream_encrypt_se_ip(cinfo, encrypt);
+    }
+
+static void push_stream_encrypt_se_ip(ops_create_info_t *cinfo,
+				      ops_crypt_t *crypt)
+    {
+    // Create arg to be used with this writer
+    // Remember to free this in the destroyer
+    stream_encrypt_se_ip_arg_t *arg=ops_mallocz(sizeof *arg);
 
-    ops_setup_memory_write(&arg->cinfo_se_ip, &arg->mem_se_ip, bufsz);
+    arg->crypt=crypt;
 
     ops_hash_any(&arg->hash, OPS_HASH_SHA1);
     arg->hash.init(&arg->hash);
@@ -126,22 +166,6 @@ void ops_writer_push_stream_encrypt_se_ip(ops_create_info_t *cinfo,
 		    stream_encrypt_se_ip_writer,
 		    stream_encrypt_se_ip_finaliser,
 		    stream_encrypt_se_ip_destroyer, arg);
-    // tidy up
-    ops_pk_session_key_free(encrypted_pk_session_key);
-    free(encrypted_pk_session_key);
-    free(iv);
-    }
-
-static ops_boolean_t ops_stream_write_se_ip(const unsigned char *data,
-                                            unsigned int len,
-                                            stream_encrypt_se_ip_arg_t *arg,
-                                            ops_create_info_t *cinfo)
-    {
-    ops_writer_push_encrypt_crypt(cinfo, arg->crypt);
-    ops_write(data, len, cinfo);
-    ops_writer_pop(cinfo);
-    arg->hash.add(&arg->hash, data, len);
-    return ops_true;
     }
 
 // Writes out the header for the encrypted packet. Invoked by the
@@ -152,58 +176,48 @@ static ops_boolean_t write_encrypt_se_ip_header(ops_create_info_t *cinfo,
     {
     stream_encrypt_se_ip_arg_t *arg = data;
     size_t sz_preamble = arg->crypt->blocksize + 2;
-    unsigned char* preamble = ops_mallocz(sz_preamble);
-
-    ops_write_scalar(SE_IP_DATA_VERSION, 1, cinfo);
+    unsigned char preamble[OPS_MAX_BLOCK_SIZE+2];
 
-    ops_writer_push_encrypt_crypt(cinfo, arg->crypt);
+    if(!ops_write_scalar(SE_IP_DATA_VERSION, 1, cinfo))
+	return ops_false;
 
     ops_random(preamble, arg->crypt->blocksize);
     preamble[arg->crypt->blocksize]=preamble[arg->crypt->blocksize-2];
     preamble[arg->crypt->blocksize+1]=preamble[arg->crypt->blocksize-1];
 
-    ops_write(preamble, sz_preamble, cinfo);
     arg->hash.add(&arg->hash, preamble, sz_preamble);
-    ops_writer_pop(cinfo);
-    free(preamble);
+    arg->crypt->cfb_encrypt(arg->crypt, preamble, preamble, sz_preamble);
 
-    return ops_true;
+    return ops_write(preamble, sz_preamble, cinfo);
     }
 
-static ops_boolean_t
-ops_stream_write_se_ip_last(stream_encrypt_se_ip_arg_t *arg,
-			    ops_create_info_t *cinfo)
+/*
+ * Hashes and encrypts a chunk at a time, so each is only read from
+ * memory once, and passes the ciphertext straight on.
+ */
+static ops_boolean_t hash_and_encrypt(stream_encrypt_se_ip_arg_t *arg,
+				      const unsigned char *src,
+				      unsigned length,ops_error_t **errors,
+				      ops_writer_info_t *winfo)
     {
-    unsigned char c[1];
-    unsigned char hashed[SHA_DIGEST_LENGTH];
-    const size_t sz_mdc = 1 + 1 + SHA_DIGEST_LENGTH;
-
-    ops_memory_t *mem_mdc;
-    ops_create_info_t *cinfo_mdc;
-
-    // MDC packet tag
-    c[0]=0xD3;
-    arg->hash.add(&arg->hash, &c[0], 1);   
-
-    // MDC packet len
-    c[0]=0x14;
-    arg->hash.add(&arg->hash, &c[0], 1);   
-
-    //finish
-    arg->hash.finish(&arg->hash, hashed);
-
-    ops_setup_memory_write(&cinfo_mdc, &mem_mdc, sz_mdc);
-    ops_write_mdc(hashed, cinfo_mdc);
-
-    // encode everthing
-    ops_writer_push_encrypt_crypt(cinfo, arg->crypt);
-
-    ops_write(ops_memory_get_data(mem_mdc), ops_memory_get_length(mem_mdc),
-	      cinfo);
-
-    ops_writer_pop(cinfo);
-
-    ops_teardown_memory_write(cinfo_mdc, mem_mdc);
+    unsigned char buf[SE_IP_CHUNK];
+
+    while(length)
+	{
+	unsigned n=length < sizeof buf ? length : sizeof buf;
+
+	arg->hash.add(&arg->hash, src, n);
+	arg->crypt->cfb_encrypt(arg->crypt, buf, src, n);
+	if(arg->crypt->failed)
+	    {
+	    OPS_ERROR(errors, OPS_E_W, "Symmetric encryption failed");
+	    return ops_false;
+	    }
+	if(!ops_stacked_write(buf, n, errors, winfo))
+	    return ops_false;
+	src+=n;
+	length-=n;
+	}
 
     return ops_true;
     }
@@ -215,30 +229,28 @@ static ops_boolean_t stream_encrypt_se_ip_writer(const unsigned char *src,
     {
     stream_encrypt_se_ip_arg_t *arg=ops_writer_get_arg(winfo);
 
-    ops_boolean_t rtn=ops_true;
-
-    ops_stream_write_se_ip(src, length,
-                           arg, arg->cinfo_se_ip);
-    // now write memory to next writer
-    rtn=ops_stacked_write(ops_memory_get_data(arg->mem_se_ip),
-                          ops_memory_get_length(arg->mem_se_ip),
-                          errors, winfo);
-    
-    ops_memory_clear(arg->mem_se_ip);
-
-    return rtn;
+    return hash_and_encrypt(arg, src, length, errors, winfo);
     }
 
+// Writes the MDC packet, whose tag and length are hashed too
 static ops_boolean_t stream_encrypt_se_ip_finaliser(ops_error_t **errors,
                                                     ops_writer_info_t *winfo)
     {
     stream_encrypt_se_ip_arg_t *arg=ops_writer_get_arg(winfo);
-    // write trailer
-    ops_stream_write_se_ip_last(arg, arg->cinfo_se_ip);
-    // now write memory to next writer
-    return ops_stacked_write(ops_memory_get_data(arg->mem_se_ip),
-                             ops_memory_get_length(arg->mem_se_ip),
-                             errors, winfo);
+    unsigned char mdc[1+1+OPS_SHA1_HASH_SIZE];
+
+    mdc[0]=0xD3;
+    mdc[1]=OPS_SHA1_HASH_SIZE;
+    arg->hash.add(&arg->hash, mdc, 2);
+    arg->hash.finish(&arg->hash, &mdc[2]);
+
+    arg->crypt->cfb_encrypt(arg->crypt, mdc, mdc, sizeof mdc);
+    if(arg->crypt->failed)
+	{
+	OPS_ERROR(errors, OPS_E_W, "Symmetric encryption failed");
+	return ops_false;
+	}
+    return ops_stacked_write(mdc, sizeof mdc, errors, winfo);
     }
 
 static void stream_encrypt_se_ip_destroyer(ops_writer_info_t *winfo)
@@ -246,9 +258,7 @@ static void stream_encrypt_se_ip_destroyer(ops_writer_info_t *winfo)
     {
     stream_encrypt_se_ip_arg_t *arg=ops_writer_get_arg(winfo);
 
-    ops_teardown_memory_write(arg->cinfo_se_ip, arg->mem_se_ip);
     arg->crypt->decrypt_finish(arg->crypt);
-
     free(arg->crypt);
     free(arg);
     }
@@ -0,0 +1,258 @@
+/*
+ * Copyright (c) 2005-2008 Nominet UK (www.nic.uk)
+ * All rights reserved.
+ * Contributors: Ben Laurie, Rachel Willmer. The Contributors have asserted
+ * their moral rights under the UK Copyright Design and Patents Act 1988 to
+ * be recorded as the authors of this copyright work.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Throughput of ops_encrypt_se()/ops_decrypt_se() and the cfb_encrypt
+ * and cfb_decrypt hooks for each symmetric algorithm and backend. The
+ * first two are compared with a byte at a time CFB loop, which is also
+ * used to check their output, including when the input is split
+ * unevenly; the EVP backend's CFB output is checked against the low
+ * level one's.
+ *
+ * Usage: bench_cfb [megabytes [chunk size]]
+ */
+
+#include <openpgpsdk/crypto.h>
+#include <openpgpsdk/packet-show.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+static const ops_symmetric_algorithm_t algs[]=
+    {
+    OPS_SA_CAST5,
+#ifndef OPENSSL_NO_IDEA
+    OPS_SA_IDEA,
+#endif
+    OPS_SA_TRIPLEDES,
+    OPS_SA_AES_128,
+    OPS_SA_AES_256,
+#ifndef OPENSSL_NO_CAMELLIA
+    OPS_SA_CAMELLIA_128,
+    OPS_SA_CAMELLIA_192,
+    OPS_SA_CAMELLIA_256,
+#endif
+    };
+
+static void setup(ops_crypt_t *crypt,ops_symmetric_algorithm_t alg,
+		  ops_crypt_backend_t backend)
+    {
+    unsigned char iv[OPS_MAX_BLOCK_SIZE];
+    unsigned char key[OPS_MAX_KEY_SIZE];
+    unsigned n;
+
+    ops_crypt_any(crypt,alg);
+    ops_crypt_set_backend(crypt,backend);
+    for(n=0 ; n < sizeof iv ; ++n)
+	iv[n]=n;
+    for(n=0 ; n < sizeof key ; ++n)
+	key[n]=n*7+1;
+    crypt->set_iv(crypt,iv);
+    crypt->set_key(crypt,key);
+    ops_encrypt_init(crypt);
+    }
+
+/* The byte at a time loop ops_encrypt_se() used to be */
+static void bytewise_encrypt(ops_crypt_t *encrypt,unsigned char *out,
+			     const unsigned char *in,size_t count)
+    {
+    while(count-- > 0)
+	{
+	if(encrypt->num == encrypt->blocksize)
+	    {
+	    memcpy(encrypt->siv,encrypt->civ,encrypt->blocksize);
+	    encrypt->block_encrypt(encrypt,encrypt->civ,encrypt->civ);
+	    encrypt->num=0;
+	    }
+	encrypt->civ[encrypt->num]=*out++=encrypt->civ[encrypt->num]^*in++;
+	++encrypt->num;
+	}
+    }
+
+static ops_boolean_t same_state(const ops_crypt_t *a,const ops_crypt_t *b)
+    {
+    return a->num == b->num
+	&& !memcmp(a->civ,b->civ,a->blocksize)
+	&& !memcmp(a->siv,b->siv,a->blocksize);
+    }
+
+/* Encrypt and decrypt in uneven pieces, checking against bytewise */
+static ops_boolean_t check(ops_symmetric_algorithm_t alg,
+			   ops_crypt_backend_t backend)
+    {
+    unsigned char in[1000],ref[1000],out[1000],back[1000];
+    ops_crypt_t r,e,d;
+    size_t n,len;
+    ops_boolean_t ok=ops_true;
+
+    for(n=0 ; n < sizeof in ; ++n)
+	in[n]=rand();
+
+    setup(&r,alg,backend);
+    setup(&e,alg,backend);
+    setup(&d,alg,backend);
+    bytewise_encrypt(&r,ref,in,sizeof in);
+    for(n=0 ; n < sizeof in ; n+=len)
+	{
+	len=rand()%(3*r.blocksize+1);
+	if(len > sizeof in-n)
+	    len=sizeof in-n;
+	ops_encrypt_se(&e,out+n,in+n,len);
+	memcpy(back+n,out+n,len);
+	ops_decrypt_se(&d,back+n,back+n,len);
+	}
+
+    if(memcmp(ref,out,sizeof out) || memcmp(in,back,sizeof in))
+	ok=ops_false;
+    if(!same_state(&r,&e) || !same_state(&r,&d))
+	ok=ops_false;
+
+    r.decrypt_finish(&r);
+    e.decrypt_finish(&e);
+    d.decrypt_finish(&d);
+
+    /* CFB from the low level backend, then the one being checked */
+    setup(&r,alg,OPS_CRYPT_BACKEND_LOW_LEVEL);
+    setup(&e,alg,backend);
+    setup(&d,alg,backend);
+    r.cfb_encrypt(&r,ref,in,sizeof in);
+    for(n=0 ; n < sizeof in ; n+=len)
+	{
+	len=rand()%(3*r.blocksize+1);
+	if(len > sizeof in-n)
+	    len=sizeof in-n;
+	e.cfb_encrypt(&e,out+n,in+n,len);
+	d.cfb_decrypt(&d,back+n,out+n,len);
+	}
+
+    if(memcmp(ref,out,sizeof out) || memcmp(in,back,sizeof in))
+	ok=ops_false;
+
+    r.decrypt_finish(&r);
+    e.decrypt_finish(&e);
+    d.decrypt_finish(&d);
+
+    return ok;
+    }
+
+static double now(void)
+    {
+    struct timeval tv;
+
+    gettimeofday(&tv,NULL);
+    return tv.tv_sec+tv.tv_usec/1e6;
+    }
+
+typedef size_t cfb_fn_t(ops_crypt_t *crypt,void *out,const void *in,
+			size_t count);
+
+static size_t bytewise(ops_crypt_t *crypt,void *out,const void *in,
+		       size_t count)
+    {
+    bytewise_encrypt(crypt,out,in,count);
+    return count;
+    }
+
+static size_t cfb_encrypt(ops_crypt_t *crypt,void *out,const void *in,
+			  size_t count)
+    {
+    crypt->cfb_encrypt(crypt,out,in,count);
+    return count;
+    }
+
+static size_t cfb_decrypt(ops_crypt_t *crypt,void *out,const void *in,
+			  size_t count)
+    {
+    crypt->cfb_decrypt(crypt,out,in,count);
+    return count;
+    }
+
+static double rate(ops_symmetric_algorithm_t alg,ops_crypt_backend_t backend,
+		   cfb_fn_t *fn,unsigned char *buf,size_t chunk,size_t total)
+    {
+    ops_crypt_t crypt;
+    size_t done;
+    double start;
+
+    setup(&crypt,alg,backend);
+    start=now();
+    for(done=0 ; done < total ; done+=chunk)
+	fn(&crypt,buf,buf,chunk);
+    start=now()-start;
+    crypt.decrypt_finish(&crypt);
+
+    return total/start/(1024*1024);
+    }
+
+int main(int argc,char **argv)
+    {
+    size_t total=64;
+    size_t chunk=8192;
+    unsigned char *buf;
+    unsigned n;
+    int b;
+    int ret=0;
+
+    if(argc > 1)
+	total=atoi(argv[1]);
+    if(argc > 2)
+	chunk=atoi(argv[2]);
+    if(!total || !chunk)
+	{
+	fprintf(stderr,"%s [megabytes [chunk size]]\n",argv[0]);
+	exit(1);
+	}
+    total*=1024*1024;
+    total-=total%chunk;
+
+    buf=calloc(1,chunk);
+
+    for(b=0 ; b < 2 ; ++b)
+	{
+	ops_crypt_backend_t backend=b ? OPS_CRYPT_BACKEND_EVP
+	    : OPS_CRYPT_BACKEND_LOW_LEVEL;
+
+	printf("%-24s %10s %10s %10s %10s %10s\n",
+	       b ? "MB/s (EVP)" : "MB/s (low level)","bytewise",
+	       "encrypt_se","decrypt_se","cfb_encrypt","cfb_decrypt");
+	for(n=0 ; n < sizeof algs/sizeof *algs ; ++n)
+	    {
+	    const char *name=ops_show_symmetric_algorithm(algs[n]);
+
+	    if(!check(algs[n],backend))
+		{
+		printf("%-24s MISMATCH\n",name);
+		ret=1;
+		continue;
+		}
+	    printf("%-24s %10.1f %10.1f %10.1f %10.1f %10.1f\n",name,
+		   rate(algs[n],backend,bytewise,buf,chunk,total),
+		   rate(algs[n],backend,ops_encrypt_se,buf,chunk,total),
+		   rate(algs[n],backend,ops_decrypt_se,buf,chunk,total),
+		   rate(algs[n],backend,cfb_encrypt,buf,chunk,total),
+		   rate(algs[n],backend,cfb_decrypt,buf,chunk,total));
+	    }
+	}
+
+    free(buf);
+    return ret;
+    }
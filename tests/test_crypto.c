@@ -288,6 +288,170 @@ static void test_cfb_camellia256()
     }
 #endif  // ndef OPENSSL_NO_CAMELLIA
 
+static const ops_symmetric_algorithm_t se_algs[]=
+    {
+    OPS_SA_TRIPLEDES,
+    OPS_SA_CAST5,
+    OPS_SA_AES_128,
+    OPS_SA_AES_256,
+#ifndef OPENSSL_NO_CAMELLIA
+    OPS_SA_CAMELLIA_128,
+    OPS_SA_CAMELLIA_192,
+    OPS_SA_CAMELLIA_256,
+#endif  // ndef OPENSSL_NO_CAMELLIA
+    };
+
+/* Set crypt up for alg with a made-up key and an empty IV */
+static void setup_crypt(ops_crypt_t *crypt,ops_symmetric_algorithm_t alg,
+			ops_crypt_backend_t backend)
+    {
+    unsigned char iv[OPS_MAX_BLOCK_SIZE];
+    unsigned char key[OPS_MAX_KEY_SIZE];
+
+    memset(iv,'\0',sizeof iv);
+    memset(key,'\0',sizeof key);
+    CU_ASSERT_FATAL(ops_crypt_any(crypt,alg));
+    ops_crypt_set_backend(crypt,backend);
+    snprintf((char *)key,crypt->keysize,"MY SE KEY");
+    crypt->set_iv(crypt,iv);
+    crypt->set_key(crypt,key);
+    ops_encrypt_init(crypt);
+    }
+
+static void test_se_cfb()
+    {
+    static const size_t chunks[]={ 1, 3, 7, 8, 16, 17, 1000 };
+    unsigned char plaintext[1000];
+    unsigned char expected[1000];
+    unsigned char out[1000];
+    unsigned char out2[1000];
+    unsigned char iv[OPS_MAX_BLOCK_SIZE];
+    unsigned a,c;
+    size_t n,l;
+
+    for(n=0 ; n < sizeof plaintext ; ++n)
+	plaintext[n]=n*31+7;
+    memset(iv,'\0',sizeof iv);
+
+    for(a=0 ; a < sizeof se_algs/sizeof *se_algs ; ++a)
+	{
+	ops_crypt_t crypt;
+	ops_crypt_t bytewise;
+
+	setup_crypt(&crypt,se_algs[a],OPS_CRYPT_BACKEND_LOW_LEVEL);
+
+	// until it is resynced, it is the cipher's own CFB, however
+	// the data is split up
+	crypt.cfb_encrypt(&crypt,expected,plaintext,sizeof plaintext);
+	for(c=0 ; c < sizeof chunks/sizeof *chunks ; ++c)
+	    {
+	    ops_crypt_reset(&crypt,iv);
+	    for(n=0 ; n < sizeof plaintext ; n+=l)
+		{
+		l=sizeof plaintext-n;
+		if(l > chunks[c])
+		    l=chunks[c];
+		ops_encrypt_se(&crypt,out+n,plaintext+n,l);
+		}
+	    CU_ASSERT(memcmp(out,expected,sizeof expected) == 0);
+
+	    ops_crypt_reset(&crypt,iv);
+	    for(n=0 ; n < sizeof plaintext ; n+=l)
+		{
+		l=sizeof plaintext-n;
+		if(l > chunks[c])
+		    l=chunks[c];
+		ops_decrypt_se(&crypt,out2+n,expected+n,l);
+		}
+	    CU_ASSERT(memcmp(out2,plaintext,sizeof plaintext) == 0);
+	    }
+
+	// resyncing part way through a block gives the same as doing it
+	// a byte at a time
+	ops_crypt_clone(&bytewise,&crypt);
+	ops_crypt_reset(&crypt,iv);
+	ops_crypt_reset(&bytewise,iv);
+	ops_decrypt_se(&crypt,out,expected,10);
+	for(n=0 ; n < 10 ; ++n)
+	    ops_decrypt_se(&bytewise,out2+n,expected+n,1);
+	crypt.decrypt_resync(&crypt);
+	bytewise.decrypt_resync(&bytewise);
+	ops_decrypt_se(&crypt,out+10,expected+10,sizeof expected-10);
+	for(n=10 ; n < sizeof expected ; ++n)
+	    ops_decrypt_se(&bytewise,out2+n,expected+n,1);
+	CU_ASSERT(memcmp(out,out2,sizeof out) == 0);
+	CU_ASSERT(memcmp(crypt.civ,bytewise.civ,crypt.blocksize) == 0);
+	CU_ASSERT(memcmp(crypt.siv,bytewise.siv,crypt.blocksize) == 0);
+	CU_ASSERT(crypt.num == bytewise.num);
+
+	bytewise.decrypt_finish(&bytewise);
+	crypt.decrypt_finish(&crypt);
+	}
+    }
+
+static void test_crypt_backends()
+    {
+    unsigned char plaintext[1000];
+    unsigned char expected[1000];
+    unsigned char out[1000];
+    unsigned char out2[1000];
+    unsigned char iv[OPS_MAX_BLOCK_SIZE];
+    unsigned a;
+    size_t n;
+
+    for(n=0 ; n < sizeof plaintext ; ++n)
+	plaintext[n]=n*31+7;
+    memset(iv,'\0',sizeof iv);
+
+    for(a=0 ; a < sizeof se_algs/sizeof *se_algs ; ++a)
+	{
+	ops_crypt_t low;
+	ops_crypt_t evp;
+	ops_crypt_t clone;
+
+	setup_crypt(&low,se_algs[a],OPS_CRYPT_BACKEND_LOW_LEVEL);
+	setup_crypt(&evp,se_algs[a],OPS_CRYPT_BACKEND_EVP);
+
+	// both backends do the same cipher
+	low.block_encrypt(&low,expected,plaintext);
+	evp.block_encrypt(&evp,out,plaintext);
+	CU_ASSERT(memcmp(out,expected,low.blocksize) == 0);
+	evp.block_decrypt(&evp,out2,out);
+	CU_ASSERT(memcmp(out2,plaintext,low.blocksize) == 0);
+
+	low.cfb_encrypt(&low,expected,plaintext,sizeof plaintext);
+	evp.cfb_encrypt(&evp,out,plaintext,100);
+	evp.cfb_encrypt(&evp,out+100,plaintext+100,sizeof plaintext-100);
+	CU_ASSERT(!evp.failed);
+	CU_ASSERT(memcmp(out,expected,sizeof expected) == 0);
+
+	// and the OpenPGP CFB built on block_encrypt
+	ops_crypt_reset(&evp,iv);
+	ops_encrypt_se(&evp,out,plaintext,sizeof plaintext);
+	CU_ASSERT(memcmp(out,expected,sizeof expected) == 0);
+
+	// a clone part way through carries on from the same place as
+	// the original, without disturbing it
+	evp.set_iv(&evp,iv);
+	evp.cfb_decrypt(&evp,out,expected,300);
+	ops_crypt_clone(&clone,&evp);
+	evp.cfb_decrypt(&evp,out+300,expected+300,sizeof expected-300);
+	clone.cfb_decrypt(&clone,out2,expected+300,sizeof expected-300);
+	CU_ASSERT(memcmp(out,plaintext,sizeof plaintext) == 0);
+	CU_ASSERT(memcmp(out2,plaintext+300,sizeof plaintext-300) == 0);
+
+	// and can be started again
+	ops_crypt_reset(&clone,iv);
+	clone.cfb_decrypt(&clone,out2,expected,sizeof expected);
+	CU_ASSERT(!clone.failed);
+	CU_ASSERT(memcmp(out2,plaintext,sizeof plaintext) == 0);
+
+	clone.decrypt_finish(&clone);
+	evp.decrypt_finish(&evp);
+	low.decrypt_finish(&low);
+	}
+    }
+
 static void test_dsa_verify()
     {
     // This test currently just tests my understanding of how openssl/DSA
@@ -398,6 +562,13 @@ CU_pSuite suite_crypto()
         return NULL;
 #endif  // ndef OPENSSL_NO_CAMELLIA
 
+    if (NULL == CU_add_test(suite, "Test SE CFB", test_se_cfb))
+        return NULL;
+
+    if (NULL == CU_add_test(suite, "Test EVP and low level backends",
+			    test_crypt_backends))
+        return NULL;
+
     if (NULL == CU_add_test(suite, "Test DSA Verify", test_dsa_verify))
         return NULL;
 
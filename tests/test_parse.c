@@ -0,0 +1,2226 @@
+/*
+ * Copyright (c) 2005-2008 Nominet UK (www.nic.uk)
+ * All rights reserved.
+ * Contributors: Ben Laurie, Rachel Willmer. The Contributors have asserted
+ * their moral rights under the UK Copyright Design and Patents Act 1988 to
+ * be recorded as the authors of this copyright work.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "CUnit/Basic.h"
+
+#include <zlib.h>
+
+#include <openpgpsdk/types.h>
+#include <openpgpsdk/packet-parse.h>
+#include <openpgpsdk/readerwriter.h>
+#include <openpgpsdk/memory.h>
+#include <openpgpsdk/errors.h>
+#include <openpgpsdk/util.h>
+#include <openpgpsdk/armour.h>
+#include <openpgpsdk/create.h>
+#include <openpgpsdk/compress.h>
+#include <openpgpsdk/crypto.h>
+#include <openpgpsdk/streamwriter.h>
+#include <openpgpsdk/keyring.h>
+#include <openpgpsdk/accumulate.h>
+#include <openpgpsdk/defs.h>
+#include <openpgpsdk/signature.h>
+#include <openpgpsdk/validate.h>
+#include "../src/lib/parse_local.h"
+#include "../src/lib/keyring_local.h"
+
+#include "tests.h"
+
+/*
+ * Parse Suite: reading packets in the less usual shapes.
+ */
+
+static int init_suite_parse(void)
+    {
+    ops_init();
+    return 0;
+    }
+
+static int clean_suite_parse(void)
+    {
+    ops_finish();
+    return 0;
+    }
+
+/* The body of a binary literal data packet with no filename or date */
+static void add_literal_header(ops_memory_t *mem)
+    {
+    static const unsigned char header[]={ 'b',0,0,0,0,0 };
+
+    ops_memory_add(mem,header,sizeof header);
+    }
+
+static void add_byte(ops_memory_t *mem,unsigned char c)
+    {
+    ops_memory_add(mem,&c,1);
+    }
+
+static void add_text(ops_memory_t *mem,unsigned length)
+    {
+    unsigned n;
+
+    for(n=0 ; n < length ; ++n)
+	add_byte(mem,'a'+n%26);
+    }
+
+/*
+ * Parse in, which is freed, collecting the literal data into *out
+ * if out is not NULL. Returns what ops_parse() returned; the codes of
+ * the errors seen are put in errors, 0 terminated.
+ */
+static int parse_literal(ops_memory_t *in,ops_memory_t **out,
+			 ops_errcode_t *errors,unsigned nerrors)
+    {
+    ops_parse_info_t *pinfo;
+    ops_memory_t *mem_out;
+    ops_error_t *error;
+    int rtn;
+
+    ops_setup_memory_read(&pinfo,in,NULL,callback_literal_data,ops_false);
+    ops_setup_memory_write(&pinfo->cbinfo.cinfo,&mem_out,128);
+    ops_parse_options(pinfo,OPS_PTAG_SS_ALL,OPS_PARSE_PARSED);
+
+    rtn=ops_parse(pinfo);
+
+    for(error=ops_parse_info_get_errors(pinfo) ; error && nerrors > 1 ;
+	error=error->next,--nerrors)
+	*errors++=error->errcode;
+    *errors=0;
+
+    if(out)
+	{
+	*out=ops_memory_new();
+	ops_memory_add(*out,ops_memory_get_data(mem_out),
+		       ops_memory_get_length(mem_out));
+	}
+
+    ops_teardown_memory_write(pinfo->cbinfo.cinfo,mem_out);
+    ops_teardown_memory_read(pinfo,in);
+    return rtn;
+    }
+
+static ops_boolean_t errors_include(const ops_errcode_t *errors,
+				    ops_errcode_t code)
+    {
+    for( ; *errors ; ++errors)
+	if(*errors == code)
+	    return ops_true;
+    return ops_false;
+    }
+
+/* Checks the raw packets given with OPS_PARSER_PACKET_END */
+typedef struct
+    {
+    const unsigned char *data; /*!< what the packets should hold */
+    size_t offset;
+    unsigned packets;
+    unsigned borrowed; /*!< how many were in place */
+    } packet_check_t;
+
+static ops_parse_cb_return_t
+callback_packet_end(const ops_parser_content_t *content_,
+		    ops_parse_cb_info_t *cbinfo)
+    {
+    packet_check_t *check=ops_parse_cb_get_arg(cbinfo);
+    const ops_packet_t *packet=&content_->content.packet;
+
+    if(content_->tag != OPS_PARSER_PACKET_END)
+	return OPS_RELEASE_MEMORY;
+
+    CU_ASSERT(memcmp(packet->raw,check->data+check->offset,packet->length)
+	      == 0);
+    check->offset+=packet->length;
+    ++check->packets;
+    if(packet->borrowed)
+	++check->borrowed;
+
+    return OPS_RELEASE_MEMORY;
+    }
+
+static void read_packets(int fd,ops_boolean_t map,packet_check_t *check)
+    {
+    ops_parse_info_t *pinfo=ops_parse_info_new();
+
+    lseek(fd,0,SEEK_SET);
+    ops_parse_cb_set(pinfo,callback_packet_end,check);
+    if(map)
+	ops_reader_set_mmap(pinfo,fd);
+    else
+	ops_reader_set_fd_buffered(pinfo,fd,0,ops_true);
+    ops_reader_set_accumulate(pinfo,ops_true);
+    CU_ASSERT(ops_parse(pinfo) == 1);
+    ops_parse_info_delete(pinfo);
+    }
+
+static void test_mmap_borrow()
+    {
+    ops_memory_t *in=ops_memory_new();
+    packet_check_t check;
+    FILE *file=tmpfile();
+    size_t length;
+
+    add_byte(in,0xc0|OPS_PTAG_CT_LITERAL_DATA);
+    add_byte(in,6+100);
+    add_literal_header(in);
+    add_text(in,100);
+
+    add_byte(in,0xc0|OPS_PTAG_CT_USER_ID);
+    add_byte(in,10);
+    add_text(in,10);
+
+    add_byte(in,0xc0|OPS_PTAG_CT_LITERAL_DATA);
+    add_byte(in,192+((6+1000-192) >> 8));
+    add_byte(in,(6+1000-192)&0xff);
+    add_literal_header(in);
+    add_text(in,1000);
+
+    length=ops_memory_get_length(in);
+    CU_ASSERT_FATAL(file != NULL);
+    CU_ASSERT(fwrite(ops_memory_get_data(in),1,length,file) == length);
+    fflush(file);
+
+    // mapped, every packet is handed over where it lies
+    memset(&check,'\0',sizeof check);
+    check.data=ops_memory_get_data(in);
+    read_packets(fileno(file),ops_true,&check);
+    CU_ASSERT(check.packets == 3);
+    CU_ASSERT(check.borrowed == 3);
+    CU_ASSERT(check.offset == length);
+
+    // read, the same packets are copies
+    memset(&check,'\0',sizeof check);
+    check.data=ops_memory_get_data(in);
+    read_packets(fileno(file),ops_false,&check);
+    CU_ASSERT(check.packets == 3);
+    CU_ASSERT(check.borrowed == 0);
+    CU_ASSERT(check.offset == length);
+
+    fclose(file);
+    ops_memory_free(in);
+    }
+
+/* Validate mem, which is freed, against the one key in keydata */
+static ops_boolean_t validate_signed(ops_memory_t *mem,
+				     const ops_keydata_t *keydata,
+				     unsigned *valid,unsigned *invalid)
+    {
+    ops_validate_result_t *result=ops_mallocz(sizeof *result);
+    ops_keyring_t keyring;
+    ops_boolean_t rtn;
+
+    memset(&keyring,'\0',sizeof keyring);
+    keyring.nkeys=1;
+    keyring.keys=(ops_keydata_t *)keydata;
+
+    rtn=ops_validate_mem(result,mem,ops_false,&keyring);
+    *valid=result->valid_count;
+    *invalid=result->invalid_count;
+    ops_validate_result_free(result);
+    return rtn;
+    }
+
+static void test_one_pass_chunks()
+    {
+    ops_user_id_t uid;
+    ops_keydata_t *keydata;
+    ops_memory_t *text=ops_memory_new();
+    ops_memory_t *signed_mem;
+    ops_memory_t *tampered;
+    unsigned char *data;
+    unsigned valid,invalid;
+
+    uid.user_id=(unsigned char *)"Chunks <chunks@nowhere.com>";
+    keydata=ops_rsa_create_selfsigned_keypair(1024,65537,&uid);
+    CU_ASSERT_FATAL(keydata != NULL);
+
+    // many times the literal chunk size, so that the one-pass
+    // signature's hash is fed a chunk at a time
+    add_text(text,100000);
+    signed_mem=ops_sign_buf(ops_memory_get_data(text),100000,OPS_SIG_BINARY,
+			    ops_get_secret_key_from_data(keydata),ops_false,
+			    ops_true);
+    CU_ASSERT_FATAL(signed_mem != NULL);
+
+    tampered=ops_memory_new();
+    ops_memory_add(tampered,ops_memory_get_data(signed_mem),
+		   ops_memory_get_length(signed_mem));
+    data=ops_memory_get_data(tampered);
+    data[50000]^=1;
+
+    CU_ASSERT(validate_signed(signed_mem,keydata,&valid,&invalid));
+    CU_ASSERT(valid == 1 && invalid == 0);
+
+    // a change in any chunk is noticed
+    CU_ASSERT(!validate_signed(tampered,keydata,&valid,&invalid));
+    CU_ASSERT(valid == 0 && invalid == 1);
+
+    ops_memory_free(text);
+    ops_keydata_free(keydata);
+    }
+
+static void test_partial_chained()
+    {
+    ops_memory_t *in=ops_memory_new();
+    ops_memory_t *expected=ops_memory_new();
+    ops_memory_t *out;
+    ops_errcode_t errors[10];
+
+    // 512 byte chunk, then 2, then a final one of 100
+    add_byte(in,0xc0|OPS_PTAG_CT_LITERAL_DATA);
+    add_byte(in,0xe0|9);
+    add_literal_header(in);
+    add_text(in,512-6);
+    add_byte(in,0xe0|1);
+    add_text(in,2);
+    add_byte(in,100);
+    add_text(in,100);
+
+    add_text(expected,512-6);
+    add_text(expected,2);
+    add_text(expected,100);
+
+    CU_ASSERT(parse_literal(in,&out,errors,10) == 1);
+    CU_ASSERT(errors[0] == 0);
+    CU_ASSERT(ops_memory_get_length(out) == ops_memory_get_length(expected));
+    CU_ASSERT(memcmp(ops_memory_get_data(out),ops_memory_get_data(expected),
+		     ops_memory_get_length(expected)) == 0);
+
+    ops_memory_free(out);
+    ops_memory_free(expected);
+    }
+
+static void test_partial_zero_final()
+    {
+    ops_memory_t *in=ops_memory_new();
+    ops_memory_t *out;
+    ops_errcode_t errors[10];
+
+    // a whole number of partial chunks, ended by an empty one, and a
+    // second packet after it to show the end was found
+    add_byte(in,0xc0|OPS_PTAG_CT_LITERAL_DATA);
+    add_byte(in,0xe0|9);
+    add_literal_header(in);
+    add_text(in,512-6);
+    add_byte(in,0);
+
+    add_byte(in,0xc0|OPS_PTAG_CT_LITERAL_DATA);
+    add_byte(in,6+3);
+    add_literal_header(in);
+    add_text(in,3);
+
+    CU_ASSERT(parse_literal(in,&out,errors,10) == 1);
+    CU_ASSERT(errors[0] == 0);
+    CU_ASSERT(ops_memory_get_length(out) == 512-6+3);
+
+    ops_memory_free(out);
+    }
+
+static void test_partial_disallowed()
+    {
+    ops_memory_t *in=ops_memory_new();
+    ops_errcode_t errors[10];
+
+    // a User ID may not have a partial length
+    add_byte(in,0xc0|OPS_PTAG_CT_USER_ID);
+    add_byte(in,0xe0|0);
+    add_text(in,1);
+    add_byte(in,0);
+
+    CU_ASSERT(parse_literal(in,NULL,errors,10) == 0);
+    CU_ASSERT(errors_include(errors,OPS_E_P_BAD_PARTIAL_LENGTH));
+    }
+
+static void test_partial_truncated()
+    {
+    ops_memory_t *in=ops_memory_new();
+    ops_errcode_t errors[10];
+
+    // the first chunk is cut short
+    add_byte(in,0xc0|OPS_PTAG_CT_LITERAL_DATA);
+    add_byte(in,0xe0|9);
+    add_literal_header(in);
+    add_text(in,100);
+
+    CU_ASSERT(parse_literal(in,NULL,errors,10) == 0);
+    CU_ASSERT(errors_include(errors,OPS_E_R_EARLY_EOF));
+
+    // the length of the next chunk is missing
+    in=ops_memory_new();
+    add_byte(in,0xc0|OPS_PTAG_CT_LITERAL_DATA);
+    add_byte(in,0xe0|9);
+    add_literal_header(in);
+    add_text(in,512-6);
+
+    CU_ASSERT(parse_literal(in,NULL,errors,10) == 0);
+    CU_ASSERT(errors_include(errors,OPS_E_R_EARLY_EOF));
+    }
+
+/* A base reader with no spans, giving one byte per read */
+typedef struct
+    {
+    const unsigned char *data;
+    size_t length;
+    size_t offset;
+    } trickle_arg_t;
+
+static int trickle_reader(void *dest,size_t length,ops_error_t **errors,
+			  ops_reader_info_t *rinfo,ops_parse_cb_info_t *cbinfo)
+    {
+    trickle_arg_t *arg=ops_reader_get_arg(rinfo);
+
+    OPS_USED(errors);
+    OPS_USED(cbinfo);
+    if(arg->offset == arg->length || length == 0)
+	return 0;
+    *(unsigned char *)dest=arg->data[arg->offset++];
+    return 1;
+    }
+
+/*
+ * Dearmour and parse in, collecting the literal data into *out,
+ * through either the memory reader, which has spans, or one that only
+ * reads a byte at a time. Returns what ops_parse() returned.
+ */
+static int dearmour_literal(ops_memory_t *in,ops_boolean_t span,
+			    ops_memory_t **out)
+    {
+    ops_parse_info_t *pinfo=ops_parse_info_new();
+    ops_memory_t *mem_out;
+    trickle_arg_t arg;
+    int rtn;
+
+    ops_parse_cb_set(pinfo,callback_literal_data,NULL);
+    if(span)
+	ops_reader_set_memory(pinfo,ops_memory_get_data(in),
+			      ops_memory_get_length(in));
+    else
+	{
+	arg.data=ops_memory_get_data(in);
+	arg.length=ops_memory_get_length(in);
+	arg.offset=0;
+	ops_reader_set(pinfo,trickle_reader,NULL,&arg);
+	}
+    CU_ASSERT(ops_reader_has_span(pinfo) == span);
+    ops_reader_push_dearmour(pinfo);
+    ops_setup_memory_write(&pinfo->cbinfo.cinfo,&mem_out,128);
+
+    rtn=ops_parse(pinfo);
+    *out=ops_memory_new();
+    ops_memory_add(*out,ops_memory_get_data(mem_out),
+		   ops_memory_get_length(mem_out));
+
+    ops_reader_pop_dearmour(pinfo);
+    ops_teardown_memory_write(pinfo->cbinfo.cinfo,mem_out);
+    ops_parse_info_delete(pinfo);
+    return rtn;
+    }
+
+static void test_span_reads()
+    {
+    ops_memory_t *in=ops_memory_new();
+    ops_memory_t *armoured;
+    ops_memory_t *expected=ops_memory_new();
+    ops_memory_t *out;
+    ops_create_info_t *cinfo;
+    unsigned n;
+
+    // partial chunks, so the spans also pass through the partial
+    // body reader under the armour
+    add_byte(in,0xc0|OPS_PTAG_CT_LITERAL_DATA);
+    add_byte(in,0xe0|12);
+    add_literal_header(in);
+    add_text(in,4096-6);
+    add_text(expected,4096-6);
+    for(n=0 ; n < 4 ; ++n)
+	{
+	add_byte(in,0xe0|10);
+	add_text(in,1024);
+	add_text(expected,1024);
+	}
+    add_byte(in,192+((3000-192) >> 8));
+    add_byte(in,(3000-192)&0xff);
+    add_text(in,3000);
+    add_text(expected,3000);
+
+    ops_setup_memory_write(&cinfo,&armoured,ops_memory_get_length(in));
+    ops_writer_push_armoured_message(cinfo);
+    CU_ASSERT(ops_write(ops_memory_get_data(in),ops_memory_get_length(in),
+			cinfo));
+    CU_ASSERT(ops_writer_close(cinfo));
+    ops_create_info_delete(cinfo);
+    ops_memory_free(in);
+
+    CU_ASSERT(dearmour_literal(armoured,ops_true,&out) == 1);
+    CU_ASSERT(ops_memory_get_length(out) == ops_memory_get_length(expected));
+    CU_ASSERT(memcmp(ops_memory_get_data(out),ops_memory_get_data(expected),
+		     ops_memory_get_length(expected)) == 0);
+    ops_memory_free(out);
+
+    // the same data a byte at a time, without spans
+    CU_ASSERT(dearmour_literal(armoured,ops_false,&out) == 1);
+    CU_ASSERT(ops_memory_get_length(out) == ops_memory_get_length(expected));
+    CU_ASSERT(memcmp(ops_memory_get_data(out),ops_memory_get_data(expected),
+		     ops_memory_get_length(expected)) == 0);
+    ops_memory_free(out);
+
+    ops_memory_free(armoured);
+    ops_memory_free(expected);
+    }
+
+/*
+ * Copy armoured, rewrapping its base64 into lines of 1, 2, 3 ...
+ * characters, ended with CRLF, so that groups of four are split
+ * across lines in every way.
+ */
+static ops_memory_t *rewrap_armour(ops_memory_t *armoured)
+    {
+    const char *data=ops_memory_get_data(armoured);
+    const char *begin=strstr(data,"\r\n\r\n");
+    const char *end=strstr(data,"\r\n=");
+    ops_memory_t *out=ops_memory_new();
+    unsigned line=0,width=1;
+
+    CU_ASSERT_FATAL(begin != NULL && end != NULL);
+    begin+=4;
+    ops_memory_add(out,(const unsigned char *)data,begin-data);
+    for( ; begin < end ; ++begin)
+	{
+	if(*begin == '\r' || *begin == '\n')
+	    continue;
+	add_byte(out,*begin);
+	if(++line == width)
+	    {
+	    ops_memory_add(out,(const unsigned char *)"\r\n",2);
+	    line=0;
+	    width=width%70+1;
+	    }
+	}
+    if(line)
+	ops_memory_add(out,(const unsigned char *)"\r\n",2);
+    ops_memory_add(out,(const unsigned char *)end+2,
+		   ops_memory_get_length(armoured)-(end+2-data));
+
+    return out;
+    }
+
+static void test_base64_lines()
+    {
+    ops_memory_t *in=ops_memory_new();
+    ops_memory_t *armoured;
+    ops_memory_t *rewrapped;
+    ops_memory_t *expected=ops_memory_new();
+    ops_memory_t *out;
+    ops_create_info_t *cinfo;
+    unsigned char *data;
+
+    // a multiple of three long, so that there is no padding to keep
+    // off the start of a line
+    add_byte(in,0xc0|OPS_PTAG_CT_LITERAL_DATA);
+    add_byte(in,192+((6+5001-192) >> 8));
+    add_byte(in,(6+5001-192)&0xff);
+    add_literal_header(in);
+    add_text(in,5001);
+    add_text(expected,5001);
+    CU_ASSERT(ops_memory_get_length(in)%3 == 0);
+
+    ops_setup_memory_write(&cinfo,&armoured,ops_memory_get_length(in));
+    ops_writer_push_armoured_message(cinfo);
+    CU_ASSERT(ops_write(ops_memory_get_data(in),ops_memory_get_length(in),
+			cinfo));
+    CU_ASSERT(ops_writer_close(cinfo));
+    ops_create_info_delete(cinfo);
+    ops_memory_free(in);
+    add_byte(armoured,0);
+    rewrapped=rewrap_armour(armoured);
+    ops_memory_free(armoured);
+
+    CU_ASSERT(dearmour_literal(rewrapped,ops_true,&out) == 1);
+    CU_ASSERT(ops_memory_get_length(out) == ops_memory_get_length(expected));
+    CU_ASSERT(memcmp(ops_memory_get_data(out),ops_memory_get_data(expected),
+		     ops_memory_get_length(expected)) == 0);
+    ops_memory_free(out);
+
+    CU_ASSERT(dearmour_literal(rewrapped,ops_false,&out) == 1);
+    CU_ASSERT(ops_memory_get_length(out) == ops_memory_get_length(expected));
+    CU_ASSERT(memcmp(ops_memory_get_data(out),ops_memory_get_data(expected),
+		     ops_memory_get_length(expected)) == 0);
+    ops_memory_free(out);
+
+    // a changed character in the middle fails the checksum
+    data=ops_memory_get_data(rewrapped);
+    data=(unsigned char *)strstr((char *)data,"\r\n\r\n")+4+3000;
+    while(*data == '\r' || *data == '\n')
+	++data;
+    *data=*data == 'A' ? 'B' : 'A';
+    CU_ASSERT(dearmour_literal(rewrapped,ops_true,&out) == 0);
+    ops_memory_free(out);
+    CU_ASSERT(dearmour_literal(rewrapped,ops_false,&out) == 0);
+    ops_memory_free(out);
+
+    ops_memory_free(rewrapped);
+    ops_memory_free(expected);
+    }
+
+/* Clearsign text, writing it chunk bytes at a time */
+static ops_memory_t *clearsign(const char *text,size_t chunk,
+			       const ops_secret_key_t *skey)
+    {
+    ops_create_signature_t *sig=ops_create_signature_new();
+    ops_create_info_t *cinfo;
+    ops_memory_t *mem;
+    unsigned char keyid[OPS_KEY_ID_SIZE];
+    size_t length=strlen(text);
+    size_t offset;
+
+    ops_signature_start_cleartext_signature(sig,skey,OPS_HASH_SHA1,
+					    OPS_SIG_BINARY);
+    ops_setup_memory_write(&cinfo,&mem,length);
+    CU_ASSERT(ops_writer_push_clearsigned(cinfo,sig));
+    for(offset=0 ; offset < length ; offset+=chunk)
+	CU_ASSERT(ops_write(text+offset,
+			    length-offset < chunk ? length-offset : chunk,
+			    cinfo));
+    CU_ASSERT(ops_writer_switch_to_armoured_signature(cinfo));
+
+    // a fixed time, so that the same text gives the same signature
+    ops_keyid(keyid,&skey->public_key);
+    CU_ASSERT(ops_signature_add_creation_time(sig,1000000000));
+    CU_ASSERT(ops_signature_add_issuer_key_id(sig,keyid));
+    CU_ASSERT(ops_signature_hashed_subpackets_end(sig));
+    CU_ASSERT(ops_write_signature(sig,&skey->public_key,skey,cinfo));
+    CU_ASSERT(ops_writer_close(cinfo));
+
+    ops_create_info_delete(cinfo);
+    ops_create_signature_delete(sig);
+    return mem;
+    }
+
+static ops_boolean_t memory_equal(ops_memory_t *a,ops_memory_t *b)
+    {
+    return ops_memory_get_length(a) == ops_memory_get_length(b)
+	&& memcmp(ops_memory_get_data(a),ops_memory_get_data(b),
+		  ops_memory_get_length(a)) == 0;
+    }
+
+/* A NUL terminated copy of mem, to be freed */
+static char *memory_string(ops_memory_t *mem)
+    {
+    size_t length=ops_memory_get_length(mem);
+    char *string=ops_mallocz(length+1);
+
+    memcpy(string,ops_memory_get_data(mem),length);
+    return string;
+    }
+
+/* Checks a cleartext signature against the dearmour reader's hash */
+typedef struct
+    {
+    const ops_public_key_t *key;
+    ops_hash_t *hash; /*!< from the trailer */
+    unsigned valid;
+    unsigned invalid;
+    } cleartext_check_t;
+
+static ops_parse_cb_return_t
+callback_cleartext(const ops_parser_content_t *content_,
+		   ops_parse_cb_info_t *cbinfo)
+    {
+    cleartext_check_t *check=ops_parse_cb_get_arg(cbinfo);
+    const ops_signature_info_t *info;
+
+    switch(content_->tag)
+	{
+    case OPS_PTAG_CT_SIGNED_CLEARTEXT_TRAILER:
+	check->hash=content_->content.signed_cleartext_trailer.hash;
+	return OPS_KEEP_MEMORY;
+
+    case OPS_PTAG_CT_SIGNATURE_FOOTER:
+	CU_ASSERT_FATAL(check->hash != NULL);
+	// ops_check_hash_signature() leaves the hashed subpackets to us
+	info=&content_->content.signature.info;
+	check->hash->add(check->hash,info->v4_hashed_data,
+			 info->v4_hashed_data_length);
+	if(ops_check_hash_signature(check->hash,&content_->content.signature,
+				    check->key))
+	    ++check->valid;
+	else
+	    ++check->invalid;
+	free(check->hash);
+	check->hash=NULL;
+	break;
+
+    default:
+	break;
+	}
+
+    return OPS_RELEASE_MEMORY;
+    }
+
+/* Check the signature on the clearsigned mem, which is freed */
+static void check_cleartext(ops_memory_t *mem,const ops_public_key_t *key,
+			    unsigned *valid,unsigned *invalid)
+    {
+    ops_parse_info_t *pinfo;
+    cleartext_check_t check;
+
+    memset(&check,'\0',sizeof check);
+    check.key=key;
+    ops_setup_memory_read(&pinfo,mem,&check,callback_cleartext,ops_true);
+    ops_reader_push_dearmour(pinfo);
+    ops_parse(pinfo);
+    ops_reader_pop_dearmour(pinfo);
+    ops_teardown_memory_read(pinfo,mem);
+
+    *valid=check.valid;
+    *invalid=check.invalid;
+    }
+
+static void test_cleartext_lines()
+    {
+    static const char text[]=
+	"-dash at the start\n"
+	"From the start\n"
+	"trailing whitespace \t \n"
+	"a CR\rin the middle\r\n"
+	"--\n"
+	"\n"
+	"- already escaped\r\n"
+	"no newline at the end";
+    // the reader keeps trailing whitespace in the hash and drops lone
+    // CRs, so signatures are checked on plainer text
+    static const char plain[]=
+	"-dash at the start\n"
+	"--\n"
+	"\n"
+	"- already escaped\r\n"
+	"in the middle\n"
+	"no newline at the end";
+    ops_user_id_t uid;
+    ops_keydata_t *keydata;
+    const ops_secret_key_t *skey;
+    ops_memory_t *whole;
+    ops_memory_t *bytes;
+    ops_memory_t *sevens;
+    unsigned char *data;
+    char *string;
+    unsigned valid,invalid;
+
+    uid.user_id=(unsigned char *)"Cleartext <cleartext@nowhere.com>";
+    keydata=ops_rsa_create_selfsigned_keypair(1024,65537,&uid);
+    CU_ASSERT_FATAL(keydata != NULL);
+    skey=ops_get_secret_key_from_data(keydata);
+
+    // however the text is split up, the output is the same
+    whole=clearsign(text,sizeof text-1,skey);
+    bytes=clearsign(text,1,skey);
+    sevens=clearsign(text,7,skey);
+    CU_ASSERT(memory_equal(whole,bytes));
+    CU_ASSERT(memory_equal(whole,sevens));
+
+    string=memory_string(whole);
+    CU_ASSERT(strstr(string,"\n- -dash at the start\r\n") != NULL);
+    CU_ASSERT(strstr(string,"\ntrailing whitespace \t \r\n") != NULL);
+    CU_ASSERT(strstr(string,"\na CR\rin the middle\r\n") != NULL);
+    CU_ASSERT(strstr(string,"\n- --\r\n") != NULL);
+    CU_ASSERT(strstr(string,"\n- - already escaped\r\n") != NULL);
+    free(string);
+    ops_memory_free(whole);
+    ops_memory_free(bytes);
+    ops_memory_free(sevens);
+
+    whole=clearsign(plain,sizeof plain-1,skey);
+    bytes=clearsign(plain,1,skey);
+    CU_ASSERT(memory_equal(whole,bytes));
+
+    check_cleartext(whole,&skey->public_key,&valid,&invalid);
+    CU_ASSERT(valid == 1 && invalid == 0);
+
+    // a change in the text is noticed
+    string=memory_string(bytes);
+    CU_ASSERT_FATAL(strstr(string,"middle") != NULL);
+    data=ops_memory_get_data(bytes);
+    data[strstr(string,"middle")-string]='M';
+    free(string);
+    check_cleartext(bytes,&skey->public_key,&valid,&invalid);
+    CU_ASSERT(valid == 0 && invalid == 1);
+
+    ops_keydata_free(keydata);
+    }
+
+/* What came back from a parse with some packets raw or ignored */
+typedef struct
+    {
+    ops_memory_t *raw; /*!< the raw bodies, run together */
+    unsigned raw_packets; /*!< how many raw chunks */
+    unsigned ptags;
+    unsigned literals; /*!< parsed literal data headers */
+    unsigned user_ids; /*!< parsed user ids */
+    } options_check_t;
+
+static ops_parse_cb_return_t
+callback_options(const ops_parser_content_t *content_,
+		 ops_parse_cb_info_t *cbinfo)
+    {
+    options_check_t *check=ops_parse_cb_get_arg(cbinfo);
+    const ops_packet_t *packet=&content_->content.packet;
+
+    switch(content_->tag)
+	{
+    case OPS_PARSER_PTAG:
+	++check->ptags;
+	break;
+
+    case OPS_PTAG_RAW_PACKET:
+	ops_memory_add(check->raw,packet->raw,packet->length);
+	++check->raw_packets;
+	break;
+
+    case OPS_PTAG_CT_LITERAL_DATA_HEADER:
+	++check->literals;
+	break;
+
+    case OPS_PTAG_CT_USER_ID:
+	++check->user_ids;
+	break;
+
+    default:
+	break;
+	}
+
+    return OPS_RELEASE_MEMORY;
+    }
+
+static void test_packet_options()
+    {
+    ops_memory_t *in=ops_memory_new();
+    ops_memory_t *expected=ops_memory_new();
+    ops_parse_info_t *pinfo;
+    options_check_t check;
+
+    add_byte(in,0xc0|OPS_PTAG_CT_LITERAL_DATA);
+    add_byte(in,6+100);
+    add_literal_header(in);
+    add_text(in,100);
+    add_literal_header(expected);
+    add_text(expected,100);
+
+    // a whole number of 8192 byte steps, which used to skip forever
+    add_byte(in,0xc0|OPS_PTAG_CT_USER_ID);
+    add_byte(in,0xff);
+    add_byte(in,0);
+    add_byte(in,0);
+    add_byte(in,16384 >> 8);
+    add_byte(in,0);
+    add_text(in,16384);
+
+    add_byte(in,0xc0|OPS_PTAG_CT_USER_ID);
+    add_byte(in,10);
+    add_text(in,10);
+
+    // a partial body comes in chunks
+    add_byte(in,0xc0|OPS_PTAG_CT_LITERAL_DATA);
+    add_byte(in,0xe0|9);
+    add_literal_header(in);
+    add_text(in,512-6);
+    add_byte(in,100);
+    add_text(in,100);
+    add_literal_header(expected);
+    add_text(expected,512-6);
+    add_text(expected,100);
+
+    memset(&check,'\0',sizeof check);
+    check.raw=ops_memory_new();
+    ops_setup_memory_read(&pinfo,in,&check,callback_options,ops_false);
+    ops_parse_options(pinfo,OPS_PTAG_CT_LITERAL_DATA,OPS_PARSE_RAW);
+    ops_parse_options(pinfo,OPS_PTAG_CT_USER_ID,OPS_PARSE_IGNORE);
+
+    CU_ASSERT(ops_parse(pinfo) == 1);
+    CU_ASSERT(ops_parse_info_get_errors(pinfo) == NULL);
+    CU_ASSERT(check.ptags == 4);
+    CU_ASSERT(check.literals == 0);
+    CU_ASSERT(check.user_ids == 0);
+    CU_ASSERT(check.raw_packets >= 2);
+    CU_ASSERT(ops_memory_get_length(check.raw)
+	      == ops_memory_get_length(expected));
+    CU_ASSERT(memcmp(ops_memory_get_data(check.raw),
+		     ops_memory_get_data(expected),
+		     ops_memory_get_length(expected)) == 0);
+    ops_teardown_memory_read(pinfo,in);
+    ops_memory_free(check.raw);
+
+    // parsed by default
+    in=ops_memory_new();
+    add_byte(in,0xc0|OPS_PTAG_CT_USER_ID);
+    add_byte(in,10);
+    add_text(in,10);
+
+    memset(&check,'\0',sizeof check);
+    check.raw=ops_memory_new();
+    ops_setup_memory_read(&pinfo,in,&check,callback_options,ops_false);
+    CU_ASSERT(ops_parse(pinfo) == 1);
+    CU_ASSERT(check.ptags == 1);
+    CU_ASSERT(check.user_ids == 1);
+    CU_ASSERT(check.raw_packets == 0);
+    ops_teardown_memory_read(pinfo,in);
+    ops_memory_free(check.raw);
+
+    ops_memory_free(expected);
+    }
+
+/*
+ * Feed in to a parser length bytes at a time, collecting the literal
+ * data into *out. Returns what ops_parse_finish() returned, and the
+ * last result of ops_parse_feed() in *fed.
+ */
+static int feed_literal(const ops_memory_t *in,size_t length,
+			ops_memory_t **out,ops_parse_feed_t *fed,
+			ops_errcode_t *errors,unsigned nerrors)
+    {
+    ops_parse_info_t *pinfo;
+    ops_memory_t *mem_out;
+    ops_error_t *error;
+    const unsigned char *data=ops_memory_get_data((ops_memory_t *)in);
+    size_t total=ops_memory_get_length(in);
+    size_t offset;
+    int rtn;
+
+    pinfo=ops_parse_info_new();
+    ops_parse_cb_set(pinfo,callback_literal_data,NULL);
+    ops_setup_memory_write(&pinfo->cbinfo.cinfo,&mem_out,128);
+
+    *fed=OPS_PARSE_FEED_NEED_MORE;
+    for(offset=0 ; offset < total ; offset+=length)
+	{
+	size_t n=total-offset < length ? total-offset : length;
+
+	*fed=ops_parse_feed(pinfo,data+offset,n);
+	}
+    rtn=ops_parse_finish(pinfo);
+
+    for(error=ops_parse_info_get_errors(pinfo) ; error && nerrors > 1 ;
+	error=error->next,--nerrors)
+	*errors++=error->errcode;
+    *errors=0;
+
+    *out=ops_memory_new();
+    ops_memory_add(*out,ops_memory_get_data(mem_out),
+		   ops_memory_get_length(mem_out));
+
+    ops_teardown_memory_write(pinfo->cbinfo.cinfo,mem_out);
+    ops_parse_info_delete(pinfo);
+    return rtn;
+    }
+
+static void test_feed_pieces()
+    {
+    ops_memory_t *in=ops_memory_new();
+    ops_memory_t *expected=ops_memory_new();
+    ops_memory_t *out;
+    ops_errcode_t errors[10];
+    ops_parse_feed_t fed;
+    static const size_t lengths[]={ 1, 7, 100, 513, 100000 };
+    unsigned n;
+
+    // partial lengths, then a two byte length, then an old format
+    // packet that runs to the end of the input
+    add_byte(in,0xc0|OPS_PTAG_CT_LITERAL_DATA);
+    add_byte(in,0xe0|9);
+    add_literal_header(in);
+    add_text(in,512-6);
+    add_byte(in,20);
+    add_text(in,20);
+
+    add_byte(in,0xc0|OPS_PTAG_CT_LITERAL_DATA);
+    add_byte(in,192+((6+300-192) >> 8));
+    add_byte(in,(6+300-192)&0xff);
+    add_literal_header(in);
+    add_text(in,300);
+
+    add_byte(in,OPS_PTAG_ALWAYS_SET|(OPS_PTAG_CT_LITERAL_DATA << 2)
+	     |OPS_PTAG_OF_LT_INDETERMINATE);
+    add_literal_header(in);
+    add_text(in,50);
+
+    add_text(expected,512-6);
+    add_text(expected,20);
+    add_text(expected,300);
+    add_text(expected,50);
+
+    for(n=0 ; n < sizeof lengths/sizeof *lengths ; ++n)
+	{
+	CU_ASSERT(feed_literal(in,lengths[n],&out,&fed,errors,10) == 1);
+	CU_ASSERT(fed == OPS_PARSE_FEED_NEED_MORE);
+	CU_ASSERT(errors[0] == 0);
+	CU_ASSERT(ops_memory_get_length(out)
+		  == ops_memory_get_length(expected));
+	CU_ASSERT(memcmp(ops_memory_get_data(out),
+			 ops_memory_get_data(expected),
+			 ops_memory_get_length(expected)) == 0);
+	ops_memory_free(out);
+	}
+
+    ops_memory_free(in);
+    ops_memory_free(expected);
+    }
+
+static void test_feed_truncated()
+    {
+    ops_memory_t *in=ops_memory_new();
+    ops_memory_t *out;
+    ops_errcode_t errors[10];
+    ops_parse_feed_t fed;
+
+    // a whole packet, then one that never finishes arriving
+    add_byte(in,0xc0|OPS_PTAG_CT_LITERAL_DATA);
+    add_byte(in,6+10);
+    add_literal_header(in);
+    add_text(in,10);
+
+    add_byte(in,0xc0|OPS_PTAG_CT_LITERAL_DATA);
+    add_byte(in,6+100);
+    add_literal_header(in);
+    add_text(in,50);
+
+    CU_ASSERT(feed_literal(in,16,&out,&fed,errors,10) == 0);
+    CU_ASSERT(fed == OPS_PARSE_FEED_NEED_MORE);
+    CU_ASSERT(errors_include(errors,OPS_E_R_READ_FAILED));
+    // the first packet was still parsed as soon as it was complete
+    CU_ASSERT(ops_memory_get_length(out) >= 10);
+
+    ops_memory_free(out);
+    ops_memory_free(in);
+    }
+
+static void test_feed_error()
+    {
+    ops_memory_t *in=ops_memory_new();
+    ops_memory_t *out;
+    ops_errcode_t errors[10];
+    ops_parse_feed_t fed;
+
+    // a packet that fails to parse ends the parse, whatever follows
+    add_byte(in,0xc0|OPS_PTAG_CT_USER_ID);
+    add_byte(in,0xe0|0);
+    add_text(in,1);
+    add_byte(in,0);
+
+    add_byte(in,0xc0|OPS_PTAG_CT_LITERAL_DATA);
+    add_byte(in,6+10);
+    add_literal_header(in);
+    add_text(in,10);
+
+    CU_ASSERT(feed_literal(in,3,&out,&fed,errors,10) == 0);
+    CU_ASSERT(fed == OPS_PARSE_FEED_ERROR);
+    CU_ASSERT(errors_include(errors,OPS_E_P_BAD_PARTIAL_LENGTH));
+    CU_ASSERT(ops_memory_get_length(out) == 0);
+
+    ops_memory_free(out);
+    ops_memory_free(in);
+    }
+
+static void test_feed_streams()
+    {
+    ops_memory_t *in=ops_memory_new();
+    ops_memory_t *mem_out;
+    ops_parse_info_t *pinfo;
+    const unsigned char *data;
+
+    // a long packet in partial lengths, only part of which arrives
+    add_byte(in,0xc0|OPS_PTAG_CT_LITERAL_DATA);
+    add_byte(in,0xe0|10);
+    add_literal_header(in);
+    add_text(in,1024-6);
+    add_byte(in,0xe0|10);
+    add_text(in,1024);
+    data=ops_memory_get_data(in);
+
+    pinfo=ops_parse_info_new();
+    ops_parse_cb_set(pinfo,callback_literal_data,NULL);
+    ops_parse_options_literal_chunk_size(pinfo,100);
+    ops_setup_memory_write(&pinfo->cbinfo.cinfo,&mem_out,128);
+
+    // the literal data is passed on as it arrives
+    CU_ASSERT(ops_parse_feed(pinfo,data,2+6+250)
+	      == OPS_PARSE_FEED_NEED_MORE);
+    CU_ASSERT(ops_memory_get_length(mem_out) == 200);
+    CU_ASSERT(ops_parse_feed(pinfo,data+2+6+250,1024)
+	      == OPS_PARSE_FEED_NEED_MORE);
+    CU_ASSERT(ops_memory_get_length(mem_out) == 1200);
+    CU_ASSERT(memcmp(ops_memory_get_data(mem_out),data+2+6,1024-6) == 0);
+
+    // deleting it mid-packet unwinds the parse
+    ops_teardown_memory_write(pinfo->cbinfo.cinfo,mem_out);
+    ops_parse_info_delete(pinfo);
+    ops_memory_free(in);
+    }
+
+static void test_armour_full_buffer()
+    {
+    ops_memory_t *in=ops_memory_new();
+    ops_memory_t *armoured;
+    ops_memory_t *expected=ops_memory_new();
+    ops_memory_t *out;
+    ops_create_info_t *cinfo;
+    ops_parse_info_t *pinfo;
+    const unsigned char *data;
+    const unsigned length=5949+5955;
+
+    // an old format packet with a four byte length, sized so that the
+    // armour's output buffer is full when the checksum is added
+    add_byte(in,OPS_PTAG_ALWAYS_SET|(OPS_PTAG_CT_LITERAL_DATA << 2)
+	     |OPS_PTAG_OF_LT_FOUR_BYTE);
+    add_byte(in,0);
+    add_byte(in,0);
+    add_byte(in,(length-5) >> 8);
+    add_byte(in,(length-5)&0xff);
+    add_literal_header(in);
+    add_text(in,length-5-6);
+    add_text(expected,length-5-6);
+    CU_ASSERT(ops_memory_get_length(in) == length);
+
+    ops_setup_memory_write(&cinfo,&armoured,length);
+    ops_writer_push_armoured_message(cinfo);
+    data=ops_memory_get_data(in);
+    CU_ASSERT(ops_write(data,5949,cinfo));
+    CU_ASSERT(ops_write(data+5949,5955,cinfo));
+    CU_ASSERT(ops_writer_close(cinfo));
+    ops_create_info_delete(cinfo);
+    ops_memory_free(in);
+
+    ops_setup_memory_read(&pinfo,armoured,NULL,callback_literal_data,
+			  ops_false);
+    ops_reader_push_dearmour(pinfo);
+    ops_setup_memory_write(&pinfo->cbinfo.cinfo,&out,128);
+
+    CU_ASSERT(ops_parse(pinfo) == 1);
+    CU_ASSERT(ops_memory_get_length(out) == ops_memory_get_length(expected));
+    CU_ASSERT(memcmp(ops_memory_get_data(out),ops_memory_get_data(expected),
+		     ops_memory_get_length(expected)) == 0);
+
+    ops_reader_pop_dearmour(pinfo);
+    ops_teardown_memory_write(pinfo->cbinfo.cinfo,out);
+    ops_teardown_memory_read(pinfo,armoured);
+    ops_memory_free(expected);
+    }
+
+/* A literal data packet of length bytes, compressed depth times */
+static ops_memory_t *compressed_literal(unsigned length,unsigned depth)
+    {
+    ops_memory_t *text=ops_memory_new();
+    ops_memory_t *mem;
+    ops_create_info_t *cinfo;
+
+    add_text(text,length);
+    ops_setup_memory_write(&cinfo,&mem,length);
+    while(depth--)
+	ops_writer_push_compressed(cinfo);
+    CU_ASSERT(ops_write_literal_data_from_buf(ops_memory_get_data(text),
+					      length,OPS_LDT_BINARY,cinfo));
+    CU_ASSERT(ops_writer_close(cinfo));
+    ops_create_info_delete(cinfo);
+    ops_memory_free(text);
+
+    return mem;
+    }
+
+/*
+ * Parse in, which is freed, with the given decompression limits.
+ * Returns what ops_parse() returned; *length is set to how much
+ * literal data came out, and *limited to whether a limit was hit.
+ */
+static int decompress_literal(ops_memory_t *in,size_t max_bytes,
+			      unsigned max_expansion,unsigned max_depth,
+			      size_t *length,ops_boolean_t *limited)
+    {
+    ops_parse_info_t *pinfo;
+    ops_memory_t *mem_out;
+    int rtn;
+
+    ops_setup_memory_read(&pinfo,in,NULL,callback_literal_data,ops_false);
+    ops_setup_memory_write(&pinfo->cbinfo.cinfo,&mem_out,128);
+    ops_parse_options_decompress_limits(pinfo,max_bytes,max_expansion,
+					max_depth);
+
+    rtn=ops_parse(pinfo);
+    *length=ops_memory_get_length(mem_out);
+    *limited=ops_has_error(ops_parse_info_get_errors(pinfo),
+			   OPS_E_P_DECOMPRESSION_LIMIT);
+
+    ops_teardown_memory_write(pinfo->cbinfo.cinfo,mem_out);
+    ops_teardown_memory_read(pinfo,in);
+    return rtn;
+    }
+
+static void test_decompress_bytes()
+    {
+    size_t length;
+    ops_boolean_t limited;
+
+    CU_ASSERT(decompress_literal(compressed_literal(300000,1),0,0,0,
+				 &length,&limited) == 1);
+    CU_ASSERT(!limited);
+    CU_ASSERT(length == 300000);
+
+    // a limit above what the packet holds is not hit
+    CU_ASSERT(decompress_literal(compressed_literal(300000,1),400000,0,0,
+				 &length,&limited) == 1);
+    CU_ASSERT(!limited);
+    CU_ASSERT(length == 300000);
+
+    CU_ASSERT(decompress_literal(compressed_literal(300000,1),100000,0,0,
+				 &length,&limited) == 0);
+    CU_ASSERT(limited);
+    CU_ASSERT(length < 300000);
+    }
+
+static void test_decompress_ratio()
+    {
+    size_t length;
+    ops_boolean_t limited;
+
+    // repeated text compresses by far more than 10 times
+    CU_ASSERT(decompress_literal(compressed_literal(300000,1),0,10,0,
+				 &length,&limited) == 0);
+    CU_ASSERT(limited);
+    CU_ASSERT(length < 300000);
+
+    CU_ASSERT(decompress_literal(compressed_literal(300000,1),0,1000000,0,
+				 &length,&limited) == 1);
+    CU_ASSERT(!limited);
+    CU_ASSERT(length == 300000);
+
+    // anything up to the allowance is let through
+    CU_ASSERT(decompress_literal(compressed_literal(30000,1),0,10,0,
+				 &length,&limited) == 1);
+    CU_ASSERT(!limited);
+    CU_ASSERT(length == 30000);
+    }
+
+static void test_decompress_depth()
+    {
+    size_t length;
+    ops_boolean_t limited;
+
+    CU_ASSERT(decompress_literal(compressed_literal(1000,2),0,0,2,
+				 &length,&limited) == 1);
+    CU_ASSERT(!limited);
+    CU_ASSERT(length == 1000);
+
+    CU_ASSERT(decompress_literal(compressed_literal(1000,3),0,0,2,
+				 &length,&limited) == 0);
+    CU_ASSERT(limited);
+    CU_ASSERT(length == 0);
+    }
+
+/* The body of the compressed data packet in packet, which is freed */
+static ops_memory_t *compressed_body(ops_memory_t *packet)
+    {
+    ops_parse_info_t *pinfo;
+    options_check_t check;
+
+    memset(&check,'\0',sizeof check);
+    check.raw=ops_memory_new();
+    ops_setup_memory_read(&pinfo,packet,&check,callback_options,ops_false);
+    ops_parse_options(pinfo,OPS_PTAG_CT_COMPRESSED,OPS_PARSE_RAW);
+    CU_ASSERT(ops_parse(pinfo) == 1);
+    ops_teardown_memory_read(pinfo,packet);
+
+    return check.raw;
+    }
+
+/*
+ * A compressed data packet holding the first length bytes of body,
+ * with the byte at flip, if not 0, changed.
+ */
+static ops_memory_t *compressed_packet(ops_memory_t *body,size_t length,
+				       size_t flip)
+    {
+    ops_memory_t *out=ops_memory_new();
+    size_t start;
+
+    add_byte(out,0xc0|OPS_PTAG_CT_COMPRESSED);
+    add_byte(out,0xff);
+    add_byte(out,length >> 24);
+    add_byte(out,length >> 16);
+    add_byte(out,length >> 8);
+    add_byte(out,length);
+    start=ops_memory_get_length(out);
+    ops_memory_add(out,ops_memory_get_data(body),length);
+    if(flip)
+	((unsigned char *)ops_memory_get_data(out))[start+flip]^=0x55;
+
+    return out;
+    }
+
+static void test_decompress_broken()
+    {
+    ops_memory_t *body=compressed_body(compressed_literal(100000,1));
+    size_t total=ops_memory_get_length(body);
+    size_t length;
+    ops_boolean_t limited;
+
+    CU_ASSERT(decompress_literal(compressed_packet(body,total,0),0,0,0,
+				 &length,&limited) == 1);
+    CU_ASSERT(length == 100000);
+
+    // a stream that stops short, or is damaged, fails the read rather
+    // than an assertion
+    CU_ASSERT(decompress_literal(compressed_packet(body,total/2,0),0,0,0,
+				 &length,&limited) == 0);
+    CU_ASSERT(!limited);
+    CU_ASSERT(length < 100000);
+
+    CU_ASSERT(decompress_literal(compressed_packet(body,total,total/2),0,0,0,
+				 &length,&limited) == 0);
+    CU_ASSERT(!limited);
+    CU_ASSERT(length < 100000);
+
+    ops_memory_free(body);
+    }
+
+/* length bytes of words that compress, but not to nothing */
+static void add_words(ops_memory_t *mem,unsigned length)
+    {
+    unsigned long seed=1;
+    unsigned n;
+
+    for(n=0 ; n < length ; ++n)
+	{
+	seed=seed*1103515245+12345;
+	add_byte(mem,(seed >> 16)%8 ? 'a'+(seed >> 20)%16 : ' ');
+	}
+    }
+
+/*
+ * A literal data packet holding text, compressed on nthreads threads,
+ * or by the ordinary writer if nthreads is -1.
+ */
+static ops_memory_t *compress_text(ops_memory_t *text,int nthreads)
+    {
+    ops_memory_t *mem;
+    ops_create_info_t *cinfo;
+
+    ops_setup_memory_write(&cinfo,&mem,ops_memory_get_length(text));
+    if(nthreads < 0)
+	ops_writer_push_compressed(cinfo);
+    else
+	ops_writer_push_compressed_parallel(cinfo,nthreads);
+    CU_ASSERT(ops_write_literal_data_from_buf(ops_memory_get_data(text),
+					      ops_memory_get_length(text),
+					      OPS_LDT_BINARY,cinfo));
+    CU_ASSERT(ops_writer_close(cinfo));
+    ops_create_info_delete(cinfo);
+
+    return mem;
+    }
+
+static void test_compress_parallel()
+    {
+    ops_memory_t *text=ops_memory_new();
+    ops_memory_t *packet;
+    ops_memory_t *body;
+    ops_memory_t *out;
+    ops_errcode_t errors[10];
+    size_t serial;
+    unsigned char *inflated;
+    uLongf inflated_length;
+    static const int nthreads[]={ 0,1,4 };
+    unsigned n;
+
+    // several blocks, the last of them short
+    add_words(text,5*128*1024+1000);
+
+    packet=compress_text(text,-1);
+    serial=ops_memory_get_length(packet);
+    ops_memory_free(packet);
+
+    for(n=0 ; n < sizeof nthreads/sizeof *nthreads ; ++n)
+	{
+	packet=compress_text(text,nthreads[n]);
+	CU_ASSERT(ops_memory_get_length(packet) < serial+serial/100);
+
+	// the blocks make one zlib stream, checksum and all
+	body=ops_memory_new();
+	ops_memory_add(body,ops_memory_get_data(packet),
+		       ops_memory_get_length(packet));
+	body=compressed_body(body);
+	CU_ASSERT(((unsigned char *)ops_memory_get_data(body))[0]
+		  == OPS_C_ZLIB);
+	inflated_length=ops_memory_get_length(text)+100;
+	inflated=malloc(inflated_length);
+	CU_ASSERT(uncompress(inflated,&inflated_length,
+			     (unsigned char *)ops_memory_get_data(body)+1,
+			     ops_memory_get_length(body)-1) == Z_OK);
+	ops_memory_free(body);
+	free(inflated);
+
+	CU_ASSERT(parse_literal(packet,&out,errors,10) == 1);
+	CU_ASSERT(errors[0] == 0);
+	CU_ASSERT(ops_memory_get_length(out) == ops_memory_get_length(text));
+	CU_ASSERT(memcmp(ops_memory_get_data(out),ops_memory_get_data(text),
+			 ops_memory_get_length(text)) == 0);
+	ops_memory_free(out);
+	}
+
+    ops_memory_free(text);
+    }
+
+/*
+ * A literal data packet holding text, compressed as opts says on
+ * nthreads threads, or by the ordinary writer if nthreads is -1.
+ * Returns NULL if the writer refused the options.
+ */
+static ops_memory_t *compress_text_with_opts(ops_memory_t *text,
+					     const ops_compress_opts_t *opts,
+					     int nthreads)
+    {
+    ops_memory_t *mem;
+    ops_create_info_t *cinfo;
+    ops_boolean_t pushed;
+
+    ops_setup_memory_write(&cinfo,&mem,ops_memory_get_length(text));
+    if(nthreads < 0)
+	pushed=ops_writer_push_compressed_with_opts(cinfo,opts);
+    else
+	pushed=ops_writer_push_compressed_parallel_with_opts(cinfo,opts,
+							      nthreads);
+    if(!pushed)
+	{
+	CU_ASSERT(cinfo->errors != NULL);
+	ops_free_errors(cinfo->errors);
+	cinfo->errors=NULL;
+	ops_teardown_memory_write(cinfo,mem);
+	return NULL;
+	}
+    CU_ASSERT(ops_write_literal_data_from_buf(ops_memory_get_data(text),
+					      ops_memory_get_length(text),
+					      OPS_LDT_BINARY,cinfo));
+    CU_ASSERT(ops_writer_close(cinfo));
+    ops_create_info_delete(cinfo);
+
+    return mem;
+    }
+
+/* Check that packet, which is freed, is compressed with algorithm and
+   holds text */
+static void check_compressed(ops_memory_t *packet,ops_memory_t *text,
+			     ops_compression_type_t algorithm)
+    {
+    ops_memory_t *body=ops_memory_new();
+    ops_memory_t *out;
+    ops_errcode_t errors[10];
+
+    ops_memory_add(body,ops_memory_get_data(packet),
+		   ops_memory_get_length(packet));
+    body=compressed_body(body);
+    CU_ASSERT(((unsigned char *)ops_memory_get_data(body))[0] == algorithm);
+    ops_memory_free(body);
+
+    CU_ASSERT(parse_literal(packet,&out,errors,10) == 1);
+    CU_ASSERT(errors[0] == 0);
+    CU_ASSERT(ops_memory_get_length(out) == ops_memory_get_length(text));
+    CU_ASSERT(memcmp(ops_memory_get_data(out),ops_memory_get_data(text),
+		     ops_memory_get_length(text)) == 0);
+    ops_memory_free(out);
+    }
+
+static void test_compress_opts()
+    {
+    static const struct
+	{
+	ops_compression_type_t algorithm;
+	int level;
+	int window_bits;
+	int mem_level;
+	} good[]=
+	{
+	{ OPS_C_ZIP,1,15,8 },
+	{ OPS_C_ZIP,9,9,1 },
+	{ OPS_C_ZLIB,0,15,8 },
+	{ OPS_C_ZLIB,9,10,9 },
+	{ OPS_C_BZIP2,1,15,8 },
+	{ OPS_C_BZIP2,9,15,8 },
+	},
+      bad[]=
+	{
+	{ OPS_C_ZLIB,10,15,8 },
+	{ OPS_C_ZLIB,-2,15,8 },
+	{ OPS_C_BZIP2,0,15,8 },
+	{ OPS_C_ZIP,6,8,8 },
+	{ OPS_C_ZIP,6,16,8 },
+	{ OPS_C_ZLIB,6,15,0 },
+	{ OPS_C_ZLIB,6,15,10 },
+	};
+    ops_memory_t *text=ops_memory_new();
+    ops_memory_t *packet;
+    ops_memory_t *literal;
+    ops_create_info_t *cinfo;
+    ops_compress_opts_t opts;
+    size_t stored=0,smallest=0;
+    unsigned n;
+
+    add_words(text,300000);
+
+    for(n=0 ; n < sizeof good/sizeof *good ; ++n)
+	{
+	ops_compress_opts_init(&opts);
+	opts.algorithm=good[n].algorithm;
+	opts.level=good[n].level;
+	opts.window_bits=good[n].window_bits;
+	opts.mem_level=good[n].mem_level;
+	packet=compress_text_with_opts(text,&opts,-1);
+	CU_ASSERT_FATAL(packet != NULL);
+	if(opts.algorithm == OPS_C_ZLIB && opts.level == 0)
+	    stored=ops_memory_get_length(packet);
+	else if(opts.algorithm == OPS_C_ZLIB)
+	    smallest=ops_memory_get_length(packet);
+	check_compressed(packet,text,opts.algorithm);
+	}
+    // level 0 stores the data as it is
+    CU_ASSERT(stored > ops_memory_get_length(text));
+    CU_ASSERT(smallest < ops_memory_get_length(text));
+
+    for(n=0 ; n < sizeof bad/sizeof *bad ; ++n)
+	{
+	ops_compress_opts_init(&opts);
+	opts.algorithm=bad[n].algorithm;
+	opts.level=bad[n].level;
+	opts.window_bits=bad[n].window_bits;
+	opts.mem_level=bad[n].mem_level;
+	CU_ASSERT(compress_text_with_opts(text,&opts,-1) == NULL);
+	}
+
+    // ops_write_compressed_with_opts() compresses packets already made
+    literal=ops_memory_new();
+    add_byte(literal,0xc0|OPS_PTAG_CT_LITERAL_DATA);
+    add_byte(literal,0xff);
+    add_byte(literal,(6+300000) >> 24);
+    add_byte(literal,((6+300000) >> 16)&0xff);
+    add_byte(literal,((6+300000) >> 8)&0xff);
+    add_byte(literal,(6+300000)&0xff);
+    add_literal_header(literal);
+    ops_memory_add(literal,ops_memory_get_data(text),300000);
+
+    ops_compress_opts_init(&opts);
+    opts.algorithm=OPS_C_BZIP2;
+    ops_setup_memory_write(&cinfo,&packet,1024);
+    CU_ASSERT(ops_write_compressed_with_opts(ops_memory_get_data(literal),
+					     ops_memory_get_length(literal),
+					     &opts,cinfo));
+    ops_create_info_delete(cinfo);
+    check_compressed(packet,text,OPS_C_BZIP2);
+
+    ops_memory_free(literal);
+    ops_memory_free(text);
+    }
+
+/* length bytes that deflate can do nothing with */
+static void add_noise(ops_memory_t *mem,unsigned length)
+    {
+    unsigned long seed=1;
+    unsigned n;
+
+    for(n=0 ; n < length ; ++n)
+	{
+	seed=seed*1103515245+12345;
+	add_byte(mem,seed >> 16);
+	}
+    }
+
+static void test_compress_bypass()
+    {
+    static const int nthreads[]={ -1,2 };
+    ops_memory_t *noise=ops_memory_new();
+    ops_memory_t *short_noise=ops_memory_new();
+    ops_memory_t *text=ops_memory_new();
+    ops_memory_t *packet;
+    ops_memory_t *out;
+    ops_errcode_t errors[10];
+    ops_compress_opts_t opts;
+    ops_compress_stats_t stats;
+    unsigned n;
+
+    add_noise(noise,300000);
+    // shorter than the sample, so decided when the writer is closed
+    add_noise(short_noise,1000);
+    add_words(text,300000);
+
+    for(n=0 ; n < sizeof nthreads/sizeof *nthreads ; ++n)
+	{
+	ops_compress_opts_init(&opts);
+	opts.sample_size=65536;
+	opts.stats=&stats;
+
+	// data that doesn't compress goes out as it is
+	opts.bypass=OPS_COMPRESS_OMITTED;
+	packet=compress_text_with_opts(noise,&opts,nthreads[n]);
+	CU_ASSERT(stats.decision == OPS_COMPRESS_OMITTED);
+	CU_ASSERT(stats.sample_in == 65536);
+	CU_ASSERT(stats.sample_out > 65536*opts.max_ratio/100);
+	CU_ASSERT(stats.bytes_in > 300000);
+	CU_ASSERT(stats.bytes_out == ops_memory_get_length(packet));
+	CU_ASSERT((((unsigned char *)ops_memory_get_data(packet))[0]&0x3f)
+		  == OPS_PTAG_CT_LITERAL_DATA);
+	CU_ASSERT(parse_literal(packet,&out,errors,10) == 1);
+	CU_ASSERT(memory_equal(out,noise));
+	ops_memory_free(out);
+
+	packet=compress_text_with_opts(short_noise,&opts,nthreads[n]);
+	CU_ASSERT(stats.decision == OPS_COMPRESS_OMITTED);
+	CU_ASSERT(stats.sample_in < 65536);
+	CU_ASSERT(parse_literal(packet,&out,errors,10) == 1);
+	CU_ASSERT(memory_equal(out,short_noise));
+	ops_memory_free(out);
+
+	// or stored in a compressed packet
+	opts.bypass=OPS_COMPRESS_STORED;
+	packet=compress_text_with_opts(noise,&opts,nthreads[n]);
+	CU_ASSERT(stats.decision == OPS_COMPRESS_STORED);
+	CU_ASSERT(stats.bytes_out > stats.bytes_in);
+	check_compressed(packet,noise,OPS_C_ZLIB);
+
+	// bzip2 can't store, so that is done with ZIP
+	if(nthreads[n] < 0)
+	    {
+	    opts.algorithm=OPS_C_BZIP2;
+	    packet=compress_text_with_opts(noise,&opts,nthreads[n]);
+	    CU_ASSERT(stats.decision == OPS_COMPRESS_STORED);
+	    check_compressed(packet,noise,OPS_C_ZIP);
+	    opts.algorithm=OPS_C_ZLIB;
+	    }
+
+	// text is compressed as before
+	packet=compress_text_with_opts(text,&opts,nthreads[n]);
+	CU_ASSERT(stats.decision == OPS_COMPRESS_COMPRESSED);
+	CU_ASSERT(stats.bytes_out < stats.bytes_in);
+	check_compressed(packet,text,OPS_C_ZLIB);
+	}
+
+    ops_memory_free(noise);
+    ops_memory_free(short_noise);
+    ops_memory_free(text);
+    }
+
+/* Set crypt up with a fixed key and a zero IV */
+static void setup_crypt(ops_crypt_t *crypt,ops_symmetric_algorithm_t alg)
+    {
+    unsigned char key[OPS_MAX_KEY_SIZE];
+    unsigned char iv[OPS_MAX_BLOCK_SIZE];
+    unsigned n;
+
+    for(n=0 ; n < sizeof key ; ++n)
+	key[n]=n*7+1;
+    memset(iv,'\0',sizeof iv);
+
+    ops_crypt_any(crypt,alg);
+    crypt->set_iv(crypt,iv);
+    crypt->set_key(crypt,key);
+    }
+
+/*
+ * An SE IP packet holding a literal data packet of length bytes,
+ * encrypted with a copy of crypt
+ */
+static ops_memory_t *se_ip_literal_crypt(const ops_crypt_t *crypt,
+					 unsigned length)
+    {
+    ops_memory_t *text=ops_memory_new();
+    ops_memory_t *mem;
+    ops_create_info_t *cinfo;
+
+    add_text(text,length);
+    ops_setup_memory_write(&cinfo,&mem,length);
+    ops_writer_push_stream_encrypt_se_ip_crypt(cinfo,crypt);
+    CU_ASSERT(ops_write_literal_data_from_buf(ops_memory_get_data(text),
+					      length,OPS_LDT_BINARY,cinfo));
+    CU_ASSERT(ops_writer_close(cinfo));
+    ops_create_info_delete(cinfo);
+    ops_memory_free(text);
+
+    return mem;
+    }
+
+/* An SE IP packet holding a literal data packet of length bytes */
+static ops_memory_t *se_ip_literal(ops_symmetric_algorithm_t alg,
+				   unsigned length)
+    {
+    ops_memory_t *mem;
+    ops_crypt_t crypt;
+
+    setup_crypt(&crypt,alg);
+    ops_encrypt_init(&crypt);
+    mem=se_ip_literal_crypt(&crypt,length);
+    crypt.decrypt_finish(&crypt);
+
+    return mem;
+    }
+
+/*
+ * Decrypt in, which is freed, on nthreads threads, returning the
+ * literal data, or NULL if the parse failed.
+ */
+static ops_memory_t *decrypt_se_ip(ops_memory_t *in,
+				   ops_symmetric_algorithm_t alg,
+				   unsigned nthreads,size_t min_size,
+				   ops_boolean_t release)
+    {
+    ops_parse_info_t *pinfo;
+    ops_memory_t *mem_out;
+    ops_memory_t *out=NULL;
+
+    ops_setup_memory_read(&pinfo,in,NULL,callback_literal_data,ops_false);
+    ops_setup_memory_write(&pinfo->cbinfo.cinfo,&mem_out,128);
+    // as if a session key had been read
+    setup_crypt(&pinfo->decrypt,alg);
+    ops_parse_options_parallel_decrypt(pinfo,nthreads,min_size);
+    ops_parse_options_release_before_auth(pinfo,release);
+
+    if(ops_parse(pinfo))
+	{
+	out=ops_memory_new();
+	ops_memory_add(out,ops_memory_get_data(mem_out),
+		       ops_memory_get_length(mem_out));
+	}
+
+    ops_teardown_memory_write(pinfo->cbinfo.cinfo,mem_out);
+    ops_teardown_memory_read(pinfo,in);
+    return out;
+    }
+
+static void test_parallel_decrypt()
+    {
+    static const ops_symmetric_algorithm_t algs[]=
+	{ OPS_SA_AES_128, OPS_SA_CAST5 };
+    static const unsigned lengths[]={ 100, 100000, 1000003 };
+    unsigned a;
+    unsigned l;
+
+    for(a=0 ; a < sizeof algs/sizeof *algs ; ++a)
+	for(l=0 ; l < sizeof lengths/sizeof *lengths ; ++l)
+	    {
+	    ops_memory_t *expected=ops_memory_new();
+	    ops_memory_t *serial;
+	    ops_memory_t *parallel;
+	    ops_memory_t *windowed;
+
+	    add_text(expected,lengths[l]);
+
+	    serial=decrypt_se_ip(se_ip_literal(algs[a],lengths[l]),algs[a],
+				 1,0,ops_false);
+	    // small enough windows that the threads have work each time
+	    parallel=decrypt_se_ip(se_ip_literal(algs[a],lengths[l]),
+				   algs[a],4,65536,ops_false);
+	    windowed=decrypt_se_ip(se_ip_literal(algs[a],lengths[l]),
+				   algs[a],3,65536,ops_true);
+
+	    CU_ASSERT_FATAL(serial && parallel && windowed);
+	    CU_ASSERT(ops_memory_get_length(serial)
+		      == ops_memory_get_length(expected));
+	    CU_ASSERT(memcmp(ops_memory_get_data(serial),
+			     ops_memory_get_data(expected),
+			     ops_memory_get_length(expected)) == 0);
+	    CU_ASSERT(ops_memory_get_length(parallel)
+		      == ops_memory_get_length(serial));
+	    CU_ASSERT(memcmp(ops_memory_get_data(parallel),
+			     ops_memory_get_data(serial),
+			     ops_memory_get_length(serial)) == 0);
+	    CU_ASSERT(ops_memory_get_length(windowed)
+		      == ops_memory_get_length(serial));
+	    CU_ASSERT(memcmp(ops_memory_get_data(windowed),
+			     ops_memory_get_data(serial),
+			     ops_memory_get_length(serial)) == 0);
+
+	    ops_memory_free(windowed);
+	    ops_memory_free(parallel);
+	    ops_memory_free(serial);
+	    ops_memory_free(expected);
+	    }
+    }
+
+static void test_crypt_reuse()
+    {
+    static const ops_symmetric_algorithm_t algs[]=
+	{ OPS_SA_AES_128, OPS_SA_CAST5 };
+    unsigned a;
+    unsigned n;
+
+    for(a=0 ; a < sizeof algs/sizeof *algs ; ++a)
+	{
+	ops_memory_t *expected=ops_memory_new();
+	ops_crypt_t crypt;
+
+	add_text(expected,10000);
+	setup_crypt(&crypt,algs[a]);
+	ops_encrypt_init(&crypt);
+
+	// each packet must start from the zero IV again
+	for(n=0 ; n < 3 ; ++n)
+	    {
+	    ops_memory_t *out=decrypt_se_ip(se_ip_literal_crypt(&crypt,10000),
+					    algs[a],1,0,ops_false);
+
+	    CU_ASSERT_FATAL(out != NULL);
+	    CU_ASSERT(ops_memory_get_length(out)
+		      == ops_memory_get_length(expected));
+	    CU_ASSERT(memcmp(ops_memory_get_data(out),
+			     ops_memory_get_data(expected),
+			     ops_memory_get_length(expected)) == 0);
+	    ops_memory_free(out);
+	    }
+
+	crypt.decrypt_finish(&crypt);
+	ops_memory_free(expected);
+	}
+    }
+
+
+/*
+ * The SE IP packet the streaming writer makes of literal, encrypted
+ * with a copy of crypt and handed to it piece bytes at a time
+ */
+static ops_memory_t *se_ip_stream_pieces(const ops_crypt_t *crypt,
+					 ops_memory_t *literal,size_t piece)
+    {
+    const unsigned char *data=ops_memory_get_data(literal);
+    size_t length=ops_memory_get_length(literal);
+    ops_memory_t *mem;
+    ops_create_info_t *cinfo;
+    ops_boolean_t ok=ops_true;
+    size_t n,l;
+
+    ops_setup_memory_write(&cinfo,&mem,length);
+    ops_writer_push_stream_encrypt_se_ip_crypt(cinfo,crypt);
+    for(n=0 ; n < length && ok ; n+=l)
+	{
+	l=length-n;
+	if(l > piece)
+	    l=piece;
+	ok=ops_write(data+n,l,cinfo);
+	}
+    CU_ASSERT(ok);
+    CU_ASSERT(ops_writer_close(cinfo));
+    ops_create_info_delete(cinfo);
+
+    return mem;
+    }
+
+static void test_se_ip_fused()
+    {
+    static const ops_crypt_backend_t backends[]=
+	{ OPS_CRYPT_BACKEND_LOW_LEVEL, OPS_CRYPT_BACKEND_EVP };
+    static const unsigned lengths[]={ 0, 1, 4000, 100000 };
+    static const size_t pieces[]={ 1, 4095, 4096, 4097, 65536 };
+    unsigned b,l,p;
+
+    for(b=0 ; b < sizeof backends/sizeof *backends ; ++b)
+	for(l=0 ; l < sizeof lengths/sizeof *lengths ; ++l)
+	    {
+	    ops_memory_t *text=ops_memory_new();
+	    ops_memory_t *literal;
+	    ops_memory_t *mem;
+	    ops_memory_t *out;
+	    ops_create_info_t *cinfo;
+	    ops_crypt_t crypt;
+	    unsigned char *data;
+
+	    add_text(text,lengths[l]);
+	    ops_setup_memory_write(&cinfo,&literal,lengths[l]);
+	    CU_ASSERT(ops_write_literal_data_from_buf(ops_memory_get_data(text),
+						      lengths[l],
+						      OPS_LDT_BINARY,cinfo));
+	    ops_create_info_delete(cinfo);
+
+	    setup_crypt(&crypt,OPS_SA_AES_128);
+	    ops_crypt_set_backend(&crypt,backends[b]);
+	    ops_encrypt_init(&crypt);
+
+	    // hashing and encrypting each chunk in one go decrypts to
+	    // the same as the packet made whole in memory, however the
+	    // writes fall across the chunks
+	    for(p=0 ; p < sizeof pieces/sizeof *pieces ; ++p)
+		{
+		out=decrypt_se_ip(se_ip_stream_pieces(&crypt,literal,
+						       pieces[p]),
+				  OPS_SA_AES_128,1,0,ops_false);
+		CU_ASSERT_FATAL(out != NULL);
+		CU_ASSERT(memory_equal(out,text));
+		ops_memory_free(out);
+		}
+
+	    ops_setup_memory_write(&cinfo,&mem,lengths[l]);
+	    CU_ASSERT(ops_write_se_ip_pktset(ops_memory_get_data(literal),
+					     ops_memory_get_length(literal),
+					     &crypt,cinfo));
+	    ops_create_info_delete(cinfo);
+	    out=decrypt_se_ip(mem,OPS_SA_AES_128,1,0,ops_false);
+	    CU_ASSERT_FATAL(out != NULL);
+	    CU_ASSERT(memory_equal(out,text));
+	    ops_memory_free(out);
+
+	    // the MDC covers all of it
+	    mem=se_ip_stream_pieces(&crypt,literal,4096);
+	    data=ops_memory_get_data(mem);
+	    data[ops_memory_get_length(mem)-1]^=1;
+	    out=decrypt_se_ip(mem,OPS_SA_AES_128,1,0,ops_false);
+	    CU_ASSERT(out == NULL);
+	    if(out)
+		ops_memory_free(out);
+
+	    crypt.decrypt_finish(&crypt);
+	    ops_memory_free(literal);
+	    ops_memory_free(text);
+	    }
+    }
+
+static void test_write_compressed_stream()
+    {
+    ops_memory_t *text=ops_memory_new();
+    ops_memory_t *literal;
+    ops_memory_t *packet;
+    ops_create_info_t *cinfo;
+    unsigned char *data;
+
+    add_words(text,300000);
+    ops_setup_memory_write(&cinfo,&literal,300000);
+    CU_ASSERT(ops_write_literal_data_from_buf(ops_memory_get_data(text),
+					      300000,OPS_LDT_BINARY,cinfo));
+    ops_create_info_delete(cinfo);
+
+    ops_setup_memory_write(&cinfo,&packet,1024);
+    CU_ASSERT(ops_write_compressed(ops_memory_get_data(literal),
+				   ops_memory_get_length(literal),cinfo));
+    ops_create_info_delete(cinfo);
+
+    // new format, with a partial length, as the length isn't known
+    // until the end
+    data=ops_memory_get_data(packet);
+    CU_ASSERT(data[0] == (0xc0|OPS_PTAG_CT_COMPRESSED));
+    CU_ASSERT(data[1] >= 0xe0 && data[1] < 0xff);
+    check_compressed(packet,text,OPS_C_ZLIB);
+
+    ops_memory_free(literal);
+    ops_memory_free(text);
+    }
+
+static void test_encrypt_se_ip_stream()
+    {
+    ops_user_id_t uid;
+    ops_keydata_t *keydata;
+    ops_keydata_t pub_keydata;
+    ops_keyring_t keyring;
+    ops_memory_t *text=ops_memory_new();
+    ops_memory_t *mem;
+    ops_create_info_t *cinfo;
+    unsigned char *out;
+    int out_length;
+
+    uid.user_id=(unsigned char *)"Stream <stream@nowhere.com>";
+    keydata=ops_rsa_create_selfsigned_keypair(1024,65537,&uid);
+    CU_ASSERT_FATAL(keydata != NULL);
+    memset(&keyring,'\0',sizeof keyring);
+    keyring.nkeys=1;
+    keyring.keys=keydata;
+    // the secret key begins with the public key, so a shallow copy
+    // serves to encrypt to
+    pub_keydata=*keydata;
+    pub_keydata.type=OPS_PTAG_CT_PUBLIC_KEY;
+
+    add_words(text,300000);
+
+    // each write is its own SE IP packet, all under one session key
+    ops_setup_memory_write(&cinfo,&mem,1024);
+    ops_writer_push_encrypt_se_ip(cinfo,&pub_keydata);
+    CU_ASSERT(ops_write(ops_memory_get_data(text),200000,cinfo));
+    CU_ASSERT(ops_write((unsigned char *)ops_memory_get_data(text)+200000,
+			100000,cinfo));
+    CU_ASSERT(ops_writer_close(cinfo));
+    ops_create_info_delete(cinfo);
+
+    // compressed, so much smaller than the text
+    CU_ASSERT(ops_memory_get_length(mem) < 300000);
+
+    CU_ASSERT_FATAL(ops_decrypt_memory(ops_memory_get_data(mem),
+				       ops_memory_get_length(mem),&out,
+				       &out_length,&keyring,ops_false,NULL));
+    CU_ASSERT(out_length == 300000);
+    CU_ASSERT(memcmp(out,ops_memory_get_data(text),300000) == 0);
+
+    free(out);
+    ops_memory_free(mem);
+    ops_memory_free(text);
+    ops_keydata_free(keydata);
+    }
+
+/*
+ * Pull the items out of a compressed literal data packet, stopping
+ * after at most max bodies. Returns how many bodies came out, with
+ * their data in out.
+ */
+static unsigned next_literal(unsigned max,ops_memory_t *out)
+    {
+    ops_memory_t *in=compressed_literal(10000,1);
+    ops_parse_info_t *pinfo;
+    ops_parser_content_t content;
+    unsigned bodies=0;
+
+    ops_setup_memory_read(&pinfo,in,NULL,NULL,ops_false);
+    ops_parse_options_literal_chunk_size(pinfo,100);
+
+    while(bodies < max && ops_parse_next(pinfo,&content))
+	{
+	if(content.tag == OPS_PTAG_CT_LITERAL_DATA_BODY)
+	    {
+	    const ops_literal_data_body_t *body
+		=&content.content.literal_data_body;
+
+	    // handed out from the parser's buffer, not queued copies
+	    CU_ASSERT(body->data == pinfo->literal_buffer);
+	    ops_memory_add(out,body->data,body->length);
+	    ++bodies;
+	    }
+	ops_parser_content_free(&content);
+	}
+
+    // stopping early unwinds the rest of the parse
+    ops_teardown_memory_read(pinfo,in);
+    return bodies;
+    }
+
+static void test_next_streams()
+    {
+    ops_memory_t *expected=ops_memory_new();
+    ops_memory_t *out=ops_memory_new();
+
+    add_text(expected,10000);
+    CU_ASSERT(next_literal(1000,out) == 100);
+    CU_ASSERT(ops_memory_get_length(out) == 10000);
+    CU_ASSERT(memcmp(ops_memory_get_data(out),ops_memory_get_data(expected),
+		     10000) == 0);
+    ops_memory_free(out);
+
+    out=ops_memory_new();
+    CU_ASSERT(next_literal(3,out) == 3);
+    CU_ASSERT(ops_memory_get_length(out) == 300);
+    ops_memory_free(out);
+    ops_memory_free(expected);
+    }
+
+static ops_parse_cb_return_t callback_release(const ops_parser_content_t *content_,
+					      ops_parse_cb_info_t *cbinfo)
+    {
+    OPS_USED(content_);
+    OPS_USED(cbinfo);
+    return OPS_RELEASE_MEMORY;
+    }
+
+/* Read the keys in mem, which is freed, with lazy MPIs */
+static void read_lazy_keyring(ops_keyring_t *keyring,ops_memory_t *mem)
+    {
+    ops_parse_info_t *pinfo;
+
+    ops_setup_memory_read(&pinfo,mem,NULL,callback_release,
+			  OPS_ACCUMULATE_NO);
+    ops_parse_options(pinfo,OPS_PTAG_SS_ALL,OPS_PARSE_PARSED);
+    ops_parse_options_lazy_mpis(pinfo,ops_true);
+    CU_ASSERT(ops_parse_and_accumulate(keyring,pinfo));
+    ops_teardown_memory_read(pinfo,mem);
+    }
+
+static void test_lazy_mpis()
+    {
+    ops_user_id_t uid;
+    ops_keydata_t *keydata;
+    const ops_public_key_t *expected;
+    const ops_public_key_t *pkey;
+    const ops_public_key_t *got;
+    ops_keyring_t pub;
+    ops_keyring_t sec;
+    ops_create_info_t *cinfo;
+    ops_memory_t *mem;
+    BIGNUM *n;
+
+    uid.user_id=(unsigned char *)"Lazy <lazy@nowhere.com>";
+    keydata=ops_rsa_create_selfsigned_keypair(1024,65537,&uid);
+    CU_ASSERT_FATAL(keydata != NULL);
+    expected=&keydata->key.skey.public_key;
+
+    // a public key keeps its MPIs raw until they are asked for
+    memset(&pub,'\0',sizeof pub);
+    ops_setup_memory_write(&cinfo,&mem,128);
+    ops_write_transferable_public_key(keydata,ops_false,cinfo);
+    ops_create_info_delete(cinfo);
+    read_lazy_keyring(&pub,mem);
+    CU_ASSERT_FATAL(pub.nkeys == 1);
+    pkey=&pub.keys[0].key.pkey;
+    CU_ASSERT(pkey->raw_mpis.len != 0);
+    CU_ASSERT(!pkey->raw_mpis.borrowed);
+    CU_ASSERT(pkey->key.rsa.n == NULL);
+    got=ops_public_key_materialise(pkey);
+    CU_ASSERT_FATAL(got->key.rsa.n != NULL);
+    CU_ASSERT(BN_cmp(got->key.rsa.n,expected->key.rsa.n) == 0);
+    CU_ASSERT(BN_cmp(got->key.rsa.e,expected->key.rsa.e) == 0);
+    // and converts them once
+    n=got->key.rsa.n;
+    CU_ASSERT(ops_public_key_materialise(pkey)->key.rsa.n == n);
+    ops_keyring_free(&pub);
+
+    // a secret key's public part is always converted
+    memset(&sec,'\0',sizeof sec);
+    ops_setup_memory_write(&cinfo,&mem,128);
+    ops_write_transferable_secret_key(keydata,(const unsigned char *)"pp",2,
+				      ops_false,cinfo);
+    ops_create_info_delete(cinfo);
+    read_lazy_keyring(&sec,mem);
+    CU_ASSERT_FATAL(sec.nkeys == 1);
+    pkey=&sec.keys[0].key.skey.public_key;
+    CU_ASSERT(pkey->raw_mpis.len == 0);
+    CU_ASSERT_FATAL(pkey->key.rsa.n != NULL);
+    CU_ASSERT(BN_cmp(pkey->key.rsa.n,expected->key.rsa.n) == 0);
+    CU_ASSERT(BN_cmp(pkey->key.rsa.e,expected->key.rsa.e) == 0);
+    ops_keyring_free(&sec);
+
+    ops_keydata_free(keydata);
+    }
+
+CU_pSuite suite_parse()
+    {
+    CU_pSuite suite=NULL;
+
+    suite=CU_add_suite("Parse Suite",init_suite_parse,clean_suite_parse);
+    if(!suite)
+	return NULL;
+
+    if(NULL == CU_add_test(suite,"mmap: packets borrowed in place",
+			   test_mmap_borrow))
+	return NULL;
+
+    if(NULL == CU_add_test(suite,"Literal data: one-pass signed in chunks",
+			   test_one_pass_chunks))
+	return NULL;
+
+    if(NULL == CU_add_test(suite,"Partial Body Lengths: chained chunks",
+			   test_partial_chained))
+	return NULL;
+
+    if(NULL == CU_add_test(suite,"Partial Body Lengths: empty final chunk",
+			   test_partial_zero_final))
+	return NULL;
+
+    if(NULL == CU_add_test(suite,"Partial Body Lengths: disallowed packet type",
+			   test_partial_disallowed))
+	return NULL;
+
+    if(NULL == CU_add_test(suite,"Partial Body Lengths: truncated",
+			   test_partial_truncated))
+	return NULL;
+
+    if(NULL == CU_add_test(suite,"Spans: dearmour with and without",
+			   test_span_reads))
+	return NULL;
+
+    if(NULL == CU_add_test(suite,"Base64: groups split across lines",
+			   test_base64_lines))
+	return NULL;
+
+    if(NULL == CU_add_test(suite,"Cleartext: dash-escaping a line at a time",
+			   test_cleartext_lines))
+	return NULL;
+
+    if(NULL == CU_add_test(suite,"Options: raw and ignored packets",
+			   test_packet_options))
+	return NULL;
+
+    if(NULL == CU_add_test(suite,"Feed: packets split anywhere",
+			   test_feed_pieces))
+	return NULL;
+
+    if(NULL == CU_add_test(suite,"Feed: truncated at finish",
+			   test_feed_truncated))
+	return NULL;
+
+    if(NULL == CU_add_test(suite,"Feed: parse error",test_feed_error))
+	return NULL;
+
+    if(NULL == CU_add_test(suite,"Feed: partial bodies stream",
+			   test_feed_streams))
+	return NULL;
+
+    if(NULL == CU_add_test(suite,"Armour: checksum at a full buffer",
+			   test_armour_full_buffer))
+	return NULL;
+
+    if(NULL == CU_add_test(suite,"Decompression limits: bytes",
+			   test_decompress_bytes))
+	return NULL;
+
+    if(NULL == CU_add_test(suite,"Decompression limits: expansion",
+			   test_decompress_ratio))
+	return NULL;
+
+    if(NULL == CU_add_test(suite,"Decompression limits: depth",
+			   test_decompress_depth))
+	return NULL;
+
+    if(NULL == CU_add_test(suite,"Decompression: short and damaged streams",
+			   test_decompress_broken))
+	return NULL;
+
+    if(NULL == CU_add_test(suite,"Compression: parallel deflate",
+			   test_compress_parallel))
+	return NULL;
+
+    if(NULL == CU_add_test(suite,"Compression: options",test_compress_opts))
+	return NULL;
+
+    if(NULL == CU_add_test(suite,"Compression: bypass",test_compress_bypass))
+	return NULL;
+
+    if(NULL == CU_add_test(suite,"SE IP: parallel and serial decryption agree",
+			   test_parallel_decrypt))
+	return NULL;
+
+    if(NULL == CU_add_test(suite,"SE IP: one crypt for several packets",
+			   test_crypt_reuse))
+	return NULL;
+
+    if(NULL == CU_add_test(suite,"SE IP: fused hashing and encryption",
+			   test_se_ip_fused))
+	return NULL;
+
+    if(NULL == CU_add_test(suite,"Compression: ops_write_compressed streams",
+			   test_write_compressed_stream))
+	return NULL;
+
+    if(NULL == CU_add_test(suite,"SE IP: streamed encryption to a key",
+			   test_encrypt_se_ip_stream))
+	return NULL;
+
+    if(NULL == CU_add_test(suite,"Next: items stream",test_next_streams))
+	return NULL;
+
+    if(NULL == CU_add_test(suite,"Lazy MPIs: public and secret keys",
+			   test_lazy_mpis))
+	return NULL;
+
+    return suite;
+    }
+
+// EOF
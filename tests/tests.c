@@ -99,6 +99,13 @@ int main(int argc, char **argv)
         return CU_get_error();
         }
 
+    if (NULL == suite_parse())
+        {
+        fprintf(stderr,"ERROR: initialising suite_parse\n");
+        CU_cleanup_registry();
+        return CU_get_error();
+        }
+
     if (NULL == suite_rsa_encrypt()) 
         {
         fprintf(stderr,"ERROR: initialising suite_rsa_encrypt\n");
@@ -48,6 +48,7 @@ extern CU_pSuite suite_crypto();
 extern CU_pSuite suite_writers();
 extern CU_pSuite suite_cmdline();
 extern CU_pSuite suite_packet_types();
+extern CU_pSuite suite_parse();
 extern CU_pSuite suite_rsa_decrypt();
 extern CU_pSuite suite_rsa_encrypt();
 extern CU_pSuite suite_rsa_signature();